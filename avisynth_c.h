@@ -131,6 +131,9 @@ enum {AVS_CS_BGR = 1<<28,
       AVS_CS_SAMPLE_BITS_8     = 0 << AVS_CS_SHIFT_SAMPLE_BITS,
       AVS_CS_SAMPLE_BITS_16    = 1 << AVS_CS_SHIFT_SAMPLE_BITS,
       AVS_CS_SAMPLE_BITS_32    = 2 << AVS_CS_SHIFT_SAMPLE_BITS,
+      AVS_CS_SAMPLE_BITS_10    = 5 << AVS_CS_SHIFT_SAMPLE_BITS, // AviSynth+
+      AVS_CS_SAMPLE_BITS_12    = 6 << AVS_CS_SHIFT_SAMPLE_BITS, // AviSynth+
+      AVS_CS_SAMPLE_BITS_14    = 7 << AVS_CS_SHIFT_SAMPLE_BITS, // AviSynth+
 
       AVS_CS_PLANAR_MASK       = AVS_CS_PLANAR | AVS_CS_INTERLEAVED | AVS_CS_YUV | AVS_CS_BGR | AVS_CS_SAMPLE_BITS_MASK | AVS_CS_SUB_HEIGHT_MASK | AVS_CS_SUB_WIDTH_MASK,
       AVS_CS_PLANAR_FILTER     = ~( AVS_CS_VPLANEFIRST | AVS_CS_UPLANEFIRST )};
@@ -295,6 +298,22 @@ AVSC_INLINE int avs_bits_per_pixel(const AVS_VideoInfo * p)
       default:           return 0;
     }
 }
+// AviSynth+ high bit depth formats share the layout flags of their 8-bit counterparts
+AVSC_INLINE int avs_bits_per_component(const AVS_VideoInfo * p)
+{
+  switch (p->pixel_type & AVS_CS_SAMPLE_BITS_MASK) {
+      case AVS_CS_SAMPLE_BITS_10: return 10;
+      case AVS_CS_SAMPLE_BITS_12: return 12;
+      case AVS_CS_SAMPLE_BITS_14: return 14;
+      case AVS_CS_SAMPLE_BITS_16: return 16;
+      case AVS_CS_SAMPLE_BITS_32: return 32;
+      default:                    return 8;
+    }
+}
+
+AVSC_INLINE int avs_is_color_space_any_depth(const AVS_VideoInfo * p, int c_space)
+        { return (p->pixel_type & AVS_CS_PLANAR_MASK & ~AVS_CS_SAMPLE_BITS_MASK) == (c_space & AVS_CS_PLANAR_FILTER & ~AVS_CS_SAMPLE_BITS_MASK); }
+
 AVSC_INLINE int avs_bytes_from_pixels(const AVS_VideoInfo * p, int pixels) 
         { return pixels * (avs_bits_per_pixel(p)>>3); }   // Will work on planar images, but will return only luma planes
 
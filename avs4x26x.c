@@ -10,11 +10,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <windows.h>
+#include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
 
+#include "osdep.h"
+#include "frame.h"
+#include "framecache.h"
+#include "probecache.h"
+#include "convert.h"
+#include "progress.h"
+
 /* the AVS interface currently uses __declspec to link function declarations to their definitions in the dll.
    this has a side effect of preventing program execution if the avisynth dll is not found,
    so define __declspec(dllimport) to nothing and work around this */
@@ -23,12 +30,24 @@
 #undef EXTERN_C
 
 #include "avisynth_c.h"
+#include "remote.h"
 #include "version.h"
 
+#ifdef _WIN32
 #define DEFAULT_X264_BINARY_PATH "x264_64"
+#define AVISYNTH_LIBRARY "avisynth"
+#else
+#define DEFAULT_X264_BINARY_PATH "x264"
+#ifdef __APPLE__
+#define AVISYNTH_LIBRARY "libavisynth.dylib"
+#else
+#define AVISYNTH_LIBRARY "libavisynth.so"
+#endif
+#endif
 #define DEFAULT_X265_BINARY_PATH "x265"
 
-#define PIPE_BUFFER_SIZE (DWORD)0//1048576 // values bigger than 250000 break the application
+/* size of the kernel buffer of the pipe to x26x, 0 leaves it to the system */
+#define DEFAULT_PIPE_BUFFER_SIZE 1048576
 
 /* AVS uses a versioned interface to control backwards compatibility */
 /* YV12 support is required */
@@ -39,9 +58,36 @@
 /* maximum size of the sequence of filters to try on non script files */
 #define AVS_MAX_SEQUENCE 5
 
+/* number of packed frames rendered ahead of the pipe writer by default */
+#define DEFAULT_PREFETCH_FRAMES 2
+
+/* x26x processes fed from one render with --fanout, including the main one */
+#define MAX_OUTPUTS 8
+
+/* smallest segment worth its own x26x: each one starts with an IDR frame and a cold lookahead */
+#define SEGMENT_MIN_FRAMES 500
+/* segments per worker with --segments, so workers that finish early pick up the remaining ones */
+#define SEGMENTS_PER_WORKER 4
+#define MAX_SEGMENT_WORKERS 64
+
+/* frames of this many pixels and more are converted on worker threads besides the renderer,
+   smaller ones don't pay off. most conversions are bound by memory bandwidth, a few threads
+   saturate it. RGB does enough arithmetic per pixel to always use them */
+#define CONVERT_THREADED_PIXELS (2560 * 1440)
+#define CONVERT_WORKERS 3
+
+/* workers calling avs_get_frame with --render-threads */
+#define MAX_RENDER_THREADS 32
+
+/* time between two lines of --progress-json */
+#define PROGRESS_INTERVAL_MS 1000
+
+/* extensions that can be given a plugin with --plugin-map */
+#define MAX_PLUGIN_MAP 32
+
 #define LOAD_AVS_FUNC(name, continue_on_fail) \
 {\
-    h->func.name = (void*)GetProcAddress( h->library, #name );\
+    h->func.name = os_library_symbol( h->library, #name );\
     if( !continue_on_fail && !h->func.name )\
         goto fail;\
 }
@@ -50,7 +96,9 @@ typedef struct
 {
     AVS_Clip *clip;
     AVS_ScriptEnvironment *env;
-    HMODULE library;
+    int b_plugins_loaded;   /* 1 once the plugin mapped to the input's extension is loaded, 2 once autoloaded */
+    void *library;
+    const char *server;     /* the avs4x26x --serve whose AviSynth is used instead of the library */
     /* declare function pointers for the utilized functions to be loaded without __declspec,
        as the avisynth header does not compensate for this type of usage */
     struct
@@ -68,21 +116,22 @@ typedef struct
         void (__stdcall *avs_release_value)( AVS_Value value );
         void (__stdcall *avs_release_video_frame)( AVS_VideoFrame *frame );
         AVS_Clip *(__stdcall *avs_take_clip)( AVS_Value, AVS_ScriptEnvironment *env );
+        /* exported by AviSynth+ only, the frame struct is opaque there */
+        int (__stdcall *avs_get_pitch_p)( const AVS_VideoFrame *frame, int plane );
+        const BYTE *(__stdcall *avs_get_read_ptr_p)( const AVS_VideoFrame *frame, int plane );
+        int (__stdcall *avs_set_cache_hints)( AVS_Clip *clip, int cachehints, int frame_range );
     } func;
 } avs_hnd_t;
 
-HANDLE h_console;
-CONSOLE_SCREEN_BUFFER_INFO console_default;
-
-void print_colored(WORD color, const char *msg, ...)
+void print_colored(int color, const char *msg, ...)
 {
     va_list args;
 
-    SetConsoleTextAttribute(h_console, color);
+    os_console_color(color);
     va_start(args, msg);
     vfprintf(stderr, msg, args);
     va_end(args);
-    SetConsoleTextAttribute(h_console, console_default.wAttributes);
+    os_console_reset();
 }
 
 #define CONSOLE_WHITE      (FOREGROUND_INTENSITY | FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE)
@@ -102,10 +151,764 @@ void print_colored(WORD color, const char *msg, ...)
 #define print_success()      print_details("avs4x26x [info]: succeeded\n" );
 #define print_avs_error(res) print_colored(CONSOLE_RED, "avs [error]: %s\n", avs_as_string(res));
 
+/* time spent in each stage of the run, in microseconds, reported with --avs-stats */
+typedef struct
+{
+    int b_enabled;
+    int64_t i_start;
+    int64_t i_setup;        /* from start up to the first frame request */
+    int64_t i_probe;        /* opening the input, including plugin loading */
+    int64_t i_plugins;      /* AutoloadPlugins */
+    int64_t i_render;       /* inside avs_get_frame */
+    int64_t i_copy;         /* packing planes */
+    int64_t i_write;        /* blocked in pipe writes, i.e. waiting for x26x */
+    int64_t i_render_wait;  /* renderer waiting for a free ring slot, i.e. for x26x */
+    int64_t i_write_wait;   /* writer waiting for a rendered frame, i.e. for AviSynth */
+    int64_t i_loop;         /* the whole frame loop */
+    int *frame_latency;     /* duration of each avs_get_frame call */
+    int i_frames;
+    progress_t *progress;   /* --progress-json, counts the frames as well */
+} stats_t;
+
+static void stats_frame( stats_t *stats, int64_t i_latency )
+{
+    progress_rendered( stats->progress, 1 );
+    stats->i_render += i_latency;
+    if( stats->frame_latency )
+        stats->frame_latency[stats->i_frames] = (int)i_latency;
+    stats->i_frames++;
+}
+
+static int compare_int( const void *a, const void *b )
+{
+    return *(const int*)a - *(const int*)b;
+}
+
+static void print_stats( stats_t *stats, int b_prefetch );
+
+static void add_plane( frame_layout_t *layout, int plane_id, int width, int height )
+{
+    layout->plane_id[layout->i_planes] = plane_id;
+    layout->width[layout->i_planes] = width;
+    layout->height[layout->i_planes] = height;
+    layout->frame_size += (size_t)width * height;
+    layout->i_planes++;
+}
+
+/* copy a plane into a packed buffer, as a single copy when the source has no padding */
+static void copy_plane( char *dst, const BYTE *src, int src_pitch, int width, int height )
+{
+    if( src_pitch == width )
+    {
+        memcpy( dst, src, (size_t)width * height );
+        return;
+    }
+    for( int y = 0; y < height; y++ )
+    {
+        memcpy( dst, src, width );
+        dst += width;
+        src += src_pitch;
+    }
+}
+
+static const BYTE *frame_read_ptr( const avs_hnd_t *h, const AVS_VideoFrame *frm, int plane )
+{
+    return h->func.avs_get_read_ptr_p ? h->func.avs_get_read_ptr_p( frm, plane ) : avs_get_read_ptr_p( frm, plane );
+}
+
+static int frame_pitch( const avs_hnd_t *h, const AVS_VideoFrame *frm, int plane )
+{
+    return h->func.avs_get_pitch_p ? h->func.avs_get_pitch_p( frm, plane ) : avs_get_pitch_p( frm, plane );
+}
+
+/* whether the whole frame is converted at once from its single interleaved plane */
+static int frame_converted( const frame_layout_t *layout )
+{
+    return layout->i_format == FRAME_FORMAT_RGB24 || layout->i_format == FRAME_FORMAT_RGB32 ||
+           layout->i_format == FRAME_FORMAT_YUY2;
+}
+
+/* pack plane p of a frame into dst, converting it to the output format if needed */
+static void pack_plane( convert_pool_t *pool, const frame_layout_t *layout, int p, char *dst, const BYTE *src, int src_pitch )
+{
+    if( layout->i_format == FRAME_FORMAT_STACK16 )
+        convert_stack16( pool, dst, src, src_pitch, layout->width[p] >> 1, layout->height[p] );
+    else if( layout->i_format == FRAME_FORMAT_BOTTOM_UP )
+        copy_plane( dst, src + (ptrdiff_t)(layout->height[p] - 1) * src_pitch, -src_pitch, layout->width[p], layout->height[p] );
+    else if( ( layout->i_format == FRAME_FORMAT_YV411 || layout->i_format == FRAME_FORMAT_YUV9 ) && p )
+        convert_chroma_420( pool, dst, src, src_pitch, layout->width[p], layout->height[p],
+                            layout->i_format == FRAME_FORMAT_YUV9, layout->b_interlaced );
+    else
+        copy_plane( dst, src, src_pitch, layout->width[p], layout->height[p] );
+}
+
+/* pack all planes of a frame contiguously into dst */
+static void pack_frame( const avs_hnd_t *h, const frame_layout_t *layout, convert_pool_t *pool,
+                        const AVS_VideoFrame *frm, char *dst )
+{
+    if( frame_converted( layout ) )
+    {
+        const BYTE *src = frame_read_ptr( h, frm, AVS_PLANAR_Y );
+        int pitch = frame_pitch( h, frm, AVS_PLANAR_Y );
+        if( layout->i_format == FRAME_FORMAT_YUY2 )
+            convert_yuy2_422( pool, dst, src, pitch, layout->width[0], layout->height[0] );
+        else
+            convert_rgb_420( pool, dst, src, pitch, layout->i_format == FRAME_FORMAT_RGB24 ? 3 : 4,
+                             layout->width[0], layout->height[0], layout->b_interlaced );
+        return;
+    }
+    for( int p = 0; p < layout->i_planes; p++ )
+    {
+        pack_plane( pool, layout, p, dst, frame_read_ptr( h, frm, layout->plane_id[p] ),
+                    frame_pitch( h, frm, layout->plane_id[p] ) );
+        dst += (size_t)layout->width[p] * layout->height[p];
+    }
+}
+
+/* the marker a stream format puts before every frame */
+static int write_frame_header( pipe_out_t *h_pipe, const frame_layout_t *layout )
+{
+    return layout->frame_header ? pipe_write( h_pipe, layout->frame_header, strlen( layout->frame_header ) ) : 0;
+}
+
+/* send one frame to the pipe in a few large writes instead of one per row:
+   planes without padding go straight from the AviSynth frame buffer,
+   the others are packed into the staging buffer first */
+static int write_frame( pipe_out_t *h_pipe, const avs_hnd_t *h, const frame_layout_t *layout, convert_pool_t *pool,
+                        const AVS_VideoFrame *frm, char *staging, stats_t *stats )
+{
+    size_t pending = 0;
+    int64_t i_time;
+    if( frame_converted( layout ) )
+    {
+        i_time = os_time_us();
+        pack_frame( h, layout, pool, frm, staging );
+        stats->i_copy += os_time_us() - i_time;
+        return pipe_write( h_pipe, staging, layout->frame_size );
+    }
+    for( int p = 0; p < layout->i_planes; p++ )
+    {
+        const BYTE *src = frame_read_ptr( h, frm, layout->plane_id[p] );
+        int pitch = frame_pitch( h, frm, layout->plane_id[p] );
+        size_t plane_size = (size_t)layout->width[p] * layout->height[p];
+        if( pitch == layout->width[p] && ( layout->i_format == FRAME_FORMAT_PLANAR ||
+                                           ( layout->i_format == FRAME_FORMAT_YV411 && !p ) ||
+                                           ( layout->i_format == FRAME_FORMAT_YUV9 && !p ) ) )
+        {
+            if( pending && pipe_write( h_pipe, staging, pending ) )
+                return -1;
+            pending = 0;
+            if( pipe_write( h_pipe, (const char*)src, plane_size ) )
+                return -1;
+        }
+        else
+        {
+            i_time = os_time_us();
+            pack_plane( pool, layout, p, staging + pending, src, pitch );
+            stats->i_copy += os_time_us() - i_time;
+            pending += plane_size;
+        }
+    }
+    return pending ? pipe_write( h_pipe, staging, pending ) : 0;
+}
+
+/* keeps the frameserver clear of the end of its address space, which a 32-bit AviSynth runs into
+   long before the machine runs out of memory. the frame buffers are sized first, AviSynth's frame
+   cache is capped with SetMemoryMax to a share of what is left, and when the process still grows
+   past the budget while encoding, the ring halves its read-ahead. samples keep the peak for the report */
+typedef struct
+{
+    int64_t i_budget;               /* bytes of address space to stay below, 0 if not governed */
+    int64_t i_peak;                 /* highest usage sampled */
+    int i_shrinks;                  /* times the read-ahead was halved */
+} memgov_t;
+
+/* the default budget leaves room for fragmentation, a 32-bit process rarely gets its last few hundred MB */
+#define MEMGOV_DEFAULT_SHARE 85
+
+/* sample the address space in use, true once it is beyond the budget */
+static int memgov_sample( memgov_t *gov )
+{
+    int64_t i_used = os_address_space_used();
+    if( i_used > gov->i_peak )
+        gov->i_peak = i_used;
+    return gov->i_budget && i_used > gov->i_budget;
+}
+
+/* bounded ring of packed frames between the renderer and the pipe writer threads, one per x26x.
+   frame n always lives in slot n % i_depth, so every writer takes frames in order and the
+   renderer can never get more than i_depth frames ahead of the slowest one. the slots are
+   read-only for the writers, so all of them send the same buffer. with i_lag, a slot is only
+   reused once that many more frames have been written after it, for pipes that keep
+   references to the pages instead of copies (vmsplice) */
+struct frame_ring_t;
+
+typedef struct
+{
+    struct frame_ring_t *ring;
+    pipe_out_t *h_pipe;
+    os_thread_t thread;
+    int b_thread;
+    int i_next_write;               /* i_frame_end once finished or failed */
+    int i_write_error;              /* frame the writer failed on, -1 if none */
+    int64_t i_write_time;           /* blocked in pipe writes */
+    int64_t i_wait_time;            /* waiting for the renderer */
+} ring_output_t;
+
+typedef struct frame_ring_t
+{
+    const frame_layout_t *layout;
+    os_mutex_t mutex;
+    os_cond_t cv_filled;            /* a slot was filled or the ring was aborted */
+    os_cond_t cv_emptied;           /* a slot was written out or the ring was aborted */
+    int i_depth;
+    int i_lag;
+    char **slot_data;
+    int *slot_frame;                /* frame stored in the slot, -1 before the first one */
+    int i_frame_end;
+    int b_abort;
+    ring_output_t out[MAX_OUTPUTS];
+    int i_outputs;
+    int i_failed;
+    memgov_t *gov;                  /* sampled on every acquire, NULL for none */
+    progress_t *progress;           /* told about the frames the slowest writer wrote */
+    struct encoder_watch_t *watch;  /* aborts the ring when x26x dies, NULL if none */
+    int i_next_acquire;             /* one past the highest frame acquired */
+    int i_shrink_depth;             /* depth to shrink to once the ring drains up to i_shrink_frame, 0 if none */
+    int i_shrink_frame;             /* frame of the pending or last shrink */
+} frame_ring_t;
+
+static os_thread_ret OS_THREAD_CC ring_writer( void *arg )
+{
+    ring_output_t *out = arg;
+    frame_ring_t *ring = out->ring;
+    os_mutex_lock( &ring->mutex );
+    while( out->i_next_write < ring->i_frame_end )
+    {
+        int slot;
+        int64_t i_time = os_time_us();
+        /* the depth may shrink while waiting for the frame */
+        while( !ring->b_abort && ring->slot_frame[slot = out->i_next_write % ring->i_depth] != out->i_next_write )
+            os_cond_wait( &ring->cv_filled, &ring->mutex );
+        if( ring->b_abort )
+            break;
+        os_mutex_unlock( &ring->mutex );
+
+        int64_t i_write_start = os_time_us();
+        out->i_wait_time += i_write_start - i_time;
+        int ret = write_frame_header( out->h_pipe, ring->layout ) ||
+                  pipe_write( out->h_pipe, ring->slot_data[slot], ring->layout->frame_size );
+        out->i_write_time += os_time_us() - i_write_start;
+
+        os_mutex_lock( &ring->mutex );
+        if( ret )
+        {
+            /* a dead x26x must not hold back the others, the ring only gives up once all are gone */
+            out->i_write_error = out->i_next_write;
+            out->i_next_write = ring->i_frame_end;
+            if( ++ring->i_failed == ring->i_outputs )
+            {
+                ring->b_abort = 1;
+                os_cond_broadcast( &ring->cv_filled );
+            }
+            os_cond_broadcast( &ring->cv_emptied );
+            break;
+        }
+        out->i_next_write++;
+        if( ring->progress )
+        {
+            int b_slowest = 1;
+            for( int i = 0; i < ring->i_outputs; i++ )
+                b_slowest &= ring->out[i].i_next_write >= out->i_next_write;
+            if( b_slowest )
+                progress_written( ring->progress, out->i_next_write, out->i_write_time );
+        }
+        os_cond_broadcast( &ring->cv_emptied );
+    }
+    os_mutex_unlock( &ring->mutex );
+    return 0;
+}
+
+static void ring_close( frame_ring_t *ring );
+
+static int ring_init( frame_ring_t *ring, pipe_out_t *h_pipes, int i_outputs, const frame_layout_t *layout,
+                      int i_depth, int i_lag, int i_frame_start, int i_frame_end, memgov_t *gov, progress_t *progress )
+{
+    memset( ring, 0, sizeof(*ring) );
+    ring->layout = layout;
+    ring->gov = gov;
+    ring->progress = progress;
+    ring->i_next_acquire = i_frame_start;
+    ring->i_depth = i_depth + i_lag;
+    ring->i_lag = i_lag;
+    i_depth = ring->i_depth;
+    ring->i_frame_end = i_frame_end;
+    os_mutex_init( &ring->mutex );
+    os_cond_init( &ring->cv_filled );
+    os_cond_init( &ring->cv_emptied );
+    ring->slot_data = calloc( i_depth, sizeof(char*) );
+    ring->slot_frame = malloc( i_depth * sizeof(int) );
+    if( !ring->slot_data || !ring->slot_frame )
+        goto fail;
+    /* a lag means the slots are handed to the pipe with vmsplice, which references whole pages:
+       they get pages of their own, so later heap writes never land in what the reader gets */
+    size_t page = os_page_size();
+    for( int i = 0; i < i_depth; i++ )
+    {
+        ring->slot_frame[i] = -1;
+        ring->slot_data[i] = i_lag ? aligned_malloc_align( (layout->frame_size + page - 1) & ~(page - 1), page )
+                                   : aligned_malloc( layout->frame_size );
+        if( !ring->slot_data[i] )
+            goto fail;
+    }
+    for( ; ring->i_outputs < i_outputs; ring->i_outputs++ )
+    {
+        ring_output_t *out = &ring->out[ring->i_outputs];
+        out->ring = ring;
+        out->h_pipe = &h_pipes[ring->i_outputs];
+        out->i_next_write = i_frame_start;
+        out->i_write_error = -1;
+        if( os_thread_create( &out->thread, ring_writer, out ) )
+            goto fail;
+        out->b_thread = 1;
+    }
+    return 0;
+fail:
+    ring_close( ring );
+    return -1;
+}
+
+/* with every frame before i_shrink_frame written out, free the slots beyond the new depth */
+static void ring_shrink( frame_ring_t *ring )
+{
+    print_warning("\navs4x26x [warning]: Address space use beyond the memory budget, rendering %d %s ahead instead of %d\n",
+                  ring->i_shrink_depth, ring->i_shrink_depth == 1 ? "frame" : "frames", ring->i_depth );
+    for( int i = ring->i_shrink_depth; i < ring->i_depth; i++ )
+    {
+        aligned_free( ring->slot_data[i] );
+        ring->slot_data[i] = NULL;
+    }
+    for( int i = 0; i < ring->i_shrink_depth; i++ )
+        ring->slot_frame[i] = -1;
+    ring->i_depth = ring->i_shrink_depth;
+    ring->i_shrink_depth = 0;
+    ring->gov->i_shrinks++;
+    os_cond_broadcast( &ring->cv_emptied );
+}
+
+/* wait for the slot of the given frame to be written out by every writer, NULL if the ring was aborted.
+   a ring over the memory budget is shrunk at the first frame not acquired yet: frames from there
+   on wait for all before it to be written, the slots are empty then and can be remapped. pages
+   lent to a pipe (i_lag) stay in use after being written, so such a ring keeps its size */
+static char *ring_acquire( frame_ring_t *ring, int frame )
+{
+    char *data = NULL;
+    os_mutex_lock( &ring->mutex );
+    /* after a shrink, give AviSynth two turns of the ring to settle before the next one */
+    if( ring->gov && memgov_sample( ring->gov ) && !ring->i_shrink_depth && !ring->i_lag && ring->i_depth > 1 &&
+        (!ring->gov->i_shrinks || ring->i_next_acquire >= ring->i_shrink_frame + 2 * ring->i_depth) )
+    {
+        ring->i_shrink_depth = ring->i_depth / 2;
+        ring->i_shrink_frame = ring->i_next_acquire;
+    }
+    for( ;; )
+    {
+        int i_slowest = ring->i_frame_end;
+        for( int i = 0; i < ring->i_outputs; i++ )
+            if( ring->out[i].i_next_write < i_slowest )
+                i_slowest = ring->out[i].i_next_write;
+        if( ring->b_abort )
+            break;
+        if( ring->i_shrink_depth && frame >= ring->i_shrink_frame && i_slowest == ring->i_shrink_frame )
+            ring_shrink( ring );
+        if( (!ring->i_shrink_depth || frame < ring->i_shrink_frame) && frame < i_slowest + ring->i_depth - ring->i_lag )
+            break;
+        os_cond_wait( &ring->cv_emptied, &ring->mutex );
+    }
+    if( !ring->b_abort )
+    {
+        data = ring->slot_data[frame % ring->i_depth];
+        if( frame >= ring->i_next_acquire )
+            ring->i_next_acquire = frame + 1;
+    }
+    os_mutex_unlock( &ring->mutex );
+    return data;
+}
+
+static void ring_commit( frame_ring_t *ring, int frame )
+{
+    os_mutex_lock( &ring->mutex );
+    ring->slot_frame[frame % ring->i_depth] = frame;
+    os_cond_broadcast( &ring->cv_filled );
+    os_mutex_unlock( &ring->mutex );
+}
+
+static void ring_abort( frame_ring_t *ring )
+{
+    os_mutex_lock( &ring->mutex );
+    ring->b_abort = 1;
+    os_cond_broadcast( &ring->cv_filled );
+    os_cond_broadcast( &ring->cv_emptied );
+    os_mutex_unlock( &ring->mutex );
+}
+
+/* wait for the writers to drain the ring, returns the number of writers that failed */
+static int ring_finish( frame_ring_t *ring )
+{
+    for( int i = 0; i < ring->i_outputs; i++ )
+        if( ring->out[i].b_thread )
+        {
+            os_thread_join( ring->out[i].thread );
+            ring->out[i].b_thread = 0;
+        }
+    return ring->i_failed;
+}
+
+static void watch_ring( struct encoder_watch_t *w, frame_ring_t *ring );
+
+static void ring_close( frame_ring_t *ring )
+{
+    if( ring->watch )
+        watch_ring( ring->watch, NULL );
+    ring_abort( ring );
+    ring_finish( ring );
+    /* the last frames are still in the pipe, not copied */
+    for( int o = 0; ring->i_lag && o < ring->i_outputs; o++ )
+        pipe_drain( ring->out[o].h_pipe );
+    for( int i = 0; ring->slot_data && i < ring->i_depth; i++ )
+        aligned_free( ring->slot_data[i] );
+    free( ring->slot_data );
+    free( ring->slot_frame );
+    ring->slot_data = NULL;
+    ring->slot_frame = NULL;
+    os_cond_destroy( &ring->cv_filled );
+    os_cond_destroy( &ring->cv_emptied );
+    os_mutex_destroy( &ring->mutex );
+}
+
+/* watches the x26x processes from threads of their own, so one exiting before its pipe was closed
+   is noticed right away instead of at the next write, which can be a long render away. once every
+   x26x is gone the ring is aborted and the frame loops stop requesting frames. a frame already in
+   avs_get_frame can't be cancelled through the C API and is let finish */
+struct encoder_watch_t;
+
+typedef struct
+{
+    struct encoder_watch_t *watch;
+    os_process_t *process;
+    os_thread_t thread;
+    int b_thread;
+    int b_early;                    /* exited before its pipe was closed */
+    int i_exitcode;
+    int i_delivered;                /* frames written to its pipe, set by the frame loops */
+} watch_output_t;
+
+typedef struct encoder_watch_t
+{
+    os_mutex_t mutex;
+    watch_output_t out[MAX_OUTPUTS];
+    int i_outputs;
+    int i_early;
+    int b_closing;                  /* the pipes are being closed, x26x exit now */
+    frame_ring_t *ring;             /* aborted once every x26x is gone, NULL if there is none */
+} encoder_watch_t;
+
+static os_thread_ret OS_THREAD_CC watch_thread( void *arg )
+{
+    watch_output_t *out = arg;
+    encoder_watch_t *w = out->watch;
+    int i_exitcode = os_process_wait( out->process );
+    os_mutex_lock( &w->mutex );
+    out->i_exitcode = i_exitcode;
+    if( !w->b_closing )
+    {
+        out->b_early = 1;
+        if( ++w->i_early == w->i_outputs )
+        {
+            print_error("\navs4x26x [error]: x26x exited with code %d, no more frames are requested\n", i_exitcode );
+            if( w->ring )
+                ring_abort( w->ring );
+        }
+        else
+            print_warning("\navs4x26x [warning]: x26x %d exited with code %d, the others go on\n",
+                          (int)(out - w->out) + 1, i_exitcode );
+    }
+    os_mutex_unlock( &w->mutex );
+    return 0;
+}
+
+static void watch_start( encoder_watch_t *w, os_process_t *process, int i_outputs )
+{
+    os_mutex_init( &w->mutex );
+    w->i_outputs = i_outputs;
+    for( int o = 0; o < i_outputs; o++ )
+    {
+        w->out[o].watch = w;
+        w->out[o].process = &process[o];
+        w->out[o].b_thread = !os_thread_create( &w->out[o].thread, watch_thread, &w->out[o] );
+    }
+}
+
+/* every x26x exited before the end of its input */
+static int watch_cancelled( encoder_watch_t *w )
+{
+    if( !w->i_outputs )
+        return 0;
+    os_mutex_lock( &w->mutex );
+    int b_cancelled = w->i_early == w->i_outputs;
+    os_mutex_unlock( &w->mutex );
+    return b_cancelled;
+}
+
+/* let the watch abort ring, NULL detaches it before the ring goes away */
+static void watch_ring( encoder_watch_t *w, frame_ring_t *ring )
+{
+    if( !w->i_outputs )
+        return;
+    os_mutex_lock( &w->mutex );
+    if( ring )
+    {
+        ring->watch = w;
+        if( w->i_early == w->i_outputs )
+            ring_abort( ring );
+    }
+    else if( w->ring )
+        w->ring->watch = NULL;
+    w->ring = ring;
+    os_mutex_unlock( &w->mutex );
+}
+
+/* called before closing the pipes, x26x are expected to exit from then on */
+static void watch_closing( encoder_watch_t *w )
+{
+    if( !w->i_outputs )
+        return;
+    os_mutex_lock( &w->mutex );
+    w->b_closing = 1;
+    os_mutex_unlock( &w->mutex );
+}
+
+/* wait for x26x o to exit, returns its exit code and reports it if it died early */
+static int watch_wait( encoder_watch_t *w, int o, int i_frame_start )
+{
+    watch_output_t *out = &w->out[o];
+    if( !out->b_thread )
+        return os_process_wait( out->process );
+    os_thread_join( out->thread );
+    out->b_thread = 0;
+    if( !out->b_early )
+        return out->i_exitcode;
+    char name[16] = "x26x";
+    if( w->i_outputs > 1 )
+        snprintf( name, sizeof(name), "x26x %d", o + 1 );
+    if( out->i_delivered > i_frame_start )
+        print_error("avs4x26x [error]: %s exited with code %d before the end of its input, the last frame written to it was %d\n",
+                    name, out->i_exitcode, out->i_delivered - 1 );
+    else
+        print_error("avs4x26x [error]: %s exited with code %d before any frame was written to it\n", name, out->i_exitcode );
+    return out->i_exitcode;
+}
+
+/* hand a rendered frame to the frame cache, a failing cache is dropped without stopping the encode */
+static void cache_frame( framecache_t **cache, int frame, const char *data )
+{
+    if( *cache && framecache_put( *cache, frame, data ) )
+    {
+        print_warning("avs4x26x [warning]: Couldn't write frame %d to the frame cache, caching disabled\n", frame );
+        framecache_close( *cache, 0 );
+        *cache = NULL;
+    }
+}
+
+/* --render-threads: every worker takes the next frame, renders it into its ring slot and commits
+   it, so AviSynth+ MT and source filters can work on several frames at once. the ring is the
+   reorder buffer, the writers still take the frames in order, and bounds how far ahead the
+   workers get. with b_linear the avs_get_frame calls are made one at a time in frame order,
+   for scripts that can only be read linearly; packing still overlaps. the frame cache takes
+   frames in order as well */
+typedef struct
+{
+    frame_ring_t *ring;
+    const avs_hnd_t *h;
+    const frame_layout_t *layout;
+    convert_pool_t *pool;
+    framecache_t **cache;
+    stats_t *stats;
+    int b_linear;
+    int b_cache;                    /* frames go through the cache in order, even once it has been dropped */
+    os_mutex_t mutex;
+    os_cond_t cv;                   /* i_next_get or i_next_cache moved, or the workers stopped */
+    int b_stop;                     /* a frame failed or the ring was aborted */
+    int i_next_frame;               /* next frame to be taken by a worker */
+    int i_next_get;                 /* with b_linear, the frame whose avs_get_frame is due */
+    int i_next_cache;               /* next frame for the frame cache */
+    int i_frame_end;
+    int i_error;                    /* frame AviSynth failed on, -1 if none */
+    char error[256];
+} render_ctx_t;
+
+/* wait for *turn to reach frame, 0 if the workers were stopped meanwhile */
+static int render_wait_turn( render_ctx_t *r, const int *turn, int frame )
+{
+    while( *turn != frame && !r->b_stop )
+        os_cond_wait( &r->cv, &r->mutex );
+    return !r->b_stop;
+}
+
+/* a worker giving up on its frame can't let the others wait for its turn */
+static void render_stop( render_ctx_t *r )
+{
+    os_mutex_lock( &r->mutex );
+    r->b_stop = 1;
+    os_cond_broadcast( &r->cv );
+    os_mutex_unlock( &r->mutex );
+    ring_abort( r->ring );
+}
+
+static os_thread_ret OS_THREAD_CC render_worker( void *arg )
+{
+    render_ctx_t *r = arg;
+    for( ;; )
+    {
+        os_mutex_lock( &r->mutex );
+        int frame = !r->b_stop && r->i_next_frame < r->i_frame_end ? r->i_next_frame++ : -1;
+        os_mutex_unlock( &r->mutex );
+        if( frame < 0 )
+            break;
+        int64_t i_time = os_time_us();
+        char *data = ring_acquire( r->ring, frame );
+        if( !data )
+        {
+            render_stop( r );
+            break;
+        }
+        int64_t i_render_start = os_time_us();
+
+        os_mutex_lock( &r->mutex );
+        int b_ok = !r->b_linear || render_wait_turn( r, &r->i_next_get, frame );
+        os_mutex_unlock( &r->mutex );
+        if( !b_ok )
+            break;
+        AVS_VideoFrame *frm = r->h->func.avs_get_frame( r->h->clip, frame );
+        int64_t i_rendered = os_time_us();
+
+        os_mutex_lock( &r->mutex );
+        r->stats->i_render_wait += i_render_start - i_time;
+        stats_frame( r->stats, i_rendered - i_render_start );
+        /* the clip has one error slot for all the workers, which the next frame request clears:
+           only a missing frame is an error, and the slot is read before the next turn starts */
+        if( !frm && r->i_error < 0 )
+        {
+            const char *err = r->h->func.avs_clip_get_error( r->h->clip );
+            r->i_error = frame;
+            snprintf( r->error, sizeof(r->error), "%s", err ? err : "Error" );
+        }
+        r->i_next_get++;
+        os_cond_broadcast( &r->cv );
+        os_mutex_unlock( &r->mutex );
+        if( !frm )
+        {
+            render_stop( r );
+            break;
+        }
+
+        pack_frame( r->h, r->layout, r->pool, frm, data );
+        r->h->func.avs_release_video_frame( frm );
+        os_mutex_lock( &r->mutex );
+        if( r->b_cache && (b_ok = render_wait_turn( r, &r->i_next_cache, frame )) )
+        {
+            cache_frame( r->cache, frame, data );
+            r->i_next_cache++;
+            os_cond_broadcast( &r->cv );
+        }
+        r->stats->i_copy += os_time_us() - i_rendered;
+        os_mutex_unlock( &r->mutex );
+        if( !b_ok )
+            break;
+        ring_commit( r->ring, frame );
+    }
+    return 0;
+}
+
+/* render [i_frame_start, i_frame_end) into the ring on i_threads threads, the calling one included.
+   returns the frame AviSynth failed on with its error in r->error, -1 if none */
+static int render_frames( render_ctx_t *r, int i_threads, int i_frame_start )
+{
+    os_thread_t threads[MAX_RENDER_THREADS];
+    int i_started = 0;
+    r->i_next_frame = r->i_next_get = r->i_next_cache = i_frame_start;
+    r->i_error = -1;
+    r->b_stop = 0;
+    r->b_cache = *r->cache != NULL;
+    os_mutex_init( &r->mutex );
+    os_cond_init( &r->cv );
+    while( i_started < i_threads - 1 && !os_thread_create( &threads[i_started], render_worker, r ) )
+        i_started++;
+    render_worker( r );
+    for( int i = 0; i < i_started; i++ )
+        os_thread_join( threads[i] );
+    os_cond_destroy( &r->cv );
+    os_mutex_destroy( &r->mutex );
+    return r->i_error;
+}
+
+/* the cache key covers everything that decides the frames we render: the input file and its
+   version, the clip's format and length, and the frozen frames of a fast seek */
+static uint64_t cache_key( const char *infile, const AVS_VideoInfo *vi, const frame_layout_t *layout, int i_freeze )
+{
+    int64_t i_size, i_mtime;
+    if( os_file_info( infile, &i_size, &i_mtime ) )
+        return 0;
+    int fields[9] = { vi->width, vi->height, vi->pixel_type, vi->num_frames, (int)vi->fps_numerator, (int)vi->fps_denominator, i_freeze,
+                      layout->i_format, layout->b_interlaced };
+    uint64_t key = framecache_hash( FRAMECACHE_HASH_INIT, infile, strlen( infile ) );
+    key = framecache_hash( key, &i_size, sizeof(i_size) );
+    key = framecache_hash( key, &i_mtime, sizeof(i_mtime) );
+    key = framecache_hash( key, fields, sizeof(fields) );
+    return framecache_hash( key, &layout->frame_size, sizeof(layout->frame_size) );
+}
+
+static void print_stats( stats_t *stats, int b_prefetch )
+{
+    print_info("avs4x26x [stats]: setup %.3f s, opening the input %.3f s, of which loading plugins %.3f s\n",
+               stats->i_setup / 1e6, stats->i_probe / 1e6, stats->i_plugins / 1e6 );
+    if( !stats->i_frames )
+        return;
+    print_info("avs4x26x [stats]: %d frames in %.3f s (%.2f fps): avs_get_frame %.3f s, copying planes %.3f s, "
+               "blocked in pipe writes %.3f s\n", stats->i_frames, stats->i_loop / 1e6,
+               stats->i_loop ? stats->i_frames * 1e6 / stats->i_loop : 0.0,
+               stats->i_render / 1e6, stats->i_copy / 1e6, stats->i_write / 1e6 );
+    if( stats->frame_latency )
+    {
+        int *lat = stats->frame_latency;
+        int n = stats->i_frames;
+        qsort( lat, n, sizeof(int), compare_int );
+        print_info("avs4x26x [stats]: avs_get_frame latency ms: min %.2f, p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n",
+                   lat[0] / 1e3, lat[n / 2] / 1e3, lat[(int)(n * 0.9)] / 1e3, lat[(int)(n * 0.99)] / 1e3, lat[n - 1] / 1e3 );
+    }
+
+    /* with prefetching, whichever side waits for the other is the faster one.
+       without it, compare the time spent rendering with the time spent blocked on x26x */
+    int64_t i_frameserver, i_encoder;
+    if( b_prefetch )
+    {
+        i_frameserver = stats->i_write_wait;
+        i_encoder = stats->i_render_wait;
+        print_info("avs4x26x [stats]: x26x waited %.3f s for frames, AviSynth waited %.3f s for x26x\n",
+                   i_frameserver / 1e6, i_encoder / 1e6 );
+    }
+    else
+    {
+        i_frameserver = stats->i_render + stats->i_copy;
+        i_encoder = stats->i_write;
+    }
+    print_colored(CONSOLE_WHITE, "avs4x26x [stats]: bottleneck: %s\n", i_frameserver > i_encoder ? "frameserver" : "encoder" );
+}
+
 /* load the library and functions we require from it */
 static int avs_load_library( avs_hnd_t *h )
 {
-    h->library = LoadLibrary( "avisynth" );
+    h->library = os_library_open( AVISYNTH_LIBRARY );
     if( !h->library )
         return -1;
     LOAD_AVS_FUNC( avs_clip_get_error, 0 );
@@ -120,12 +923,37 @@ static int avs_load_library( avs_hnd_t *h )
     LOAD_AVS_FUNC( avs_release_value, 0 );
     LOAD_AVS_FUNC( avs_release_video_frame, 0 );
     LOAD_AVS_FUNC( avs_take_clip, 0 );
+    LOAD_AVS_FUNC( avs_get_pitch_p, 1 );
+    LOAD_AVS_FUNC( avs_get_read_ptr_p, 1 );
+    LOAD_AVS_FUNC( avs_set_cache_hints, 1 );
     return 0;
 fail:
-    FreeLibrary( h->library );
+    os_library_close( h->library );
     return -1;
 }
 
+/* talk to an avs4x26x --serve instead, the connection is made with the script environment */
+static void remote_load( avs_hnd_t *h, const char *server )
+{
+    remote_set_server( server );
+    h->server = server;
+    h->func.avs_clip_get_error = remote_clip_get_error;
+    h->func.avs_create_script_environment = remote_create_script_environment;
+    h->func.avs_delete_script_environment = remote_delete_script_environment;
+    h->func.avs_get_frame = remote_get_frame;
+    h->func.avs_get_version = remote_get_version;
+    h->func.avs_get_video_info = remote_get_video_info;
+    h->func.avs_function_exists = remote_function_exists;
+    h->func.avs_invoke = remote_invoke;
+    h->func.avs_release_clip = remote_release_clip;
+    h->func.avs_release_value = remote_release_value;
+    h->func.avs_release_video_frame = remote_release_video_frame;
+    h->func.avs_take_clip = remote_take_clip;
+    h->func.avs_get_pitch_p = remote_get_pitch_p;
+    h->func.avs_get_read_ptr_p = remote_get_read_ptr_p;
+    h->func.avs_set_cache_hints = remote_set_cache_hints;
+}
+
 /*
  * @deprecated Use get_avs_version_string instead
  *
@@ -177,194 +1005,1162 @@ static char const *get_avs_version_string( avs_hnd_t avs_h )
     return ret;
 }
 
-static AVS_Value update_clip( avs_hnd_t avs_h, const AVS_VideoInfo *vi, AVS_Value res, AVS_Value release )
+static AVS_Value update_clip( avs_hnd_t *avs_h, const AVS_VideoInfo **vi, AVS_Value res, AVS_Value release )
 {
-    avs_h.func.avs_release_clip( avs_h.clip );
-    avs_h.clip = avs_h.func.avs_take_clip( res, avs_h.env );
-    avs_h.func.avs_release_value( release );
-    vi = avs_h.func.avs_get_video_info( avs_h.clip );
+    avs_h->func.avs_release_clip( avs_h->clip );
+    avs_h->clip = avs_h->func.avs_take_clip( res, avs_h->env );
+    avs_h->func.avs_release_value( release );
+    *vi = avs_h->func.avs_get_video_info( avs_h->clip );
     return res;
 }
 
-#define AUTO_LOAD_PLUGINS \
-/* AviSynth+ need explicit invoke of AutoloadPlugins() for registering plugins functions */             \
-if( avs_h.func.avs_function_exists( avs_h.env, "AutoloadPlugins" ) )                                    \
-{                                                                                                       \
-    res = avs_h.func.avs_invoke( avs_h.env, "AutoloadPlugins", avs_new_value_array( NULL, 0 ), NULL );  \
-    if( avs_is_error( res ) )                                                                           \
-        print_error( "AutoloadPlugins failed: %s\n", avs_as_string( res ) );                            \
-}
-
-char* generate_new_commandline(int argc, char *argv[], int b_hbpp_vfw, int i_frame_total,
-                              int i_fps_num, int i_fps_den, int i_width, int i_height, char* infile,
-                              const char* csp, int b_tc, int i_encode_frames, int b_x265 )
+/* remember a successful source filter call for the probe cache, the input file itself is
+   stored as a reference so the entry doesn't depend on how the path was spelled */
+static void probe_record( probe_result_t *probe, const char *infile, const char *filter, AVS_Value args, const char **names )
 {
-    int i;
-    char *cmd, *buf;
-    int b_add_fps      = 1;
-    int b_add_csp      = 1;
-    int b_add_res      = 1;
-    int b_add_timebase = b_tc;
-    char *x26x_binary;
-    x26x_binary = b_x265 ? DEFAULT_X265_BINARY_PATH : DEFAULT_X264_BINARY_PATH;
-    buf = malloc(20);
-    *buf=0;
-    cmd = malloc(8192);
-    for (i=1;i<argc;i++)
-    {
-        if( !strncmp(argv[i], "--x26x-binary", 13) || !strncmp(argv[i], "-L", 2) ||
-            !strncmp(argv[i], "--x264-binary", 13) || !strncmp(argv[i], "--x265-binary", 13)
-            /* preserved for legacy usage */
-          )
-        {
-            if( !strcmp(argv[i], "--x26x-binary") || !strcmp(argv[i], "-L") ||
-                !strcmp(argv[i], "--x264-binary") || !strcmp(argv[i], "--x265-binary") )
-            {
-                x26x_binary = argv[i+1];
-                for (int k=i;k<argc-2;k++)
-                    argv[k] = argv[k+2];
-                argc -= 2;
-            }
-            else if( !strncmp(argv[i], "--x26x-binary=", 14) ||
-                     !strncmp(argv[i], "--x264-binary=", 14) || !strncmp(argv[i], "--x265-binary=", 14) )
-            {
-                x26x_binary = argv[i]+14;
-                for (int k=i;k<argc-1;k++)
-                    argv[k] = argv[k+1];
-                argc--;
-            }
-            else if( !strncmp(argv[i], "-L=", 3) )
-            {
-                x26x_binary = argv[i]+3;
-                for (int k=i;k<argc-1;k++)
-                    argv[k] = argv[k+1];
-                argc--;
-            }
-            else                           /* else argv[i] should have structure like -Lx26x */
-            {
-                x26x_binary = argv[i]+2;
-                for (int k=i;k<argc-1;k++)
-                    argv[k] = argv[k+1];
-                argc--;
-            }
-            i--;
-        }
-    }
-    if ( b_tc )
+    if( probe->i_steps < 0 )
+        return;
+    probe_step_t *step = &probe->steps[probe->i_steps];
+    int n = avs_array_size( args );
+    if( probe->i_steps == PROBE_MAX_STEPS || n > PROBE_MAX_ARGS || strlen( filter ) >= sizeof(step->filter) )
+        goto fail;
+    strcpy( step->filter, filter );
+    step->i_args = n;
+    for( int k = 0; k < n; k++ )
     {
-        b_add_fps = 0;
-        for (i=1;i<argc;i++)
+        AVS_Value v = avs_array_elt( args, k );
+        probe_arg_t *a = &step->args[k];
+        if( names && names[k] && strlen( names[k] ) >= sizeof(a->name) )
+            goto fail;
+        strcpy( a->name, names && names[k] ? names[k] : "" );
+        if( avs_is_string( v ) && infile && !strcmp( avs_as_string( v ), infile ) )
         {
-            if( !strncmp(argv[i], "--timebase", 10) )
-            {
-                b_add_timebase = 0;
-                break;
-            }
+            a->type = '@';
+            *a->value = 0;
+        }
+        else if( avs_is_string( v ) && strlen( avs_as_string( v ) ) < sizeof(a->value) )
+        {
+            a->type = 's';
+            strcpy( a->value, avs_as_string( v ) );
+        }
+        else if( avs_is_bool( v ) || avs_is_int( v ) )
+        {
+            a->type = avs_is_bool( v ) ? 'b' : 'i';
+            sprintf( a->value, "%d", avs_is_bool( v ) ? avs_as_bool( v ) : avs_as_int( v ) );
         }
+        else if( avs_is_float( v ) )
+        {
+            a->type = 'f';
+            sprintf( a->value, "%.9g", avs_as_float( v ) );
+        }
+        else
+            goto fail;
     }
+    probe->i_steps++;
+    return;
+fail:
+    probe->i_steps = -1;
+}
+
+/* invoke a source filter while probing the input. the call is timed in the log, and the calls
+   since the last failure are recorded: they are the ones that opened the input */
+static AVS_Value probe_invoke( avs_hnd_t *h, probe_result_t *probe, const char *infile, const char *filter,
+                               AVS_Value args, const char **names )
+{
+    int64_t i_start = os_time_us();
+    AVS_Value res = h->func.avs_invoke( h->env, filter, args, names );
+    print_details("avs4x26x [info]: %s %s after %.3f s\n", filter, avs_is_error( res ) ? "failed" : "returned",
+                  (os_time_us() - i_start) / 1e6 );
+    if( avs_is_error( res ) )
+        probe->i_steps = 0;
     else
+        probe_record( probe, infile, filter, args, names );
+    return res;
+}
+
+/* make the calls of a cached probe again, the last one returns the clip */
+static int probe_replay( avs_hnd_t *h, const probe_result_t *probe, const char *infile, AVS_Value *res )
+{
+    for( int k = 0; k < probe->i_steps; k++ )
     {
-        for (i=1;i<argc;i++)
+        const probe_step_t *step = &probe->steps[k];
+        AVS_Value args[PROBE_MAX_ARGS];
+        const char *names[PROBE_MAX_ARGS];
+        int b_named = 0;
+        for( int j = 0; j < step->i_args; j++ )
         {
-            if( !strncmp(argv[i], "--fps", 5) )
+            const probe_arg_t *a = &step->args[j];
+            names[j] = *a->name ? a->name : NULL;
+            b_named |= !!*a->name;
+            switch( a->type )
             {
-                b_add_fps = 0;
-                break;
+                case '@': args[j] = avs_new_value_string( infile ); break;
+                case 's': args[j] = avs_new_value_string( a->value ); break;
+                case 'b': args[j] = avs_new_value_bool( atoi( a->value ) ); break;
+                case 'i': args[j] = avs_new_value_int( atoi( a->value ) ); break;
+                default:  args[j] = avs_new_value_float( (float)atof( a->value ) ); break;
             }
         }
-    }
-    for (i=1;i<argc;i++)
-    {
-        if( !strncmp(argv[i], "--input-csp", 11) )
+        if( !h->func.avs_function_exists( h->env, step->filter ) )
         {
-            b_add_csp = 0;
-            break;
+            print_warning("avs4x26x [warning]: \"%s\" not found\n", step->filter );
+            return -1;
         }
-    }
-    for (i=1;i<argc;i++)
+        int64_t i_start = os_time_us();
+        AVS_Value ret = h->func.avs_invoke( h->env, step->filter, avs_new_value_array( args, step->i_args ),
+                                            b_named ? names : NULL );
+        print_details("avs4x26x [info]: %s %s after %.3f s\n", step->filter, avs_is_error( ret ) ? "failed" : "returned",
+                      (os_time_us() - i_start) / 1e6 );
+        if( avs_is_error( ret ) )
+        {
+            print_avs_error(ret);
+            return -1;
+        }
+        if( k < probe->i_steps - 1 )
+            h->func.avs_release_value( ret );
+        else
+            *res = ret;
+    }
+    return probe->i_steps > 0 ? 0 : -1;
+}
+
+/* index files written next to the input by the source filters we try */
+static void probe_find_index( probe_result_t *probe, const char *infile )
+{
+    static const char * const suffixes[] = { ".lwi", ".ffindex", NULL };
+    int64_t i_size, i_mtime;
+    *probe->index = 0;
+    for( int k = 0; suffixes[k]; k++ )
     {
-        if( !strncmp(argv[i], "--input-res", 11) )
+        snprintf( probe->index, sizeof(probe->index), "%s%s", infile, suffixes[k] );
+        if( !os_file_info( probe->index, &i_size, &i_mtime ) )
+            return;
+    }
+    *probe->index = 0;
+}
+
+/* parse "ext=plugin[;ext=plugin...]" into pairs of allocated strings */
+static int parse_plugin_map( const char *str, char **plugin_map, int *i_plugin_map )
+{
+    while( *str )
+    {
+        size_t len = strcspn( str, ";" );
+        const char *eq = memchr( str, '=', len );
+        if( !eq || eq == str || eq == str + len - 1 || *i_plugin_map == 2 * MAX_PLUGIN_MAP )
+            return -1;
+        int b_dot = *str == '.';
+        char *ext = malloc( eq - str + 2 );
+        char *path = malloc( str + len - eq );
+        if( !ext || !path )
         {
-            b_add_res = 0;
-            break;
+            free( ext );
+            free( path );
+            return -1;
         }
+        sprintf( ext, "%s%.*s", b_dot ? "" : ".", (int)(eq - str), str );
+        sprintf( path, "%.*s", (int)(str + len - eq - 1), eq + 1 );
+        plugin_map[(*i_plugin_map)++] = ext;
+        plugin_map[(*i_plugin_map)++] = path;
+        str += len + !!str[len];
     }
-    for (i=argc-1;i>0;i--)
+    return 0;
+}
+
+/* load plugins at most once per run, and only once a source filter from a plugin is needed.
+   if the input's extension is in the plugin map only that plugin is loaded, otherwise
+   AviSynth+ is asked to autoload its plugin directories. AviSynth 2.6 autoloads by itself */
+static void load_plugins( avs_hnd_t *h, const char *ext, char **plugin_map, int i_plugin_map, stats_t *stats )
+{
+    AVS_Value res;
+    if( h->b_plugins_loaded )
+        return;
+    h->b_plugins_loaded = 1;
+    int64_t i_start = os_time_us();
+    for( int k = 0; ext && k < i_plugin_map; k += 2 )
+    {
+        if( strcasecmp( plugin_map[k], ext ) )
+            continue;
+        res = h->func.avs_invoke( h->env, "LoadPlugin", avs_new_value_string( plugin_map[k+1] ), NULL );
+        if( avs_is_error( res ) && h->func.avs_function_exists( h->env, "LoadCPlugin" ) )
+            res = h->func.avs_invoke( h->env, "LoadCPlugin", avs_new_value_string( plugin_map[k+1] ), NULL );
+        if( !avs_is_error( res ) )
+        {
+            h->func.avs_release_value( res );
+            stats->i_plugins += os_time_us() - i_start;
+            print_details("avs4x26x [info]: loaded \"%s\" for %s in %.3f s\n", plugin_map[k+1], ext, stats->i_plugins / 1e6 );
+            return;
+        }
+        print_warning("avs4x26x [warning]: LoadPlugin(\"%s\") failed: %s\n", plugin_map[k+1], avs_as_string( res ) );
+        break;
+    }
+    /* AviSynth+ need explicit invoke of AutoloadPlugins() for registering plugins functions */
+    h->b_plugins_loaded = 2;
+    if( h->func.avs_function_exists( h->env, "AutoloadPlugins" ) )
+    {
+        res = h->func.avs_invoke( h->env, "AutoloadPlugins", avs_new_value_array( NULL, 0 ), NULL );
+        if( avs_is_error( res ) )
+            print_error( "AutoloadPlugins failed: %s\n", avs_as_string( res ) );
+        stats->i_plugins += os_time_us() - i_start;
+        print_details("avs4x26x [info]: autoloaded plugins in %.3f s\n", stats->i_plugins / 1e6 );
+    }
+}
+
+/* a file x26x reads by frame number, --qpfile or --tcfile-in. when fast seek skips frames here,
+   x26x is given a copy renumbered from the first frame it reads */
+typedef struct
+{
+    const char *option;
+    const char *file;       /* as named on the command line */
+    char shifted[1024];     /* the renumbered copy, empty if there is none */
+} shifted_file_t;
+
+static int blank_line( const char *line )
+{
+    return !line[strspn( line, " \t\r\n" )];
+}
+
+/* qpfile lines are "frame type [qp]", those of the frames skipped are dropped */
+static int shift_qpfile( FILE *in, FILE *out, int i_seek )
+{
+    char line[1024];
+    while( fgets( line, sizeof(line), in ) )
     {
-#define FIND_HBPP                                                                  \
-{                                                                                  \
-  i_width >>= 1;                                                                   \
-  print_info("avs4x26x [info]: High bit depth detected, resolution corrected\n" ); \
-  break;                                                                           \
+        char *end;
+        long frame = strtol( line, &end, 10 );
+        if( blank_line( line ) )
+            continue;
+        if( end == line )
+            return -1;
+        if( frame >= i_seek )
+            fprintf( out, "%ld%s", frame - i_seek, end );
+    }
+    return ferror( in ) ? -1 : 0;
 }
-        if( b_hbpp_vfw == 1 )
-            FIND_HBPP
-        else if( !strncmp(argv[i], "--input-depth", 13) )
+
+/* a v2 file lists a timestamp per frame, the ones of the frames skipped are dropped and the rest
+   keep their time. v1 lists "start,end,fps" ranges over a default rate, they are moved down by
+   i_seek, which restarts the encode at time 0 as v1 times run from its first frame */
+static int shift_tcfile( FILE *in, FILE *out, int i_seek )
+{
+    char line[1024];
+    int i_version = 0, i_frame = 0;
+    if( !fgets( line, sizeof(line), in ) || sscanf( line, "# timecode format v%d", &i_version ) != 1 ||
+        (i_version != 1 && i_version != 2) )
+        return -1;
+    fputs( line, out );
+    while( fgets( line, sizeof(line), in ) )
+    {
+        int i_start, i_end, n = 0;
+        if( *line == '#' || blank_line( line ) )
+            fputs( line, out );
+        else if( i_version == 2 )
         {
-            if( !strcmp(argv[i], "--input-depth") )
-            {
-                if( strcmp(argv[++i], "8") )
-                    FIND_HBPP
-            }
-            else if( strcmp(argv[i], "--input-depth=8") )
-                FIND_HBPP
+            if( i_frame++ >= i_seek )
+                fputs( line, out );
+        }
+        else if( sscanf( line, "%d,%d,%n", &i_start, &i_end, &n ) == 2 && n )
+        {
+            if( i_end >= i_seek )
+                fprintf( out, "%d,%d,%s", i_start > i_seek ? i_start - i_seek : 0, i_end - i_seek, line + n );
+        }
+        else
+            fputs( line, out );     /* "assume fps" */
+    }
+    return ferror( in ) ? -1 : 0;
+}
+
+static int shift_file( shifted_file_t *s, int i_seek )
+{
+    FILE *in = fopen( s->file, "rb" );
+    FILE *out = in ? os_temp_file( s->shifted, sizeof(s->shifted) ) : NULL;
+    int ret = -1;
+    if( out )
+        ret = strcmp( s->option, "--qpfile" ) ? shift_tcfile( in, out, i_seek ) : shift_qpfile( in, out, i_seek );
+    if( in )
+        fclose( in );
+    if( out && fclose( out ) )
+        ret = -1;
+    if( ret && out )
+        remove( s->shifted );
+    if( ret )
+        *s->shifted = 0;
+    return ret;
+}
+
+static void remove_shifted( shifted_file_t *shifted, int i_shifted )
+{
+    for( int k = 0; k < i_shifted; k++ )
+    {
+        if( *shifted[k].shifted )
+            remove( shifted[k].shifted );
+        *shifted[k].shifted = 0;
+    }
+}
+
+/* the options avs4x26x takes for itself or reads from those of x26x, parsed in one pass by parse_options */
+enum
+{
+    OPT_INTERLACED,
+    OPT_QPFILE,
+    OPT_TCFILE_IN,
+    OPT_INPUT_DEPTH,
+    OPT_OUTPUT,
+    OPT_SAR,
+    OPT_FPS,
+    OPT_TIMEBASE,
+    OPT_INPUT_CSP,
+    OPT_INPUT_RES,
+    OPT_AUDIOFILE,
+    OPT_PASS,
+    OPT_NO_PROGRESS,
+    OPT_STITCHABLE,
+    OPT_X26X_BINARY,
+    OPT_SEEK,
+    OPT_FRAMES,
+    OPT_SEEK_MODE,
+    OPT_Y4M,
+    OPT_CONVERT,
+    OPT_INPUT_FORMAT,
+    OPT_PREFETCH_FRAMES,
+    OPT_RENDER_THREADS,
+    OPT_RENDER_LINEAR,
+    OPT_AVS_THREADS,
+    OPT_PROGRESS_JSON,
+    OPT_MEMORY_BUDGET,
+    OPT_AVS_CACHE_HINTS,
+    OPT_PIPE_BUFFER,
+    OPT_FRAME_CACHE,
+    OPT_SERVER,
+    OPT_PLUGIN_MAP,
+    OPT_PROBE_CACHE,
+    OPT_FANOUT,
+    OPT_SEGMENTS,
+    OPT_STATS,
+    OPT_AVS_FRESH_ENV,
+    OPT_JOBS,
+    OPT_SERVE,
+    OPT_COUNT
+};
+
+/* how an option is given its value */
+enum
+{
+    OPT_FLAG,       /* "--name" */
+    OPT_VALUE,      /* "--name value" or "--name=value", short options also "-nvalue" */
+    OPT_OPTIONAL,   /* "--name" or "--name=value" */
+};
+
+static const struct
+{
+    const char *name;
+    int id;
+    int i_value;
+    int b_x26x;     /* an x26x option we read too, it stays on the x26x command line */
+} option_table[] =
+{
+    { "--interlaced",        OPT_INTERLACED,      OPT_FLAG,     1 },
+    { "--tff",               OPT_INTERLACED,      OPT_FLAG,     1 },
+    { "--bff",               OPT_INTERLACED,      OPT_FLAG,     1 },
+    { "--qpfile",            OPT_QPFILE,          OPT_VALUE,    1 },
+    { "--tcfile-in",         OPT_TCFILE_IN,       OPT_VALUE,    1 },
+    { "--input-depth",       OPT_INPUT_DEPTH,     OPT_VALUE,    1 },
+    { "--output",            OPT_OUTPUT,          OPT_VALUE,    1 },
+    { "-o",                  OPT_OUTPUT,          OPT_VALUE,    1 },
+    { "--sar",               OPT_SAR,             OPT_VALUE,    1 },
+    { "--fps",               OPT_FPS,             OPT_VALUE,    1 },
+    { "--timebase",          OPT_TIMEBASE,        OPT_VALUE,    1 },
+    { "--input-csp",         OPT_INPUT_CSP,       OPT_VALUE,    1 },
+    { "--input-res",         OPT_INPUT_RES,       OPT_VALUE,    1 },
+    { "--audiofile",         OPT_AUDIOFILE,       OPT_VALUE,    1 },
+    { "--pass",              OPT_PASS,            OPT_VALUE,    1 },
+    { "-p",                  OPT_PASS,            OPT_VALUE,    1 },
+    { "--no-progress",       OPT_NO_PROGRESS,     OPT_FLAG,     1 },
+    { "--stitchable",        OPT_STITCHABLE,      OPT_FLAG,     1 },
+    /* --x264-binary and --x265-binary are preserved for legacy usage */
+    { "--x26x-binary",       OPT_X26X_BINARY,     OPT_VALUE,    0 },
+    { "--x264-binary",       OPT_X26X_BINARY,     OPT_VALUE,    0 },
+    { "--x265-binary",       OPT_X26X_BINARY,     OPT_VALUE,    0 },
+    { "-L",                  OPT_X26X_BINARY,     OPT_VALUE,    0 },
+    { "--seek",              OPT_SEEK,            OPT_VALUE,    0 },
+    { "--frames",            OPT_FRAMES,          OPT_VALUE,    0 },
+    { "--seek-mode",         OPT_SEEK_MODE,       OPT_VALUE,    0 },
+    { "--y4m",               OPT_Y4M,             OPT_FLAG,     0 },
+    { "--stdout",            OPT_Y4M,             OPT_FLAG,     0 },
+    { "--convert",           OPT_CONVERT,         OPT_VALUE,    0 },
+    { "--input-format",      OPT_INPUT_FORMAT,    OPT_VALUE,    0 },
+    { "--prefetch-frames",   OPT_PREFETCH_FRAMES, OPT_VALUE,    0 },
+    { "--render-threads",    OPT_RENDER_THREADS,  OPT_VALUE,    0 },
+    { "--render-linear",     OPT_RENDER_LINEAR,   OPT_FLAG,     0 },
+    { "--avs-threads",       OPT_AVS_THREADS,     OPT_VALUE,    0 },
+    { "--progress-json",     OPT_PROGRESS_JSON,   OPT_VALUE,    0 },
+    { "--memory-budget",     OPT_MEMORY_BUDGET,   OPT_VALUE,    0 },
+    { "--avs-cache-hints",   OPT_AVS_CACHE_HINTS, OPT_OPTIONAL, 0 },
+    { "--pipe-buffer",       OPT_PIPE_BUFFER,     OPT_VALUE,    0 },
+    { "--frame-cache",       OPT_FRAME_CACHE,     OPT_VALUE,    0 },
+    { "--server",            OPT_SERVER,          OPT_VALUE,    0 },
+    { "--plugin-map",        OPT_PLUGIN_MAP,      OPT_VALUE,    0 },
+    { "--probe-cache",       OPT_PROBE_CACHE,     OPT_VALUE,    0 },
+    { "--fanout",            OPT_FANOUT,          OPT_VALUE,    0 },
+    { "--segments",          OPT_SEGMENTS,        OPT_VALUE,    0 },
+    { "--avs-stats",         OPT_STATS,           OPT_FLAG,     0 },
+    { "--avs-fresh-env",     OPT_AVS_FRESH_ENV,   OPT_FLAG,     0 },
+    { "--jobs",              OPT_JOBS,            OPT_VALUE,    0 },
+    { "--serve",             OPT_SERVE,           OPT_VALUE,    0 },
+    { NULL }
+};
+
+/* how each argument of a command line was read by parse_options, ARG_OTHER for what avs4x26x
+   leaves to x26x untouched and the value of an option for ARG_VALUE, the index in option_table otherwise */
+enum
+{
+    ARG_VALUE = -2,
+    ARG_OTHER = -1,
+};
+
+/* a command line with every argument tagged, and what the x26x options we read on it say */
+typedef struct
+{
+    int argc;
+    char **argv;            /* argv[0] is the program name */
+    short *arg_option;
+    int b_fanout;           /* the options of a --fanout encoder, all of which but the binary go to x26x */
+    unsigned char b_found[OPT_COUNT];
+    const char *x26x_binary;
+    const char *outfile;
+    const char *input_depth;    /* of the last --input-depth */
+    const char *sar;
+    char interlace;         /* 't', 'b' or 'p' as in a YUV4MPEG2 header, from the last of --tff/--bff/--interlaced */
+    char **split;           /* the allocation the arguments of a --fanout encoder point into */
+} arglist_t;
+
+typedef struct
+{
+    arglist_t args;         /* the whole command line, segments are started with it */
+    char **inputs;          /* the arguments that may name the input, by their extension */
+    int i_inputs;
+    int b_interlaced;
+    const char *interlaced; /* the option that set it, for the warning */
+    int b_qp;               /* x26x options we need to know about, they stay on the x26x command line */
+    const char *qpfile;
+    int b_tc;
+    const char *tcfile_in;
+    int i_seek;
+    int i_frames;           /* -1 if not given */
+    int b_seek_safe;
+    int b_y4m;              /* YUV4MPEG2 on stdout instead of raw frames to x26x */
+    int b_convert_internal;
+    int i_input_format;
+    int i_prefetch;
+    int i_render_threads;
+    int b_render_linear;
+    int i_avs_threads;
+    const char *progress_target;
+    int i_memory_budget;
+    int i_cache_range;
+    long i_pipe_buffer;
+    const char *cache_dir;
+    const char *server;
+    char *plugin_map[2 * MAX_PLUGIN_MAP];
+    int i_plugin_map;
+    const char *probe_file;
+    char probe_file_buf[1024];
+    const char *fanout[MAX_OUTPUTS];
+    arglist_t fanout_args[MAX_OUTPUTS]; /* the command line of each --fanout encoder, from 1 */
+    int i_outputs;
+    int i_segment_workers;
+    int b_stats;
+    int b_fresh_env;
+    const char *jobs_file;
+    const char *serve;
+} options_t;
+
+static void free_arglist( arglist_t *a )
+{
+    free( a->arg_option );
+    if( a->b_fanout )
+    {
+        free( a->argv );
+        free( a->split );
+    }
+}
+
+static void free_options( options_t *opt )
+{
+    for( int k = 0; k < opt->i_plugin_map; k++ )
+        free( opt->plugin_map[k] );
+    free_arglist( &opt->args );
+    for( int o = 1; o < opt->i_outputs; o++ )
+        free_arglist( &opt->fanout_args[o] );
+    free( opt->inputs );
+}
+
+/* the option_table entry argv[i] is, -1 if none. its value is stored in value, NULL if it has none,
+   and the number of arguments it takes up in n */
+static int match_option( int argc, char *argv[], int i, const char **value, int *n )
+{
+    *value = NULL;
+    *n = 1;
+    for( int o = 0; option_table[o].name; o++ )
+    {
+        size_t len = strlen( option_table[o].name );
+        if( strncmp( argv[i], option_table[o].name, len ) )
+            continue;
+        if( !argv[i][len] )
+        {
+            if( option_table[o].i_value == OPT_VALUE && i+1 < argc )
+                *value = argv[i+1], *n = 2;
+            return o;
+        }
+        if( option_table[o].i_value != OPT_FLAG && argv[i][len] == '=' )
+        {
+            *value = argv[i] + len + 1;
+            return o;
+        }
+        if( option_table[o].i_value == OPT_VALUE && option_table[o].name[1] != '-' )
+        {
+            *value = argv[i] + len;
+            return o;
+        }
+    }
+    return -1;
+}
+
+/* the number of arguments the option at argv[i] of a takes up */
+static int arg_width( const arglist_t *a, int i )
+{
+    return i+1 < a->argc && a->arg_option[i+1] == ARG_VALUE ? 2 : 1;
+}
+
+/* the value of the option at argv[i] of a, NULL if it has none */
+static const char *arg_value( const arglist_t *a, int i )
+{
+    const char *name = option_table[a->arg_option[i]].name;
+    size_t len = strlen( name );
+    if( arg_width( a, i ) == 2 )
+        return a->argv[i+1];
+    if( !a->argv[i][len] )
+        return NULL;
+    return a->argv[i] + len + (a->argv[i][len] == '=');
+}
+
+/* tag argv[i] of a as the option o taking up n arguments, noting what it says */
+static void arglist_note( arglist_t *a, int i, int o, const char *value, int n )
+{
+    a->arg_option[i] = o;
+    if( n == 2 )
+        a->arg_option[i+1] = ARG_VALUE;
+    if( o < 0 )
+        return;
+    a->b_found[option_table[o].id] = 1;
+    switch( option_table[o].id )
+    {
+        case OPT_INTERLACED:
+            a->interlace = strcmp( option_table[o].name, "--bff" ) ? 't' : 'b';
+            break;
+        case OPT_OUTPUT:
+            a->outfile = value;
+            break;
+        case OPT_INPUT_DEPTH:
+            a->input_depth = value;
             break;
+        case OPT_SAR:
+            a->sar = value;
+            break;
+        case OPT_X26X_BINARY:
+            a->x26x_binary = value;
+            break;
+    }
+}
+
+/* the command line of a --fanout encoder: its own options, then the options of the main command
+   line describing the piped stream that it doesn't set. every x26x reads the same stream */
+static int fanout_arglist( arglist_t *a, const char *options, const arglist_t *main_args )
+{
+    static const int stream_options[] = { OPT_INPUT_DEPTH, OPT_INPUT_CSP, OPT_INPUT_RES, OPT_FPS,
+                                          OPT_TIMEBASE, OPT_TCFILE_IN, -1 };
+    memset( a, 0, sizeof(*a) );
+    a->b_fanout = 1;
+    a->interlace = 'p';
+    a->split = split_commandline( options );
+    int i_split = 0;
+    while( a->split && a->split[i_split] )
+        i_split++;
+    a->argv = a->split ? malloc( (i_split + main_args->argc + 1) * sizeof(char*) ) : NULL;
+    a->arg_option = malloc( (i_split + main_args->argc + 1) * sizeof(short) );
+    if( !a->argv || !a->arg_option )
+        return -1;
+    a->argv[a->argc] = main_args->argv[0];
+    a->arg_option[a->argc++] = ARG_OTHER;
+    for( int i = 0; i < i_split; i++ )
+        a->argv[a->argc++] = a->split[i];
+    for( int i = 1; i < a->argc; i++ )
+    {
+        const char *value;
+        int n;
+        arglist_note( a, i, match_option( a->argc, a->argv, i, &value, &n ), value, n );
+        i += n - 1;
+    }
+    unsigned char b_set[OPT_COUNT];
+    memcpy( b_set, a->b_found, sizeof(b_set) );
+    for( int i = 1; i < main_args->argc; i++ )
+    {
+        int o = main_args->arg_option[i];
+        if( o < 0 )
+            continue;
+        int n = arg_width( main_args, i ), b_stream = 0;
+        for( int k = 0; stream_options[k] >= 0; k++ )
+            b_stream |= option_table[o].id == stream_options[k];
+        if( b_stream && !b_set[option_table[o].id] )
+        {
+            for( int k = 0; k < n; k++ )
+                a->argv[a->argc + k] = main_args->argv[i + k];
+            arglist_note( a, a->argc, o, arg_value( main_args, i ), n );
+            a->argc += n;
         }
-#undef FIND_HBPP
+        i += n - 1;
     }
+    a->argv[a->argc] = NULL;
+    return 0;
+}
 
-    sprintf(cmd, "\"%s\" - ", x26x_binary);
+/* read the command line in one pass: our options into opt, every argument tagged in opt->args,
+   the x26x options we need to know about noted there too. the values point into argv.
+   returns -1 after printing the error, opt is to be freed with free_options either way */
+static int parse_options( int argc, char *argv[], options_t *opt )
+{
+    int o = 0;
+    memset( opt, 0, sizeof(*opt) );
+    opt->i_frames = -1;
+    opt->b_convert_internal = 1;
+    opt->i_prefetch = DEFAULT_PREFETCH_FRAMES;
+    opt->i_render_threads = 1;
+    opt->i_memory_budget = -1;
+    opt->i_cache_range = -1;
+    opt->i_pipe_buffer = DEFAULT_PIPE_BUFFER_SIZE;
+    opt->probe_file = probecache_default_file( opt->probe_file_buf, sizeof(opt->probe_file_buf) );
+    opt->i_outputs = 1;
+    opt->args.argc = argc;
+    opt->args.argv = argv;
+    opt->args.interlace = 'p';
+    opt->args.arg_option = malloc( (argc + 1) * sizeof(short) );
+    opt->inputs = malloc( (argc + 1) * sizeof(char*) );
+    if( !opt->args.arg_option || !opt->inputs )
+        return -1;
+    opt->args.arg_option[0] = ARG_OTHER;
 
-    for (i=1;i<argc;i++)
+    for( int i = 1; i < argc; i++ )
     {
-        if ( infile!=argv[i] || !strcmp(argv[i-1], "--audiofile") )
+        const char *value;
+        int n;
+        o = match_option( argc, argv, i, &value, &n );
+        arglist_note( &opt->args, i, o, value, n );
+        if( o < 0 )
         {
-            if (strrchr(argv[i], ' '))
-            {
-                strcat(cmd, "\"");
-                strcat(cmd, argv[i]);
-                strcat(cmd, "\"");
-            }
-            else
-                strcat(cmd, argv[i]);
-            if(i<argc-1)
-                strcat(cmd, " ");
+            const char *ext = strrchr( argv[i], '.' );
+            if( ext && strlen( ext ) <= 5 )
+                opt->inputs[opt->i_inputs++] = argv[i];
+            continue;
+        }
+        if( !option_table[o].b_x26x && option_table[o].i_value == OPT_VALUE && !value )
+            goto invalid;
+        i += n - 1;
+
+        char *end;
+        switch( option_table[o].id )
+        {
+            case OPT_INTERLACED:
+                if( !opt->b_interlaced )
+                    opt->interlaced = argv[i];
+                opt->b_interlaced = 1;
+                break;
+            case OPT_QPFILE:
+                opt->b_qp = 1;
+                opt->qpfile = value;
+                break;
+            case OPT_TCFILE_IN:
+                opt->b_tc = 1;
+                opt->tcfile_in = value;
+                break;
+            case OPT_SEEK:
+                opt->i_seek = atoi( value );
+                break;
+            case OPT_FRAMES:
+                opt->i_frames = atoi( value );
+                if( opt->i_frames < 0 )
+                    goto invalid;
+                break;
+            case OPT_SEEK_MODE:
+                if( !strcasecmp( value, "safe" ) )
+                    opt->b_seek_safe = 1;
+                else if( !strcasecmp( value, "fast" ) )
+                    opt->b_seek_safe = 0;
+                else
+                    goto invalid;
+                break;
+            case OPT_Y4M:
+                opt->b_y4m = 1;
+                break;
+            case OPT_CONVERT:
+                if( !strcasecmp( value, "internal" ) )
+                    opt->b_convert_internal = 1;
+                else if( !strcasecmp( value, "avisynth" ) )
+                    opt->b_convert_internal = 0;
+                else
+                {
+                    print_error("avs4x26x [error]: invalid convert \"%s\"\n", value );
+                    return -1;
+                }
+                break;
+            case OPT_INPUT_FORMAT:
+                if( !strcasecmp( value, "stack16" ) )
+                    opt->i_input_format = FRAME_FORMAT_STACK16;
+                else if( !strcasecmp( value, "native" ) )
+                    opt->i_input_format = FRAME_FORMAT_PLANAR;
+                else
+                {
+                    print_error("avs4x26x [error]: invalid input-format \"%s\"\n", value );
+                    return -1;
+                }
+                break;
+            case OPT_PREFETCH_FRAMES:
+                opt->i_prefetch = atoi( value );
+                if( opt->i_prefetch < 0 )
+                {
+                    print_error("avs4x26x [error]: prefetch-frames must not be negative\n" );
+                    return -1;
+                }
+                break;
+            case OPT_RENDER_THREADS:
+                opt->i_render_threads = atoi( value );
+                if( opt->i_render_threads < 1 || opt->i_render_threads > MAX_RENDER_THREADS )
+                {
+                    print_error("avs4x26x [error]: render-threads must be between 1 and %d\n", MAX_RENDER_THREADS );
+                    return -1;
+                }
+                break;
+            case OPT_RENDER_LINEAR:
+                opt->b_render_linear = 1;
+                break;
+            case OPT_AVS_THREADS:
+                opt->i_avs_threads = !strcmp(value, "auto") ? os_cpu_count() : atoi(value);
+                if( opt->i_avs_threads < 0 || opt->i_avs_threads > 256 || (strcmp(value, "auto") && (*value < '0' || *value > '9')) )
+                {
+                    print_error("avs4x26x [error]: avs-threads must be between 0 and 256 or auto\n" );
+                    return -1;
+                }
+                break;
+            case OPT_PROGRESS_JSON:
+                if( !*value )
+                    goto invalid;
+                opt->progress_target = value;
+                break;
+            case OPT_MEMORY_BUDGET:
+                opt->i_memory_budget = atoi( value );
+                if( opt->i_memory_budget < 0 )
+                {
+                    print_error("avs4x26x [error]: memory-budget must be a number of MB, 0 to disable\n" );
+                    return -1;
+                }
+                break;
+            case OPT_AVS_CACHE_HINTS:
+                /* 0 sizes the range to the frames in flight */
+                opt->i_cache_range = value ? atoi( value ) : 0;
+                if( opt->i_cache_range < 0 || (value && !opt->i_cache_range) )
+                {
+                    print_error("avs4x26x [error]: avs-cache-hints range must be a positive number of frames\n" );
+                    return -1;
+                }
+                break;
+            case OPT_PIPE_BUFFER:
+                opt->i_pipe_buffer = strtol( value, &end, 10 );
+                if( *end == 'k' || *end == 'K' )
+                    opt->i_pipe_buffer <<= 10, end++;
+                else if( *end == 'm' || *end == 'M' )
+                    opt->i_pipe_buffer <<= 20, end++;
+                if( *end || opt->i_pipe_buffer < 0 || opt->i_pipe_buffer > 256 << 20 )
+                {
+                    print_error("avs4x26x [error]: invalid pipe-buffer \"%s\"\n", value );
+                    return -1;
+                }
+                break;
+            case OPT_FRAME_CACHE:
+                if( !*value )
+                    goto invalid;
+                opt->cache_dir = value;
+                break;
+            case OPT_SERVER:
+                if( !*value )
+                    goto invalid;
+                opt->server = value;
+                break;
+            case OPT_PLUGIN_MAP:
+                if( parse_plugin_map( value, opt->plugin_map, &opt->i_plugin_map ) )
+                {
+                    print_error("avs4x26x [error]: invalid plugin-map, expected ext=plugin[;ext=plugin...]\n" );
+                    return -1;
+                }
+                break;
+            case OPT_PROBE_CACHE:
+                if( !*value )
+                    goto invalid;
+                opt->probe_file = strcmp( value, "none" ) ? value : NULL;
+                break;
+            case OPT_FANOUT:
+                if( opt->i_outputs == MAX_OUTPUTS )
+                {
+                    print_error("avs4x26x [error]: at most %d encoders can be fed at once\n", MAX_OUTPUTS );
+                    return -1;
+                }
+                opt->fanout[opt->i_outputs++] = value;
+                break;
+            case OPT_X26X_BINARY:
+                if( !*value )
+                    goto invalid;
+                break;
+            case OPT_SEGMENTS:
+                opt->i_segment_workers = atoi( value );
+                if( opt->i_segment_workers < 0 || opt->i_segment_workers > MAX_SEGMENT_WORKERS )
+                {
+                    print_error("avs4x26x [error]: segments must be between 0 and %d\n", MAX_SEGMENT_WORKERS );
+                    return -1;
+                }
+                break;
+            case OPT_STATS:
+                opt->b_stats = 1;
+                break;
+            case OPT_AVS_FRESH_ENV:
+                opt->b_fresh_env = 1;
+                break;
+            case OPT_JOBS:
+                if( !*value )
+                    goto invalid;
+                opt->jobs_file = value;
+                break;
+            case OPT_SERVE:
+                if( !*value )
+                    goto invalid;
+                opt->serve = value;
+                break;
         }
     }
+    for( int k = 1; k < opt->i_outputs; k++ )
+        if( fanout_arglist( &opt->fanout_args[k], opt->fanout[k], &opt->args ) )
+            return -1;
+    return 0;
 
-    sprintf(buf, " --frames %d", i_encode_frames);
-    strcat(cmd, buf);
+invalid:
+    print_error("avs4x26x [error]: invalid %s\n", option_table[o].name + (option_table[o].name[1] == '-' ? 2 : 1) );
+    return -1;
+}
 
-    if ( b_add_fps )
+/* the x26x command line: the options of a, without the input file and the x26x binary they
+   may name, then what x26x needs to know about the piped stream unless a already says it */
+char* generate_new_commandline(const arglist_t *a, int b_hbpp_vfw, int i_depth, int i_fps_num, int i_fps_den,
+                              int i_width, int i_height, char* infile, const char* csp, int b_tc, int i_seek,
+                              int i_encode_frames, int b_x265, const shifted_file_t *shifted, int i_shifted )
+{
+    cmdline_t cmd = {0}, args = {0};
+    char *tail;
+    int b_add_fps      = !b_tc && !a->b_found[OPT_FPS];
+    int b_add_timebase = b_tc && !a->b_found[OPT_TIMEBASE];
+    int b_add_csp      = !a->b_found[OPT_INPUT_CSP];
+    int b_add_res      = !a->b_found[OPT_INPUT_RES];
+    int b_add_seek     = i_seek > 0 && !(a->b_fanout && a->b_found[OPT_SEEK]);
+    int b_add_frames   = !(a->b_fanout && a->b_found[OPT_FRAMES]);     /* a --fanout encoder may set its own */
+    const char *x26x_binary = a->x26x_binary ? a->x26x_binary : b_x265 ? DEFAULT_X265_BINARY_PATH : DEFAULT_X264_BINARY_PATH;
+
+    for (int i=1;i<a->argc;i++)
     {
-        sprintf(buf, " --fps %d/%d", i_fps_num, i_fps_den);
-        strcat(cmd, buf);
+        int o = a->arg_option[i];
+        int n = o < 0 ? 1 : arg_width( a, i );
+        if( o == ARG_OTHER )
+        {
+            if( a->argv[i] != infile )
+                cmdline_arg(&args, a->argv[i]);
+            continue;
+        }
+        if( o == ARG_VALUE || option_table[o].id == OPT_X26X_BINARY ||
+            (!option_table[o].b_x26x && !a->b_fanout) )
+        {
+            i += n - 1;
+            continue;
+        }
+        const char *value = arg_value( a, i );
+        if( option_table[o].id == OPT_INPUT_DEPTH && i_depth > 8 )
+        {
+            /* the depth of a native high bit depth clip is known */
+            if( atoi(value ? value : "") != i_depth )
+                print_warning("avs4x26x [warning]: Ignoring --input-depth %s, the clip has %d-bit samples\n", value ? value : "", i_depth );
+            i += n - 1;
+            continue;
+        }
+
+        /* the files given to every x26x are replaced by their shifted copies */
+        int k = 0;
+        while( k < i_shifted && !(*shifted[k].shifted && !strcmp( option_table[o].name, shifted[k].option ) &&
+                                  value && !strcmp( value, shifted[k].file )) )
+            k++;
+        if( k < i_shifted )
+        {
+            cmdline_arg(&args, shifted[k].option);
+            cmdline_arg(&args, shifted[k].shifted);
+        }
+        else
+            for( int j = 0; j < n; j++ )
+                cmdline_arg(&args, a->argv[i + j]);
+        i += n - 1;
     }
+    cmdline_arg(&cmd, x26x_binary);
+    cmdline_arg(&cmd, "-");
+    tail = cmdline_take(&args);
+    if ( tail && *tail )
+        cmdline_printf(&cmd, "%s", tail);
+    if ( !tail )
+        cmd.b_failed = 1;
+    free(tail);
+
+    if ( b_add_seek )
+        cmdline_printf(&cmd, "--seek %d", i_seek);
+    if ( b_add_frames )
+        cmdline_printf(&cmd, "--frames %d", i_encode_frames);
+    if ( b_add_fps )
+        cmdline_printf(&cmd, "--fps %d/%d", i_fps_num, i_fps_den);
     if ( b_add_timebase )
+        cmdline_printf(&cmd, "--timebase %d", i_fps_den);
+    if ( b_hbpp_vfw )
+        cmdline_printf(&cmd, "--input-depth 16");
+    else if ( i_depth > 8 )
+        cmdline_printf(&cmd, "--input-depth %d", i_depth);
+    if ( b_add_res )
+        cmdline_printf(&cmd, "--input-res %dx%d", i_width, i_height);
+    if ( b_add_csp )
+        cmdline_printf(&cmd, "--input-csp %s", csp);
+    return cmdline_take(&cmd);
+}
+
+/* x265 is the default binary for HEVC elementary stream outputs */
+static int outfile_is_hevc( const char *outfile )
+{
+    if (outfile && strlen(outfile)>5)
     {
-        sprintf(buf, " --timebase %d", i_fps_den);
-        strcat(cmd, buf);
+        const char *outext = strrchr(outfile, '.');
+        if ( outext && ( !strcasecmp(outext, ".hevc") || !strcasecmp(outext, ".h265") || !strcasecmp(outext, ".265" ) ) )
+            return 1;
     }
-    if ( b_hbpp_vfw )
+    return 0;
+}
+
+/* the YUV4MPEG2 stream header for --y4m. the x26x options that describe the stream, --sar and
+   --tff/--bff/--interlaced, are honoured so a command line can switch between x26x and --y4m */
+static void y4m_header( char *buf, size_t size, const arglist_t *a, int i_width, int i_height,
+                        int i_fps_num, int i_fps_den, const char *csp, int i_depth )
+{
+    /* AviSynth's 4:2:0 has MPEG-2 chroma siting, high bit depth formats have no siting variants */
+    char colorspace[16];
+    if( !strcmp( csp, "i400" ) )
+        snprintf( colorspace, sizeof(colorspace), i_depth > 8 ? "mono%d" : "mono", i_depth );
+    else if( i_depth > 8 )
+        snprintf( colorspace, sizeof(colorspace), "%sp%d", csp + 1, i_depth );
+    else
+        snprintf( colorspace, sizeof(colorspace), "%s%s", csp + 1, strcmp( csp, "i420" ) ? "" : "mpeg2" );
+    snprintf( buf, size, "YUV4MPEG2 W%d H%d F%d:%d I%c A%s C%s\n", i_width, i_height, i_fps_num, i_fps_den,
+              a->interlace, a->sar && strchr( a->sar, ':' ) ? a->sar : "0:0", colorspace );
+}
+
+/* name of the elementary stream of a segment: the output name with .segNNN before its extension,
+   so x26x still picks its raw output by the extension */
+static char *segment_name( const char *outfile, int segment )
+{
+    const char *ext = strrchr( outfile, '.' );
+    const char *sep = strrchr( outfile, '/' ) > strrchr( outfile, '\\' ) ? strrchr( outfile, '/' ) : strrchr( outfile, '\\' );
+    if( !ext || (sep && ext < sep) )
+        ext = outfile + strlen( outfile );
+    char *name = malloc( strlen( outfile ) + 16 );
+    if( name )
+        sprintf( name, "%.*s.seg%03d%s", (int)(ext - outfile), outfile, segment, ext );
+    return name;
+}
+
+/* the command line of the avs4x26x instance encoding one segment: our own arguments without
+   --segments and with the range and output replaced. every segment is a separate encode, so
+   its first frame is an IDR frame and the streams can be joined end to end. the progress and
+   the stats are reported by the parent for the whole range, and the frame cache is left out
+   as every segment would write the entry of the whole clip */
+static char *segment_commandline( const arglist_t *a, const char *name, int i_seek, int i_frames, int b_x265 )
+{
+    static const int replaced[] = { OPT_SEGMENTS, OPT_SEEK, OPT_FRAMES, OPT_OUTPUT,
+                                    OPT_PROGRESS_JSON, OPT_FRAME_CACHE, OPT_STATS, -1 };
+    cmdline_t cmd = {0};
+    cmdline_arg( &cmd, a->argv[0] );
+    for( int i = 1; i < a->argc; i++ )
+    {
+        int o = a->arg_option[i], b_replaced = 0;
+        for( int k = 0; o >= 0 && replaced[k] >= 0; k++ )
+            b_replaced |= option_table[o].id == replaced[k];
+        if( b_replaced )
+        {
+            i += arg_width( a, i ) - 1;
+            continue;
+        }
+        cmdline_arg( &cmd, a->argv[i] );
+    }
+    cmdline_printf( &cmd, "--seek %d --frames %d -o", i_seek, i_frames );
+    cmdline_arg( &cmd, name );
+    /* the progress lines of parallel x26x would overwrite each other */
+    if( !a->b_found[OPT_NO_PROGRESS] )
+        cmdline_printf( &cmd, "--no-progress" );
+    /* x264 can keep the headers of the segments identical so they join cleanly */
+    if( !b_x265 && !a->b_found[OPT_STITCHABLE] )
+        cmdline_printf( &cmd, "--stitchable" );
+    return cmdline_take( &cmd );
+}
+
+static int concatenate_segments( const char *outfile, char **names, int i_segments )
+{
+    FILE *out = fopen( outfile, "wb" );
+    char *buf = malloc( 1 << 20 );
+    int ret = !out || !buf ? -1 : 0;
+    for( int k = 0; k < i_segments && !ret; k++ )
     {
-        sprintf(buf, " --input-depth 16");
-        strcat(cmd, buf);
+        FILE *in = fopen( names[k], "rb" );
+        size_t size;
+        if( !in )
+        {
+            ret = -1;
+            break;
+        }
+        while( !ret && (size = fread( buf, 1, 1 << 20, in )) > 0 )
+            if( fwrite( buf, 1, size, out ) != size )
+                ret = -1;
+        if( ferror( in ) )
+            ret = -1;
+        fclose( in );
     }
-    if ( b_add_res )
+    if( out && fclose( out ) )
+        ret = -1;
+    free( buf );
+    return ret;
+}
+
+/* encode [i_first, i_end) as i_segments pieces on i_workers parallel avs4x26x instances, each with
+   its own AviSynth environment and x26x. segments are handed out in order as workers free up,
+   then the elementary streams are joined into outfile. the frames of finished segments are counted
+   in progress, b_stats reports how long they took. returns the exit code */
+static int run_segments( const arglist_t *a, const char *outfile, int i_first, int i_end,
+                         int i_segments, int i_workers, int b_x265, progress_t *progress, int b_stats )
+{
+    os_process_t running[MAX_SEGMENT_WORKERS];
+    int running_segment[MAX_SEGMENT_WORKERS];
+    int64_t started[MAX_SEGMENT_WORKERS];
+    int i_running = 0, i_next = 0, exitcode = 0;
+    int i_done = 0;
+    int64_t i_start = os_time_us(), i_busy = 0, i_min = 0, i_max = 0;
+    char **names = calloc( i_segments, sizeof(char*) );
+    int *start = malloc( (i_segments + 1) * sizeof(int) );
+    if( !names || !start )
     {
-        sprintf(buf, " --input-res %dx%d", i_width, i_height);
-        strcat(cmd, buf);
+        free( names );
+        free( start );
+        return -1;
     }
-    if ( b_add_csp )
+    for( int k = 0; k <= i_segments; k++ )
+        start[k] = i_first + (int)((int64_t)(i_end - i_first) * k / i_segments);
+
+    print_info("avs4x26x [info]: Encoding frames %d-%d as %d segments on %d workers\n",
+               i_first, i_end - 1, i_segments, i_workers );
+    while( i_next < i_segments || i_running )
+    {
+        while( !exitcode && i_running < i_workers && i_next < i_segments )
+        {
+            int k = i_next++;
+            char *cmd = NULL;
+            names[k] = segment_name( outfile, k );
+            if( names[k] )
+                cmd = segment_commandline( a, names[k], start[k], start[k+1] - start[k], b_x265 );
+            if( cmd )
+                print_colored(CONSOLE_DARKGRAY, "avs4x26x [info]: segment %d/%d: %s\n", k + 1, i_segments, cmd);
+            if( !cmd || os_process_spawn( &running[i_running], cmd, OS_INVALID_HANDLE ) )
+            {
+                char error_message[256];
+                print_error( "Error: Failed to create process. %s\n", os_error_string(error_message, sizeof(error_message)));
+                exitcode = -1;
+            }
+            else
+            {
+                running_segment[i_running] = k;
+                started[i_running++] = os_time_us();
+            }
+            free( cmd );
+        }
+        if( !i_running )
+            break;
+
+        int ret;
+        int i = os_process_wait_any( running, i_running, &ret );
+        if( i < 0 )
+        {
+            /* nothing left to wait for */
+            exitcode = -1;
+            break;
+        }
+        int k = running_segment[i];
+        if( ret )
+        {
+            print_error("avs4x26x [error]: segment %d/%d (frames %d-%d) failed with exit code %d\n",
+                        k + 1, i_segments, start[k], start[k+1] - 1, ret );
+            if( !exitcode )
+                exitcode = ret;
+        }
+        else
+        {
+            int64_t i_time = os_time_us() - started[i];
+            print_info("avs4x26x [info]: segment %d/%d (frames %d-%d) done in %.1f s\n",
+                       k + 1, i_segments, start[k], start[k+1] - 1, i_time / 1e6 );
+            i_busy += i_time;
+            i_min = !i_min || i_time < i_min ? i_time : i_min;
+            i_max = i_time > i_max ? i_time : i_max;
+            i_done += start[k+1] - start[k];
+            progress_rendered( progress, start[k+1] - start[k] );
+            progress_written( progress, i_first + i_done, 0 );
+        }
+        i_running--;
+        running[i] = running[i_running];
+        running_segment[i] = running_segment[i_running];
+        started[i] = started[i_running];
+    }
+
+    if( b_stats && i_done )
+    {
+        int64_t i_wall = os_time_us() - i_start;
+        print_info("avs4x26x [info]: %d frames in %.3f s, %.2f fps. a segment took %.1f-%.1f s, the workers were busy %.0f%% of the time\n",
+                   i_done, i_wall / 1e6, i_wall > 0 ? i_done * 1e6 / i_wall : 0.0, i_min / 1e6, i_max / 1e6,
+                   i_wall > 0 ? 100.0 * i_busy / i_wall / i_workers : 0.0 );
+    }
+    if( !exitcode )
     {
-        sprintf(buf, " --input-csp %s", csp);
-        strcat(cmd, buf);
+        if( concatenate_segments( outfile, names, i_segments ) )
+        {
+            print_error("avs4x26x [error]: Couldn't join the segments into \"%s\"\n", outfile );
+            exitcode = -1;
+        }
+        else
+            print_info("avs4x26x [info]: Joined %d segments into \"%s\"\n", i_segments, outfile );
     }
-    free(buf);
-    return cmd;
+    for( int k = 0; k < i_segments; k++ )
+    {
+        if( names[k] )
+            remove( names[k] );
+        free( names[k] );
+    }
+    free( names );
+    free( start );
+    return exitcode;
 }
 
-int main(int argc, char *argv[])
+/* one encode as given by the options read by parse_options. with --jobs, shared keeps the library and, between jobs
+   that don't need isolation, the script environment with its plugins loaded; NULL otherwise.
+   the stages' times are copied to report if it isn't NULL */
+static int encode( options_t *opt, avs_hnd_t *shared, stats_t *report )
 {
     //avs related
     avs_hnd_t avs_h = {0};
@@ -375,11 +2171,16 @@ int main(int argc, char *argv[])
     const char *avs_version_string;
     AVS_VideoFrame *frm;
     //createprocess related
-    HANDLE /*h_process, */ h_stdOut, h_stdErr, h_pipeRead, h_pipeWrite;
-    SECURITY_ATTRIBUTES saAttr;
-    STARTUPINFO si_info;
-    PROCESS_INFORMATION pi_info;
-    DWORD exitcode = 0;
+    os_handle_t h_pipeRead;
+    pipe_out_t pipe_out[MAX_OUTPUTS];
+    os_process_t process[MAX_OUTPUTS];
+    encoder_watch_t watch = { .i_outputs = 0 };
+    int i_outputs;
+    const char *probe_lookup;
+    probe_result_t probe = {0}, probe_cached;
+    int b_probe_hit = 0;
+    int i_segments = 0;
+    int exitcode = 0;
     /*Video Info*/
     int i_width;
     int i_height;
@@ -388,107 +2189,117 @@ int main(int argc, char *argv[])
     int i_frame_start=0;
     int i_frame_total;
     int b_hbpp_vfw=0;
-    int b_interlaced=0;
+    int i_depth=8;
+    int i_stream_width;     /* the width and depth of the samples as x26x and the Y4M header are told */
+    int i_stream_depth;
+    int i_pixel_bytes=0;    /* bytes per pixel of an interleaved format, 0 if planar */
+    char y4m[128];
     int b_qp=0;
     int b_tc=0;
-    int b_seek_safe=0;
-    int b_change_frame_total=0;
+    int b_seek_safe;
+    int i_x26x_seek=0;      /* --seek left to x26x, when the frames aren't skipped here */
+    shifted_file_t shifted[2] = { { "--qpfile" }, { "--tcfile-in" } };
+    int b_shifted=0;        /* x26x reads shifted copies of them, so --seek skips here */
     int i_encode_frames;
     int b_x265=0;
     /*Video Info End*/
-    char *plane;
-    unsigned int frame,len,chroma_height,chroma_width;
-    int i,j;
+    frame_layout_t layout = {0};
+    frame_ring_t ring;
+    int i_prefetch;
+    int i_ring_lag = 0;
+    int b_render_linear;
+    int i_avs_threads;
+    int i_cache_range;
+    memgov_t memgov = { 0 };
+    stats_t stats = {0};
+    int64_t i_time;
+    char *staging = NULL;
+    convert_pool_t *convert_pool = NULL;
+    framecache_t *cache_in = NULL, *cache_out = NULL;
+    int i_freeze = 0;
+    int b_done = 0;
+    int frame;
+    unsigned int chroma_height,chroma_width;
+    int i;
     char *cmd;
-    char *infile = NULL, *outfile = NULL;
+    char *infile = NULL;
     const char *csp = NULL;
     const char *csp_human = NULL;
+    char csp_name[16];
 
-    h_console = GetStdHandle(STD_ERROR_HANDLE);
-    GetConsoleScreenBufferInfo(h_console, &console_default);
+    stats.i_start = os_time_us();
 
-    if (argc>1)
+    if (opt->args.argc>1)
     {
-        //get the script file and other informations from the commandline
-
-        for (i=1;i<argc;i++)
+        b_qp = opt->b_qp && !opt->b_y4m;     /* there is no x26x to read them, --seek always skips here */
+        b_tc = opt->b_tc && !opt->b_y4m;
+        b_seek_safe = opt->b_seek_safe;
+        i_prefetch = opt->i_prefetch;
+        b_render_linear = opt->b_render_linear;
+        i_avs_threads = opt->i_avs_threads;
+        i_cache_range = opt->i_cache_range;
+        i_outputs = opt->i_outputs;
+        layout.i_format = opt->i_input_format;
+        stats.b_enabled = opt->b_stats;
+        if( opt->interlaced )
+            print_warning("%s found.\n", opt->interlaced);
+
+        if( opt->b_y4m && ( i_outputs > 1 || opt->i_segment_workers > 1 ) )
         {
-            if( !strcmp(argv[i], "--interlaced") || !strcmp(argv[i], "--tff") || !strcmp(argv[i], "--bff") )
-            {
-                print_warning("%s found.\n", argv[i]);
-                b_interlaced=1;
-                break;
-            }
+            print_error("avs4x26x [error]: --y4m can't be used with --fanout or --segments\n" );
+            return -1;
         }
-        for (i=1;i<argc;i++)
+        if( opt->i_segment_workers > 1 )
         {
-            if( !strncmp(argv[i], "--qpfile", 8) )
+            /* the segments are joined as elementary streams, which containers and 2-pass stats can't be */
+            const char *seg_ext = opt->args.outfile ? strrchr( opt->args.outfile, '.' ) : NULL;
+            if( !opt->args.outfile || !strcmp( opt->args.outfile, "-" ) ||
+                (seg_ext && (!strcasecmp( seg_ext, ".mkv" ) || !strcasecmp( seg_ext, ".mp4" ) || !strcasecmp( seg_ext, ".flv" ))) )
             {
-                b_qp = 1;
-                break;
+                print_error("avs4x26x [error]: --segments needs a raw elementary stream output file\n" );
+                 return -1;
             }
-        }
-        for (i=1;i<argc;i++)
-        {
-            if( !strncmp(argv[i], "--tcfile-in", 11) )
+            if( i_outputs > 1 || opt->args.b_found[OPT_PASS] )
             {
-                b_tc = 1;
-                break;
+                print_error("avs4x26x [error]: --segments can't be used with --fanout or --pass\n" );
+                 return -1;
             }
         }
-        for (i=1;i<argc;i++)
+
+        //avs open
+        if( shared && (shared->library || shared->server) )
         {
-            if( !strncmp(argv[i], "--seek-mode", 11) )
+            avs_h = *shared;
+            shared->env = NULL;
+            if( avs_h.env && opt->b_fresh_env )
             {
-                if( !strcmp(argv[i], "--seek-mode") )
-                {
-                    if( !strcasecmp(argv[i+1], "safe" ) )
-                    {
-                        b_seek_safe = 1;
-                    }
-                    else if( !strcasecmp(argv[i+1], "fast" ) )
-                    {
-                        b_seek_safe = 0;
-                    }
-                    else
-                    {
-                        print_error("avs4x26x [error]: invalid seek-mode\n" );
-                        return -1;
-                    }
-                    for (int k=i;k<argc-2;k++)
-                        argv[k] = argv[k+2];
-                    argc -= 2;
-                }
-                else if( !strncmp(argv[i], "--seek-mode=", 12) )
-                {
-                    if( !strcasecmp(argv[i]+12, "safe" ) )
-                    {
-                        b_seek_safe = 1;
-                    }
-                    else if( !strcasecmp(argv[i]+12, "fast" ) )
-                    {
-                        b_seek_safe = 0;
-                    }
-                    else
-                    {
-                        print_error("avs4x26x [error]: invalid seek-mode\n" );
-                        return -1;
-                    }
-                    for (int k=i;k<argc-1;k++)
-                        argv[k] = argv[k+1];
-                    argc--;
-                }
-                i--;
+                if( avs_h.func.avs_delete_script_environment )
+                    avs_h.func.avs_delete_script_environment( avs_h.env );
+                avs_h.env = NULL;
             }
+            /* another input may need another mapped plugin */
+            if( avs_h.b_plugins_loaded == 1 )
+                avs_h.b_plugins_loaded = 0;
         }
-
-        //avs open
-        if( avs_load_library( &avs_h ) )
+        else if( opt->server )
+            remote_load( &avs_h, opt->server );
+        else if( avs_load_library( &avs_h ) )
         {
            print_error("avs [error]: failed to load avisynth\n" );
            return -1;
         }
-        avs_h.env = avs_h.func.avs_create_script_environment( AVS_INTERFACE_YV12 );
+        if( !avs_h.env )
+        {
+            avs_h.env = avs_h.func.avs_create_script_environment( AVS_INTERFACE_YV12 );
+            avs_h.b_plugins_loaded = 0;
+        }
+        else
+            print_details("avs4x26x [info]: reusing the script environment of the previous job\n" );
+        if( !avs_h.env && avs_h.server )
+        {
+           print_error("avs4x26x [error]: Couldn't connect to the AviSynth server \"%s\"\n", avs_h.server );
+           goto avs_fail;
+        }
         if( !avs_h.env )
         {
            print_error("avs [error]: failed to initiate avisynth\n" );
@@ -507,9 +2318,9 @@ int main(int argc, char *argv[])
         #define break_on_success 4
         #define print_and_break_on_success (print_on_success|break_on_success)
         #define simple_avs_invoke(filter, action) {                     \
-            infile = argv[i];                                           \
+            infile = opt->inputs[i];                                    \
             arg = avs_new_value_string( infile );                       \
-            res = avs_h.func.avs_invoke(avs_h.env, filter, arg, NULL);  \
+            res = probe_invoke(&avs_h, &probe, infile, filter, arg, NULL);  \
             if( avs_is_error( res ) ) {                                 \
                 print_avs_error(res);                                   \
                 if (action & abort_on_fail)                             \
@@ -523,24 +2334,39 @@ int main(int argc, char *argv[])
             }                                                           \
         }
 
-        for (i=1;i<argc;i++)
+        i_time = os_time_us();
+        probe_lookup = opt->probe_file;
+        for (i=0;i<opt->i_inputs;i++)
         {
-            len =  strlen(argv[i]);
-            char *ext = strrchr(argv[i], '.');
+            char *ext = strrchr(opt->inputs[i], '.');
 
-            if ( !strncmp(argv[i], "--audiofile=", 12) || !strncmp(argv[i], "--output=", 9) )
-                continue;
-            else if ( !strncmp(argv[i], "-o", 2) && strcmp(argv[i], "-o") )                   // special case: -ofilename.ext equals to --output filename.ext
-                continue;
-            else if ( !strcmp(argv[i], "--output") || !strcmp(argv[i], "-o") || !strcmp(argv[i], "--audiofile") )
+            if ( probe_lookup && strcasecmp(ext, ".avs") && !probecache_lookup( probe_lookup, opt->inputs[i], &probe_cached ) )
             {
-                i++;
+                int64_t i_index_size, i_index_mtime;
+                infile = opt->inputs[i];
+                print_details("avs4x26x [info]: opening with the cached probe of \"%s\"\n", infile);
+                if( *probe_cached.index )
+                    print_details("avs4x26x [info]: index \"%s\"%s\n", probe_cached.index,
+                                  os_file_info( probe_cached.index, &i_index_size, &i_index_mtime ) ? " is gone, reindexing" : "" );
+                load_plugins( &avs_h, ext, opt->plugin_map, opt->i_plugin_map, &stats );
+                if( !probe_replay( &avs_h, &probe_cached, infile, &res ) )
+                {
+                    filter = probe_cached.steps[probe_cached.i_steps - 1].filter;
+                    b_hbpp_vfw |= !!(probe_cached.i_flags & PROBE_HBPP_VFW);
+                    if( probe_cached.i_flags & PROBE_SEEK_SAFE )
+                    {
+                        print_details("avs4x26x [info]: No safe non-linear seeking guaranteed for input file, force seek-mode=safe\n");
+                        b_seek_safe = 1;
+                    }
+                    b_probe_hit = 1;
+                    break;
+                }
+                print_warning("avs4x26x [warning]: The cached probe failed, trying the source filters again\n");
+                infile = NULL;
+                probe_lookup = NULL;
+                i--;
                 continue;
             }
-            else if (ext == NULL || strlen(ext) > 5)
-            {
-                continue; // do nothing as the extension is either empty or too long
-            }
             else if (strcasecmp(ext, ".avs") == 0)
             {
                 print_details("avs4x26x [info]: opening as AviSynth script\n");
@@ -550,7 +2376,7 @@ int main(int argc, char *argv[])
 
             else if (strcasecmp(ext, ".d2v") == 0)
             {
-                AUTO_LOAD_PLUGINS
+                load_plugins( &avs_h, ext, opt->plugin_map, opt->i_plugin_map, &stats );
                 filter = "MPEG2Source";
                 print_trying(filter);
                 simple_avs_exists(filter);
@@ -559,7 +2385,7 @@ int main(int argc, char *argv[])
 
             else if (strcasecmp(ext, ".dga") == 0)
             {
-                AUTO_LOAD_PLUGINS
+                load_plugins( &avs_h, ext, opt->plugin_map, opt->i_plugin_map, &stats );
                 filter = "AVCSource";
                 print_trying(filter);
                 simple_avs_exists(filter);
@@ -568,7 +2394,7 @@ int main(int argc, char *argv[])
 
             else if (strcasecmp(ext, ".dgi") == 0)
             {
-                AUTO_LOAD_PLUGINS
+                load_plugins( &avs_h, ext, opt->plugin_map, opt->i_plugin_map, &stats );
                 filter = "DGSource";
                 if( avs_h.func.avs_function_exists( avs_h.env, filter ) )
                 {
@@ -585,14 +2411,13 @@ int main(int argc, char *argv[])
             else if (strcasecmp(ext, ".vpy") == 0)
             {
                 filter = "VSImport";
-                AUTO_LOAD_PLUGINS
+                load_plugins( &avs_h, ext, opt->plugin_map, opt->i_plugin_map, &stats );
                 if( avs_h.func.avs_function_exists( avs_h.env, filter ) )
                 {
                     print_trying(filter);
                     simple_avs_invoke(filter, print_and_break_on_success);
                 }
 
-                AUTO_LOAD_PLUGINS
                 filter = "AVISource";
                 print_trying(filter);
                 simple_avs_invoke(filter, print_and_break_on_success);
@@ -604,6 +2429,7 @@ int main(int argc, char *argv[])
                     print_trying(filter);
                     simple_avs_invoke(filter, print_on_success | abort_on_fail);
                     b_hbpp_vfw = 1;
+                    probe.i_flags |= PROBE_HBPP_VFW;
                     break;
                 }
             }
@@ -626,9 +2452,9 @@ int main(int argc, char *argv[])
                   || strcasecmp(ext, ".tp") == 0
                   || strcasecmp(ext, ".ps") == 0) /* We don't trust ffms's non-linear seeking for these formats */
             {
-                infile = argv[i];
+                infile = opt->inputs[i];
 
-                AUTO_LOAD_PLUGINS
+                load_plugins( &avs_h, ext, opt->plugin_map, opt->i_plugin_map, &stats );
                 filter = "LWLibavVideoSource";
                 if( avs_h.func.avs_function_exists( avs_h.env, filter ) )
                 {
@@ -636,7 +2462,7 @@ int main(int argc, char *argv[])
                     print_indexing();
                     AVS_Value arg_arr[] = { avs_new_value_string( infile ), avs_new_value_int( 1 ) };
                     const char *arg_name[] = { "source", "threads" };
-                    res = avs_h.func.avs_invoke( avs_h.env, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
+                    res = probe_invoke( &avs_h, &probe, infile, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
                     if( !avs_is_error( res ) )
                     {
                         print_success();
@@ -652,7 +2478,7 @@ int main(int argc, char *argv[])
                     print_indexing();
                     AVS_Value arg_arr[] = { avs_new_value_string( infile ), avs_new_value_string( "lavf" ) };
                     const char *arg_name[] = { "source", "demuxer" };
-                    res = avs_h.func.avs_invoke( avs_h.env, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
+                    res = probe_invoke( &avs_h, &probe, infile, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
                     if( avs_is_error( res ) )
                     {
                         print_avs_error(res);
@@ -667,7 +2493,7 @@ int main(int argc, char *argv[])
                 {
                     AVS_Value arg_arr[] = { avs_new_value_string( infile ), avs_new_value_int( 1 ), avs_new_value_int( -1 ) };
                     const char *arg_name[] = { "source", "threads", "seekmode" };
-                    res = avs_h.func.avs_invoke( avs_h.env, filter, avs_new_value_array( arg_arr, 3 ), arg_name );
+                    res = probe_invoke( &avs_h, &probe, infile, filter, avs_new_value_array( arg_arr, 3 ), arg_name );
                     if( avs_is_error( res ) )
                     {
                         print_avs_error(res);
@@ -678,6 +2504,7 @@ int main(int argc, char *argv[])
                         print_success();
                         print_details("avs4x26x [info]: No safe non-linear seeking guaranteed for input file, force seek-mode=safe\n");
                         b_seek_safe = 1;
+                        probe.i_flags |= PROBE_SEEK_SAFE;
                     }
                 }
                 else
@@ -692,8 +2519,8 @@ int main(int argc, char *argv[])
                   || strcasecmp(ext, ".3g2") == 0
                   || strcasecmp(ext, ".qt") == 0) /* LSMASHVideoSource works perfect for them */
             {
-                infile = argv[i];
-                AUTO_LOAD_PLUGINS
+                infile = opt->inputs[i];
+                load_plugins( &avs_h, ext, opt->plugin_map, opt->i_plugin_map, &stats );
                 filter = "LSMASHVideoSource";
                 if( avs_h.func.avs_function_exists( avs_h.env, filter ) )
                 {
@@ -701,7 +2528,7 @@ int main(int argc, char *argv[])
                     print_indexing();
                     AVS_Value arg_arr[] = { avs_new_value_string( infile ), avs_new_value_int( 1 ) };
                     const char *arg_name[] = { "source", "threads" };
-                    res = avs_h.func.avs_invoke( avs_h.env, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
+                    res = probe_invoke( &avs_h, &probe, infile, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
                     if( avs_is_error( res ) )
                     {
                         print_avs_error(res);
@@ -721,9 +2548,9 @@ int main(int argc, char *argv[])
                   || strcasecmp(ext, ".flv") == 0
                   || strcasecmp(ext, ".webm") == 0) /* Non-linear seeking seems to be reliable for these formats */
             {
-                AUTO_LOAD_PLUGINS
-                infile = argv[i];
+                infile = opt->inputs[i];
 source_lwl_ffms_general:
+                load_plugins( &avs_h, ext, opt->plugin_map, opt->i_plugin_map, &stats );
 
                 filter = "LWLibavVideoSource";
                 if( avs_h.func.avs_function_exists( avs_h.env, filter ) )
@@ -732,7 +2559,7 @@ source_lwl_ffms_general:
                     print_indexing();
                     AVS_Value arg_arr[] = { avs_new_value_string( infile ), avs_new_value_int( 1 ) };
                     const char *arg_name[] = { "source", "threads" };
-                    res = avs_h.func.avs_invoke( avs_h.env, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
+                    res = probe_invoke( &avs_h, &probe, infile, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
                     if( !avs_is_error( res ) )
                     {
                         print_success();
@@ -749,7 +2576,7 @@ source_lwl_ffms_general:
                     print_indexing();
                     AVS_Value arg_arr[] = { avs_new_value_string( infile ), avs_new_value_int( 1 ) };
                     const char *arg_name[] = { "source", "threads" };
-                    res = avs_h.func.avs_invoke( avs_h.env, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
+                    res = probe_invoke( &avs_h, &probe, infile, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
                     if( avs_is_error( res ) )
                     {
                         print_avs_error(res);
@@ -772,9 +2599,9 @@ source_lwl_ffms_general:
                   || strcasecmp(ext, ".rm") == 0
                   || strcasecmp(ext, ".wm") == 0) /* Only use DSS2/DirectShowSource for these formats */
             {
-                AUTO_LOAD_PLUGINS
-                infile = argv[i];
+                infile = opt->inputs[i];
 source_dss:
+                load_plugins( &avs_h, ext, opt->plugin_map, opt->i_plugin_map, &stats );
                 filter = "DSS2";
                 if( avs_h.func.avs_function_exists( avs_h.env, filter ) )
                 {
@@ -788,7 +2615,7 @@ source_dss:
                     print_trying(filter);
                     AVS_Value arg_arr[] = { avs_new_value_string( infile ), avs_new_value_bool( 0 ) };
                     const char *arg_name[] = { NULL, "audio" };
-                    res = avs_h.func.avs_invoke( avs_h.env, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
+                    res = probe_invoke( &avs_h, &probe, infile, filter, avs_new_value_array( arg_arr, 2 ), arg_name );
                     if( !avs_is_error( res ) )
                     {
                         print_success();
@@ -803,32 +2630,26 @@ source_dss:
 
         }
 
+        stats.i_probe = os_time_us() - i_time;
+        print_details("avs4x26x [info]: Startup took %.3f s, of which loading plugins %.3f s\n",
+                      (os_time_us() - stats.i_start) / 1e6, stats.i_plugins / 1e6 );
+
+        /* scripts open directly, only the filter fallback chain is worth caching */
+        if( infile && opt->probe_file && !b_probe_hit && probe.i_steps > 0 &&
+            strcmp( probe.steps[probe.i_steps - 1].filter, "Import" ) )
+        {
+            probe_find_index( &probe, infile );
+            if( !probecache_store( opt->probe_file, infile, &probe ) )
+                print_details("avs4x26x [info]: probe of \"%s\" cached in \"%s\"\n", infile, opt->probe_file );
+        }
+
         if (!infile)
         {
             print_error("avs4x26x [error]: No supported input file found.\n");
             goto avs_fail;
         }
 
-        for (i=1;i<argc;i++)
-        {
-            if( !strncmp(argv[i], "--output", 8) || !strncmp(argv[i], "-o", 2) )
-            {
-                if( !strcmp(argv[i], "--output") || !strcmp(argv[i], "-o") )
-                    outfile = argv[i+1];
-                else if( !strncmp(argv[i], "--output=", 9) )
-                    outfile = argv[i]+9;
-                else if( !strncmp(argv[i], "-o=", 3) )
-                    outfile = argv[i]+3;
-                else    /* else argv[i] should have structure like -ofilename */
-                    outfile = argv[i]+2;
-            }
-        }
-        if (outfile && strlen(outfile)>5)
-        {
-            char *outext = strrchr(outfile, '.');
-            if ( !strcasecmp(outext, ".hevc") || !strcasecmp(outext, ".h265") || !strcasecmp(outext, ".265" ) )
-                b_x265 = 1;
-        }
+        b_x265 = outfile_is_hevc( opt->args.outfile );
 
         if (filter)
             print_info("avs4x26x [info]: using \"%s\" as source filter\n", filter );
@@ -867,74 +2688,140 @@ source_dss:
                      vi->width, vi->height );
             goto avs_fail;
         }
-        if ( avs_is_yv12( vi ) )
+        /* AviSynth+ high bit depth formats are piped as they are, x26x takes them with --input-depth */
+        i_depth = avs_bits_per_component( vi );
+        if ( i_depth == 32 )
+        {
+            print_warning("avs [warning]: Converting 32-bit float input clip to 16-bit\n" );
+            AVS_Value arg_arr[2] = { res, avs_new_value_int( 16 ) };
+            AVS_Value res2 = avs_h.func.avs_invoke( avs_h.env, "ConvertBits", avs_new_value_array( arg_arr, 2 ), NULL );
+            if( avs_is_error( res2 ) )
+            {
+                print_error("avs [error]: Couldn't convert input clip to 16-bit\n" );
+                goto avs_fail;
+            }
+            res = update_clip( &avs_h, &vi, res2, res );
+            i_depth = 16;
+        }
+        if ( layout.i_format == FRAME_FORMAT_STACK16 &&
+             ( i_depth != 8 || !( avs_is_yv12( vi ) || avs_is_yv16( vi ) || avs_is_yv24( vi ) ) || vi->height & 3 ) )
+        {
+            print_error("avs [error]: --input-format stack16 needs a YV12, YV16 or YV24 clip of twice the height, "
+                        "divisible by 4\n" );
+            goto avs_fail;
+        }
+        /* every x26x reads the same stream, and x265 and YUV4MPEG2 take planar YUV only */
+        int b_packed_ok = !b_x265 && !opt->b_y4m;
+        for ( int o=1; o<i_outputs && b_packed_ok; o++ )
+            b_packed_ok = !outfile_is_hevc( opt->fanout_args[o].outfile );
+        if ( avs_is_color_space_any_depth( vi, AVS_CS_YV12 ) )
         {
             csp = "i420";
             chroma_width = vi->width >> 1;
             chroma_height = vi->height >> 1;
             csp_human = "YV12";
         }
-        else if ( avs_is_yv24( vi ) )
+        else if ( avs_is_color_space_any_depth( vi, AVS_CS_YV24 ) )
         {
             csp = "i444";
             chroma_width = vi->width;
             chroma_height = vi->height;
             csp_human = "YV24";
         }
-        else if ( avs_is_yv16( vi ) )
+        else if ( avs_is_color_space_any_depth( vi, AVS_CS_YV16 ) )
         {
             csp = "i422";
             chroma_width = vi->width >> 1;
             chroma_height = vi->height;
             csp_human = "YV16";
         }
+        else if ( avs_is_color_space_any_depth( vi, AVS_CS_Y8 ) )
+        {
+            csp = "i400";
+            chroma_width = 0;
+            chroma_height = 0;
+            csp_human = "Y8";
+        }
+        else if ( b_packed_ok && i_depth == 8 && ( avs_is_yuy2( vi ) || avs_is_rgb24( vi ) || avs_is_rgb32( vi ) ) )
+        {
+            /* interleaved formats go as one plane, AviSynth stores RGB bottom-up */
+            i_pixel_bytes = avs_is_yuy2( vi ) ? 2 : avs_is_rgb24( vi ) ? 3 : 4;
+            csp = avs_is_yuy2( vi ) ? "yuyv" : avs_is_rgb24( vi ) ? "bgr" : "bgra";
+            csp_human = avs_is_yuy2( vi ) ? "YUY2" : avs_is_rgb24( vi ) ? "RGB24" : "RGB32";
+            if ( avs_is_rgb( vi ) )
+                layout.i_format = FRAME_FORMAT_BOTTOM_UP;
+            chroma_width = 0;
+            chroma_height = 0;
+        }
+        else if ( opt->b_convert_internal && i_depth == 8 &&
+                  ( avs_is_yv411( vi ) || avs_is_color_space( vi, AVS_CS_YUV9 ) || avs_is_yuy2( vi ) || avs_is_rgb( vi ) ) )
+        {
+            /* converted while packing, on the pool with the fastest kernels the CPU has.
+               YUY2 loses nothing as YV16, the others go to YV12 like with ConvertToYV12 */
+            int b_422 = avs_is_yuy2( vi );
+            layout.i_format = avs_is_yv411( vi ) ? FRAME_FORMAT_YV411 : avs_is_yuy2( vi ) ? FRAME_FORMAT_YUY2 :
+                              avs_is_rgb24( vi ) ? FRAME_FORMAT_RGB24 : avs_is_rgb32( vi ) ? FRAME_FORMAT_RGB32 :
+                              FRAME_FORMAT_YUV9;
+            layout.b_interlaced = opt->b_interlaced;
+            print_warning("avs [warning]: Converting input clip to %s\n", b_422 ? "YV16" : "YV12" );
+            csp = b_422 ? "i422" : "i420";
+            csp_human = b_422 ? "YV16" : "YV12";
+            chroma_width = vi->width >> 1;
+            chroma_height = b_422 ? vi->height : vi->height >> 1;
+        }
         else
         {
-            print_warning("avs [warning]: Converting input clip to YV12\n" );
+            /* YUY2 loses nothing as YV16. ConvertToYV12 is 8-bit only, AviSynth+ converts other depths
+               with ConvertToYUV420 */
+            int b_422 = avs_is_yuy2( vi );
+            const char *convert = b_422 ? "ConvertToYV16" : i_depth > 8 ? "ConvertToYUV420" : "ConvertToYV12";
+            const char *target = b_422 ? "YV16" : i_depth > 8 ? "YUV420" : "YV12";
+            print_warning("avs [warning]: Converting input clip to %s\n", target );
             const char *arg_name[2] = { NULL, "interlaced" };
-            AVS_Value arg_arr[2] = { res, avs_new_value_bool( b_interlaced ) };
-            AVS_Value res2 = avs_h.func.avs_invoke( avs_h.env, "ConvertToYV12", avs_new_value_array( arg_arr, 2 ), arg_name );
+            AVS_Value arg_arr[2] = { res, avs_new_value_bool( opt->b_interlaced ) };
+            AVS_Value res2 = avs_h.func.avs_invoke( avs_h.env, convert, avs_new_value_array( arg_arr, 2 ), arg_name );
             if( avs_is_error( res2 ) )
             {
-                print_error("avs [error]: Couldn't convert input clip to YV12\n" );
+                print_error("avs [error]: Couldn't convert input clip to %s\n", target );
                 goto avs_fail;
             }
-            res = update_clip( avs_h, vi, res2, res );
-            csp = "i420";
-            csp_human = "YV12";
+            res = update_clip( &avs_h, &vi, res2, res );
+            csp = b_422 ? "i422" : "i420";
+            csp_human = b_422 ? "YV16" : "YV12";
             chroma_width = vi->width >> 1;
-            chroma_height = vi->height >> 1;
+            chroma_height = b_422 ? vi->height : vi->height >> 1;
+        }
+        if ( layout.i_format == FRAME_FORMAT_STACK16 )
+        {
+            /* the MSB half on top of the LSB half of every plane */
+            chroma_height >>= 1;
+            i_depth = 16;
+        }
+        if ( i_depth > 8 )
+        {
+            if ( !strcmp( csp, "i400" ) )
+                snprintf( csp_name, sizeof(csp_name), "Y%d", i_depth );
+            else
+                snprintf( csp_name, sizeof(csp_name), "YUV%sP%d", csp + 1, i_depth );
+            csp_human = csp_name;
         }
 
-        for (i=1;i<argc;i++)
+        i_frame_start = opt->i_seek;
+        if ( !b_seek_safe && i_frame_start && ( b_qp || b_tc ) )
         {
-            if( !strncmp(argv[i], "--seek", 6) )
+            shifted[0].file = opt->qpfile;
+            shifted[1].file = opt->tcfile_in;
+            b_shifted = (!b_qp || (opt->qpfile && !shift_file( &shifted[0], i_frame_start ))) &&
+                        (!b_tc || (opt->tcfile_in && !shift_file( &shifted[1], i_frame_start )));
+            if ( b_shifted )
+                print_info("avs4x26x [info]: seek-mode=fast with qpfile or timecodes in, renumbered them to skip the first %d %s\n", i_frame_start, i_frame_start==1 ? "frame" : "frames" );
+            else
             {
-                if( !strcmp(argv[i], "--seek") )
-                {
-                    i_frame_start = atoi(argv[i+1]);
-                    if( !b_tc && !b_qp && !b_seek_safe )   /* delete seek parameters if no timecodes/qpfile and seek-mode=fast */
-                    {
-                        for (int k=i;k<argc-2;k++)
-                            argv[k] = argv[k+2];
-                        argc -= 2;
-                        i--;
-                    }
-                }
-                else
-                {
-                    i_frame_start = atoi(argv[i]+7);
-                    if( !b_tc && !b_qp && !b_seek_safe )   /* delete seek parameters if no timecodes/qpfile and seek-mode=fast */
-                    {
-                        for (int k=i;k<argc-1;k++)
-                            argv[k] = argv[k+1];
-                        argc -= 1;
-                        i--;
-                    }
-                }
+                print_warning("avs4x26x [warning]: Couldn't write renumbered copies of the qpfile or timecodes\n" );
+                remove_shifted( shifted, 2 );
             }
         }
-        if ( !b_seek_safe && i_frame_start && ( b_qp || b_tc ) )
+        if ( !b_seek_safe && i_frame_start && ( b_qp || b_tc ) && !b_shifted )
         {
             print_info("avs4x26x [info]: seek-mode=fast with qpfile or timecodes in, freeze first %d %s for fast processing\n", i_frame_start, i_frame_start==1 ? "frame" : "frames" );
             AVS_Value arg_arr[4] = { res, avs_new_value_int( 0 ), avs_new_value_int( i_frame_start ), avs_new_value_int( i_frame_start ) };
@@ -944,16 +2831,47 @@ source_dss:
                 print_error("avs [error]: Couldn't freeze first %d %s\n", i_frame_start, i_frame_start==1 ? "frame" : "frames" );
                 goto avs_fail;
             }
-            res = update_clip( avs_h, vi, res2, res );
+            res = update_clip( &avs_h, &vi, res2, res );
+            i_freeze = i_frame_start;
+        }
+
+        /* AviSynth+ runs the filters of the script on its own thread pool once the output is prefetched,
+           classic AviSynth MT has to be set up by SetMTMode() before the source filter */
+        if( i_avs_threads )
+        {
+            AVS_Value res2 = avs_void;
+            if( avs_h.func.avs_function_exists( avs_h.env, "Prefetch" ) )
+            {
+                AVS_Value arg_arr[2] = { res, avs_new_value_int( i_avs_threads ) };
+                res2 = avs_h.func.avs_invoke( avs_h.env, "Prefetch", avs_new_value_array( arg_arr, 2 ), NULL );
+            }
+            if( avs_is_clip( res2 ) )
+                res = update_clip( &avs_h, &vi, res2, res );
+            else
+            {
+                print_warning("avs4x26x [warning]: %s, --avs-threads ignored\n",
+                              avs_is_error( res2 ) ? avs_as_error( res2 ) : "AviSynth has no Prefetch()" );
+                avs_h.func.avs_release_value( res2 );
+                i_avs_threads = 0;
+            }
         }
 
         avs_h.func.avs_release_value( res );
 
         i_width = vi->width;
-        i_height = vi->height;
+        i_height = layout.i_format == FRAME_FORMAT_STACK16 ? vi->height >> 1 : vi->height;
         i_fps_num = vi->fps_numerator;
         i_fps_den = vi->fps_denominator;
         i_frame_total = vi->num_frames;
+        i_stream_width = i_width;
+        i_stream_depth = i_depth;
+        /* an 8-bit clip carrying 16-bit samples as MSB/LSB pairs */
+        if ( i_depth == 8 && (b_hbpp_vfw || (opt->args.input_depth && strcmp(opt->args.input_depth, "8"))) )
+        {
+            i_stream_width >>= 1;
+            i_stream_depth = b_hbpp_vfw ? 16 : atoi(opt->args.input_depth);
+            print_info("avs4x26x [info]: High bit depth detected, resolution corrected\n" );
+        }
 
         if( i_fps_den != 1 )
         {
@@ -971,153 +2889,475 @@ source_dss:
         print_colored(CONSOLE_YELLOW, "avs [info]: Video: %dx%d, %s, %d/%d fps, %d frames\n",
                  i_width, i_height, csp_human, i_fps_num, i_fps_den, i_frame_total);
 
-        //execute the commandline
-        //h_process = GetCurrentProcess();
-        h_stdOut = GetStdHandle(STD_OUTPUT_HANDLE);
-        h_stdErr = GetStdHandle(STD_ERROR_HANDLE);
+        if ( opt->i_frames >= 0 )
+            i_frame_total = i_frame_start + opt->i_frames; /* ending frame should add offset of i_frame_start, not needed if not set as will be clamped */
+
+        if ( vi->num_frames < i_frame_total )
+        {
+            print_warning("avs4x26x [warning]: x26x is trying to encode until frame %d, but input clip has only %d %s\n",
+                     i_frame_total, vi->num_frames, vi->num_frames > 1 ? "frames" : "frame" );
+            i_frame_total = vi->num_frames;
+        }
+
+        i_encode_frames = i_frame_total - i_frame_start;
+
+        if( opt->i_segment_workers > 1 )
+        {
+            int i_max = i_encode_frames / SEGMENT_MIN_FRAMES;
+            i_segments = opt->i_segment_workers * SEGMENTS_PER_WORKER;
+            if( i_segments > i_max )
+                i_segments = i_max;
+            if( i_segments > 1 )
+                goto avs_cleanup;   /* the segments open the script themselves */
+            print_warning("avs4x26x [warning]: %d frames are too few for --segments, encoding in one piece\n", i_encode_frames );
+            i_segments = 0;
+        }
+
+        if ( ( ( ( b_tc || b_qp ) && !b_shifted ) || b_seek_safe ) && !opt->b_y4m )    /* don't skip the number --seek defines if has timecodes/qpfile or seek-mode=safe */
+        {
+            i_x26x_seek = i_frame_start;
+            i_frame_start = 0;
+        }
+        else if ( i_frame_start != 0 )
+        {
+            print_details("avs4x26x [info]: Convert \"--seek %d\" to internal frame skipping\n", i_frame_start );
+        }
+
+        if( opt->progress_target && !(stats.progress = progress_open( opt->progress_target, i_frame_start, i_frame_total,
+                                                                  PROGRESS_INTERVAL_MS )) )
+        {
+            print_error("avs4x26x [error]: Couldn't open \"%s\" for the progress\n", opt->progress_target );
+            goto avs_fail;
+        }
+
+        //execute the commandlines, one pipe per x26x
+        for ( int o=0; o<i_outputs && !opt->b_y4m; o++ )
+        {
+            if ( pipe_create(&pipe_out[o], &h_pipeRead, (size_t)opt->i_pipe_buffer) )
+            {
+                print_error("Error: Pipe creation failed!");
+                i_outputs = o;
+                goto spawn_fail;
+            }
+            if ( o == 0 )
+                cmd = generate_new_commandline(&opt->args, b_hbpp_vfw, i_depth, i_fps_num, i_fps_den, i_stream_width, i_height, infile, csp, b_tc, i_x26x_seek, i_encode_frames, b_x265,
+                                               shifted, 2 );
+            else
+                cmd = generate_new_commandline(&opt->fanout_args[o], b_hbpp_vfw, i_depth, i_fps_num, i_fps_den, i_stream_width, i_height, infile, csp, b_tc, i_x26x_seek, i_encode_frames,
+                                               outfile_is_hevc( opt->fanout_args[o].outfile ), shifted, 2 );
+            if ( cmd )
+                print_colored(CONSOLE_DARKGRAY, "avs4x26x [info]: %s\n", cmd);
+
+            if (!cmd || os_process_spawn(&process[o], cmd, h_pipeRead))
+            {
+                char error_message[256];
+                print_error( "Error: Failed to create process. %s\n", os_error_string(error_message, sizeof(error_message)));
+                free(cmd);
+                os_handle_close(h_pipeRead);
+                pipe_close(&pipe_out[o]);
+                i_outputs = o;
+                goto spawn_fail;
+            }
+            //cleanup before writing to pipe
+            os_handle_close(h_pipeRead);
+            free(cmd);
+        }
+        if ( !opt->b_y4m )
+            watch_start( &watch, process, i_outputs );
+        if ( opt->b_y4m && pipe_open_stdout(&pipe_out[0]) )
+        {
+            print_error("avs4x26x [error]: Couldn't write to stdout\n" );
+            goto avs_fail;
+        }
+        if( i_outputs > 1 && !i_prefetch )
+        {
+            print_details("avs4x26x [info]: --fanout writes through the frame ring, using --prefetch-frames 1\n" );
+            i_prefetch = 1;
+        }
+        if( opt->i_render_threads > 1 )
+        {
+            if( !i_prefetch )
+            {
+                print_details("avs4x26x [info]: --render-threads renders into the frame ring, using --prefetch-frames 1\n" );
+                i_prefetch = 1;
+            }
+            /* classic AviSynth can't serve two frames at once, only AviSynth+ has MT modes */
+            if( !b_render_linear && !avs_h.func.avs_function_exists( avs_h.env, "SetFilterMTMode" ) )
+            {
+                print_warning("avs4x26x [warning]: AviSynth without MT support, --render-threads requests frames in order\n" );
+                b_render_linear = 1;
+            }
+        }
+        if( i_cache_range >= 0 )
+        {
+            /* keep every frame that can be requested at once in the cache of the output clip */
+            if( !i_cache_range )
+                i_cache_range = i_prefetch + opt->i_render_threads + i_avs_threads;
+            if( avs_h.func.avs_set_cache_hints )
+                avs_h.func.avs_set_cache_hints( avs_h.clip, AVS_CACHE_RANGE, i_cache_range );
+            else
+            {
+                print_warning("avs4x26x [warning]: AviSynth has no avs_set_cache_hints, --avs-cache-hints ignored\n" );
+                i_cache_range = -1;
+            }
+        }
+        {
+            char avs_mt[64], cache_hints[48] = "";
+            if( i_avs_threads )
+                snprintf( avs_mt, sizeof(avs_mt), "Prefetch(%d)", i_avs_threads );
+            else if( mt_mode > 0 && mt_mode < 5 )
+                snprintf( avs_mt, sizeof(avs_mt), "MT mode %d with Distributor()", mt_mode );
+            else
+                snprintf( avs_mt, sizeof(avs_mt), "as set up by the script" );
+            if( i_cache_range > 0 )
+                snprintf( cache_hints, sizeof(cache_hints), ", caching %d frames", i_cache_range );
+            print_info("avs4x26x [info]: AviSynth threading %s, %d render %s%s%s\n", avs_mt, opt->i_render_threads,
+                       opt->i_render_threads > 1 ? "threads" : "thread",
+                       opt->i_render_threads > 1 && b_render_linear ? " requesting frames in order" : "", cache_hints );
+        }
 
-        if (h_stdOut==INVALID_HANDLE_VALUE || h_stdErr==INVALID_HANDLE_VALUE)
+        /* samples above 8 bits take two bytes */
+        if ( i_pixel_bytes )
+            add_plane( &layout, AVS_PLANAR_Y, i_width * i_pixel_bytes, i_height );
+        else
+            add_plane( &layout, AVS_PLANAR_Y, i_width * (i_depth > 8 ? 2 : 1), i_height );
+        if ( chroma_width )
         {
-            print_error("Error: Couldn\'t get standard handles!");
-            goto avs_fail;
+            add_plane( &layout, AVS_PLANAR_U, chroma_width * (i_depth > 8 ? 2 : 1), chroma_height );
+            add_plane( &layout, AVS_PLANAR_V, chroma_width * (i_depth > 8 ? 2 : 1), chroma_height );
         }
 
-        saAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
-        saAttr.bInheritHandle = TRUE;
-        saAttr.lpSecurityDescriptor = NULL;
-
-        if (!CreatePipe(&h_pipeRead, &h_pipeWrite, &saAttr, PIPE_BUFFER_SIZE))
+        if( layout.i_format != FRAME_FORMAT_PLANAR && layout.i_format != FRAME_FORMAT_BOTTOM_UP )
         {
-            print_error("Error: Pipe creation failed!");
-            goto avs_fail;
+            static const char * const format_names[] = { [FRAME_FORMAT_STACK16] = "stack16", [FRAME_FORMAT_YV411] = "YV411",
+                [FRAME_FORMAT_YUV9] = "YUV9", [FRAME_FORMAT_RGB24] = "RGB24", [FRAME_FORMAT_RGB32] = "RGB32", [FRAME_FORMAT_YUY2] = "YUY2" };
+            const char *isa = convert_init( NULL );
+            int i_workers = os_cpu_count() - 1;
+            if( i_workers > CONVERT_WORKERS )
+                i_workers = CONVERT_WORKERS;
+            if( i_width * i_height >= CONVERT_THREADED_PIXELS ||
+                layout.i_format == FRAME_FORMAT_RGB24 || layout.i_format == FRAME_FORMAT_RGB32 )
+                convert_pool = convert_pool_create( i_workers );
+            print_details("avs4x26x [info]: Converting %s to %s with %s on %d %s\n", format_names[layout.i_format], csp_human, isa,
+                          convert_pool ? i_workers + 1 : 1, convert_pool ? "threads" : "thread" );
         }
 
-        if ( !SetHandleInformation(h_pipeWrite, HANDLE_FLAG_INHERIT, 0) )
+        if( opt->cache_dir )
         {
-            print_error("Error: SetHandleInformation");
-            goto pipe_fail;
+            uint64_t key = cache_key( infile, vi, &layout, i_freeze );
+            if( key && (cache_in = framecache_open_read( opt->cache_dir, key, &layout, i_frame_start, i_frame_total )) )
+                print_info("avs4x26x [info]: Reading frames from the frame cache\n" );
+            else if( key && (cache_out = framecache_open_write( opt->cache_dir, key, &layout, i_frame_start, i_frame_total,
+                                                                 os_cpu_count() / 2 )) )
+                print_details("avs4x26x [info]: Storing frames in the frame cache\n" );
+            else
+                print_warning("avs4x26x [warning]: Couldn't use the frame cache in \"%s\"\n", opt->cache_dir );
         }
 
-        ZeroMemory( &pi_info, sizeof(PROCESS_INFORMATION) );
-        ZeroMemory( &si_info, sizeof(STARTUPINFO) );
-        si_info.cb = sizeof(STARTUPINFO);
-        si_info.dwFlags = STARTF_USESTDHANDLES;
-        si_info.hStdInput = h_pipeRead;
-        si_info.hStdOutput = h_stdOut;
-        si_info.hStdError = h_stdErr;
-
-        for (i=1;i<argc;i++)
+        if( opt->b_y4m )
         {
-            if( !strncmp(argv[i], "--frames", 8) )
+            /* the ring keeps each frame until the next one has filled the pipe, then the reader has it all */
+            int b_splice = i_prefetch > 0 && !pipe_enable_splice( &pipe_out[0], layout.frame_size );
+            i_ring_lag = b_splice;
+            layout.frame_header = "FRAME\n";
+            y4m_header( y4m, sizeof(y4m), &opt->args, i_stream_width, i_height, i_fps_num, i_fps_den, csp, i_stream_depth );
+            print_details("avs4x26x [info]: Writing YUV4MPEG2 to stdout%s: %.*s\n", b_splice ? " with vmsplice" : "",
+                          (int)strlen( y4m ) - 1, y4m );
+            if( pipe_write( &pipe_out[0], y4m, strlen( y4m ) ) )
             {
-                if( !strcmp(argv[i], "--frames") )
-                {
-                    i_frame_total = atoi(argv[i+1]);
-                    for (int k=i;k<argc-2;k++)
-                        argv[k] = argv[k+2];
-                    argc -= 2;
-                }
-                else
-                {
-                    i_frame_total = atoi(argv[i]+9);
-                    for (int k=i;k<argc-1;k++)
-                        argv[k] = argv[k+1];
-                    argc -= 1;
-                }
-                i--;
-                b_change_frame_total = 1;
+                print_error("avs4x26x [error]: Couldn't write to stdout\n" );
+                goto process_fail;
             }
+            /* with seek-mode=safe the script sees every frame, those before --seek aren't written */
+            for ( frame=0; b_seek_safe && !cache_in && frame<i_frame_start; frame++ )
+                avs_h.func.avs_release_video_frame( avs_h.func.avs_get_frame( avs_h.clip, frame ) );
         }
-        if ( b_change_frame_total )
-            i_frame_total += i_frame_start; /* ending frame should add offset of i_frame_start, not needed if not set as will be clamped */
 
-        if ( vi->num_frames < i_frame_total )
+        if( opt->i_memory_budget )
+            memgov.i_budget = opt->i_memory_budget > 0 ? (int64_t)opt->i_memory_budget << 20
+                                                  : os_address_space_limit() / 100 * MEMGOV_DEFAULT_SHARE;
+        int64_t i_mem_used = os_address_space_used();
+        if( memgov.i_budget && i_mem_used > 0 )
         {
-            print_warning("avs4x26x [warning]: x26x is trying to encode until frame %d, but input clip has only %d %s\n",
-                     i_frame_total, vi->num_frames, vi->num_frames > 1 ? "frames" : "frame" );
-            i_frame_total = vi->num_frames;
+            /* the frame buffers get at most half of what is left, AviSynth's cache half of the rest */
+            int64_t i_mem_free = memgov.i_budget - i_mem_used, i_buffers;
+            int i_prefetch_asked = i_prefetch;
+            for( ;; )
+            {
+                i_buffers = !i_prefetch ? 1 : (cache_in ? i_prefetch : i_prefetch + opt->i_render_threads - 1) + i_ring_lag;
+                if( i_prefetch <= 1 || i_buffers * (int64_t)layout.frame_size <= i_mem_free / 2 )
+                    break;
+                i_prefetch--;
+            }
+            if( i_prefetch < i_prefetch_asked )
+                print_warning("avs4x26x [warning]: Prefetching %d frames instead of %d to stay within the memory budget\n",
+                              i_prefetch, i_prefetch_asked );
+            i_mem_free -= i_buffers * (int64_t)layout.frame_size;
+            int i_cache_max = i_mem_free > (128 << 20) ? (int)(i_mem_free / 2 >> 20) : 64;
+            /* the budget is ours, a server's cache is its own business */
+            AVS_Value mem_max = avs_h.server ? avs_void : avs_h.func.avs_invoke( avs_h.env, "SetMemoryMax", avs_new_value_int( 0 ), NULL );
+            if( avs_is_int( mem_max ) && avs_as_int( mem_max ) > i_cache_max )
+            {
+                avs_h.func.avs_release_value( avs_h.func.avs_invoke( avs_h.env, "SetMemoryMax",
+                                                                     avs_new_value_int( i_cache_max ), NULL ) );
+                print_details("avs4x26x [info]: Memory budget %d MB, %d MB in use, %d MB of frame buffers, SetMemoryMax(%d)\n",
+                              (int)(memgov.i_budget >> 20), (int)(i_mem_used >> 20),
+                              (int)(i_buffers * layout.frame_size >> 20), i_cache_max );
+            }
+            else
+                print_details("avs4x26x [info]: Memory budget %d MB, %d MB in use, %d MB of frame buffers, AviSynth cache %s\n",
+                              (int)(memgov.i_budget >> 20), (int)(i_mem_used >> 20),
+                              (int)(i_buffers * layout.frame_size >> 20),
+                              avs_is_int( mem_max ) ? "already within it" : "not adjustable" );
+            avs_h.func.avs_release_value( mem_max );
         }
 
-        i_encode_frames = i_frame_total - i_frame_start;
+        if( stats.b_enabled )
+            stats.frame_latency = malloc( (i_frame_total - i_frame_start) * sizeof(int) );
+        stats.i_setup = os_time_us() - stats.i_start;
 
-        if ( b_tc || b_qp || b_seek_safe )      /* don't skip the number --seek defines if has timecodes/qpfile or seek-mode=safe */
-        {
-            i_frame_start = 0;
-        }
-        else if ( i_frame_start != 0 )
+        if( i_prefetch > 0 )
         {
-            print_details("avs4x26x [info]: Convert \"--seek %d\" to internal frame skipping\n", i_frame_start );
+            /* every render thread works on a frame of its own besides the prefetched ones */
+            int i_depth = cache_in ? i_prefetch : i_prefetch + opt->i_render_threads - 1;
+            if( ring_init( &ring, pipe_out, i_outputs, &layout, i_depth, i_ring_lag, i_frame_start, i_frame_total, &memgov, stats.progress ) )
+            {
+                print_error("avs4x26x [error]: Couldn't allocate %d frame buffers of %u bytes\n",
+                            i_depth + i_ring_lag, (unsigned)layout.frame_size );
+                goto process_fail;
+            }
+            watch_ring( &watch, &ring );
+            int b_render_workers = opt->i_render_threads > 1 && !cache_in;
+            if( b_render_workers )
+            {
+                render_ctx_t render = { &ring, &avs_h, &layout, convert_pool, &cache_out, &stats, b_render_linear };
+                render.i_frame_end = i_frame_total;
+                int i_error = render_frames( &render, opt->i_render_threads, i_frame_start );
+                if( i_error >= 0 )
+                {
+                    print_error("\navs [error]: %s occurred while reading frame %d\n", render.error, i_error );
+                    ring_close( &ring );
+                    goto process_fail;
+                }
+            }
+            //render ahead while the writer thread feeds the pipe
+            for ( frame=i_frame_start; frame<i_frame_total && !b_render_workers; frame++ )
+            {
+                i_time = os_time_us();
+                char *data = ring_acquire( &ring, frame );
+                if( !data )
+                    break;
+                int64_t i_render_start = os_time_us();
+                stats.i_render_wait += i_render_start - i_time;
+                if( cache_in )
+                {
+                    if( framecache_read( cache_in, frame, data ) )
+                    {
+                        print_error("\navs4x26x [error]: The frame cache is damaged at frame %d\n", frame );
+                        ring_close( &ring );
+                        goto process_fail;
+                    }
+                    stats_frame( &stats, os_time_us() - i_render_start );
+                    ring_commit( &ring, frame );
+                    continue;
+                }
+                frm = avs_h.func.avs_get_frame( avs_h.clip, frame );
+                i_time = os_time_us();
+                stats_frame( &stats, i_time - i_render_start );
+                const char *err = avs_h.func.avs_clip_get_error( avs_h.clip );
+                if( err )
+                {
+                    print_error("\navs [error]: %s occurred while reading frame %d\n", err, frame );
+                    ring_close( &ring );
+                    goto process_fail;
+                }
+                pack_frame( &avs_h, &layout, convert_pool, frm, data );
+                avs_h.func.avs_release_video_frame( frm );
+                cache_frame( &cache_out, frame, data );
+                stats.i_copy += os_time_us() - i_time;
+                ring_commit( &ring, frame );
+            }
+            int i_failed = ring_finish( &ring );
+            for ( int o=0; o<i_outputs; o++ )
+            {
+                watch.out[o].i_delivered = ring.out[o].i_write_error >= 0 ? ring.out[o].i_write_error : ring.out[o].i_next_write;
+                /* the slowest x26x sets the pace, report its pipe */
+                if( ring.out[o].i_write_time >= stats.i_write )
+                {
+                    stats.i_write = ring.out[o].i_write_time;
+                    stats.i_write_wait = ring.out[o].i_wait_time;
+                }
+                if( ring.out[o].i_write_error < 0 )
+                    continue;
+                if( i_outputs > 1 )
+                    print_error("\navs [error]: Error occurred while writing frame %d to encoder %d\n"
+                                "(Maybe x26x closed)\n", ring.out[o].i_write_error, o + 1 );
+                else
+                    print_error("\navs [error]: Error occurred while writing frame %d\n"
+                                "(Maybe x26x closed)\n", ring.out[o].i_write_error );
+            }
+            ring_close( &ring );
+            if( i_failed || watch_cancelled( &watch ) )
+                goto process_fail;
+            goto process_done;
         }
 
-        cmd = generate_new_commandline(argc, argv, b_hbpp_vfw, i_frame_total, i_fps_num, i_fps_den, i_width, i_height, infile, csp, b_tc, i_encode_frames, b_x265 );
-        print_colored(CONSOLE_DARKGRAY, "avs4x26x [info]: %s\n", cmd);
-
-        if (!CreateProcess(NULL, cmd, NULL, NULL, TRUE, 0, NULL, NULL, &si_info, &pi_info))
+        staging = aligned_malloc( layout.frame_size );
+        if( !staging )
         {
-            LPVOID error_message;
-            DWORD error = GetLastError();
-            FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-                NULL, error, 0, (LPTSTR)&error_message, 0, NULL);
-            print_error( "Error %d: Failed to create process. %s", error, (LPCTSTR)error_message);
-            LocalFree(error_message);
-            free(cmd);
-            goto pipe_fail;
+            print_error("avs4x26x [error]: Couldn't allocate %u bytes for the frame buffer\n", (unsigned)layout.frame_size );
+            goto process_fail;
         }
-        //cleanup before writing to pipe
-        CloseHandle(h_pipeRead);
-        free(cmd);
 
         //write
         for ( frame=i_frame_start; frame<i_frame_total; frame++ )
         {
-            frm = avs_h.func.avs_get_frame( avs_h.clip, frame );
-            const char *err = avs_h.func.avs_clip_get_error( avs_h.clip );
-            if( err )
-            {
-                print_error("\navs [error]: %s occurred while reading frame %d\n", err, frame );
+            if( watch_cancelled( &watch ) )
                 goto process_fail;
+            memgov_sample( &memgov );
+            i_time = os_time_us();
+            if( cache_in )
+            {
+                if( framecache_read( cache_in, frame, staging ) )
+                {
+                    print_error("\navs4x26x [error]: The frame cache is damaged at frame %d\n", frame );
+                    goto process_fail;
+                }
+                stats_frame( &stats, os_time_us() - i_time );
+                frm = NULL;
             }
-
-            #define write_plane(offset, width, height, pitch)                                   \
-                plane = (char*)(frm->vfb->data + offset);                                       \
-                for (j=0; j<height; j++) {                                                      \
-                   if( !WriteFile(h_pipeWrite, plane, width, (PDWORD)&i, NULL) ) {              \
-                       print_error("\navs [error]: Error occurred while writing frame %d\n" \
-                                   "(Maybe x26x closed)\n", frame );                            \
-                       goto process_fail;                                                       \
-                   }                                                                            \
-                   plane += pitch;                                                              \
+            else
+            {
+                frm = avs_h.func.avs_get_frame( avs_h.clip, frame );
+                stats_frame( &stats, os_time_us() - i_time );
+                const char *err = avs_h.func.avs_clip_get_error( avs_h.clip );
+                if( err )
+                {
+                    print_error("\navs [error]: %s occurred while reading frame %d\n", err, frame );
+                    goto process_fail;
+                }
+                if( cache_out )
+                {
+                    /* the cache needs the packed frame anyway, so write it from there */
+                    i_time = os_time_us();
+                    pack_frame( &avs_h, &layout, convert_pool, frm, staging );
+                    avs_h.func.avs_release_video_frame( frm );
+                    frm = NULL;
+                    cache_frame( &cache_out, frame, staging );
+                    stats.i_copy += os_time_us() - i_time;
                 }
+            }
 
-            write_plane(frm->offset, i_width, i_height, frm->pitch);
-            write_plane(frm->offsetU, chroma_width, chroma_height, frm->pitchUV);
-            write_plane(frm->offsetV, chroma_width, chroma_height, frm->pitchUV);
-            avs_h.func.avs_release_video_frame( frm );
+            i_time = os_time_us();
+            int64_t i_copy = stats.i_copy;
+            int ret = write_frame_header( &pipe_out[0], &layout ) ||
+                      ( frm ? write_frame( &pipe_out[0], &avs_h, &layout, convert_pool, frm, staging, &stats )
+                            : pipe_write( &pipe_out[0], staging, layout.frame_size ) );
+            stats.i_write += os_time_us() - i_time - (stats.i_copy - i_copy);
+            if( frm )
+                avs_h.func.avs_release_video_frame( frm );
+            if( ret )
+            {
+                print_error("\navs [error]: Error occurred while writing frame %d\n"
+                            "(Maybe x26x closed)\n", frame );
+                goto process_fail;
+            }
+            progress_written( stats.progress, frame + 1, stats.i_write );
+            watch.out[0].i_delivered = frame + 1;
         }
+    process_done:
         //close & cleanup
+        b_done = 1;
 
     process_fail: // everything created
-        CloseHandle(h_pipeWrite);// h_pipeRead already closed
-        WaitForSingleObject(pi_info.hProcess, INFINITE);
-        GetExitCodeProcess(pi_info.hProcess,&exitcode);
-        CloseHandle(pi_info.hProcess);
+        stats.i_loop = os_time_us() - stats.i_start - stats.i_setup;
+        watch_closing( &watch );
+        for ( int o=0; o<i_outputs; o++ )
+            pipe_close(&pipe_out[o]);// h_pipeRead already closed
+        framecache_close( cache_in, 0 );
+        framecache_close( cache_out, b_done );
+        for ( int o=0; o<i_outputs && !opt->b_y4m; o++ )
+        {
+            int ret = watch_wait( &watch, o, i_frame_start );
+            if( !exitcode )
+                exitcode = ret;
+        }
+        if( watch.i_outputs )
+            os_mutex_destroy( &watch.mutex );
+        if( stats.b_enabled )
+            print_stats( &stats, i_prefetch > 0 );
+        if( memgov.i_peak && (memgov.i_budget || stats.b_enabled) )
+        {
+            char budget[64] = "";
+            if( memgov.i_budget )
+                snprintf( budget, sizeof(budget), " of the %d MB budget", (int)(memgov.i_budget >> 20) );
+            print_details("avs4x26x [info]: Peak address space use %d MB%s", (int)(memgov.i_peak >> 20), budget );
+            if( memgov.i_shrinks )
+                print_details(", read-ahead halved %d %s", memgov.i_shrinks, memgov.i_shrinks == 1 ? "time" : "times" );
+            print_details("\n" );
+        }
         goto avs_cleanup;// pipes already closed
 
-    pipe_fail: //pipe created but failed after that
-        CloseHandle(h_pipeRead);
-        CloseHandle(h_pipeWrite);
+    spawn_fail: //let the x26x already started see the end of their input
+        for ( int o=0; o<i_outputs; o++ )
+        {
+            pipe_close(&pipe_out[o]);
+            os_process_wait(&process[o]);
+        }
 
     avs_fail: //avs environmet created but failed after that
         exitcode = -1;
 
     avs_cleanup:
+        remove_shifted( shifted, 2 );
+        progress_close( stats.progress, b_done );
+        aligned_free( staging );
+        convert_pool_close( convert_pool );
+        free( stats.frame_latency );
+        stats.frame_latency = NULL;
+        if( report )
+            *report = stats;
         avs_h.func.avs_release_clip( avs_h.clip );
-        if( avs_h.func.avs_delete_script_environment )
-            avs_h.func.avs_delete_script_environment( avs_h.env );
-        FreeLibrary( avs_h.library );
+        avs_h.clip = NULL;
+        if( shared )
+        {
+            /* a failed job may leave the environment in any state, the next one gets a new one */
+            if( (!b_done || exitcode) && avs_h.env && avs_h.func.avs_delete_script_environment )
+            {
+                avs_h.func.avs_delete_script_environment( avs_h.env );
+                avs_h.env = NULL;
+            }
+            *shared = avs_h;
+        }
+        else
+        {
+            if( avs_h.func.avs_delete_script_environment )
+                avs_h.func.avs_delete_script_environment( avs_h.env );
+            os_library_close( avs_h.library );
+        }
+
+        if( i_segments > 1 )
+        {
+            progress_t *progress = NULL;
+            if( opt->progress_target && !(progress = progress_open( opt->progress_target, i_frame_start, i_frame_total,
+                                                                   PROGRESS_INTERVAL_MS )) )
+            {
+                print_error("avs4x26x [error]: Couldn't open \"%s\" for the progress\n", opt->progress_target );
+                exitcode = -1;
+            }
+            else
+            {
+                exitcode = run_segments( &opt->args, opt->args.outfile, i_frame_start, i_frame_total,
+                                         i_segments, i_segments < opt->i_segment_workers ? i_segments : opt->i_segment_workers,
+                                         outfile_is_hevc( opt->args.outfile ), progress, opt->b_stats );
+                progress_close( progress, !exitcode );
+            }
+        }
     }
     else
     {
+        char probe_file_buf[1024];
+        const char *probe_file = probecache_default_file( probe_file_buf, sizeof(probe_file_buf) );
         printf("\n"
                "avs4x26x - simple AviSynth pipe tool for x262/x264/x265\n"
                "Version: %d.%d.%d.%d-colorized, built on %s, %s\n\n",
@@ -1156,20 +3396,641 @@ source_dss:
                "                                         otherwise \"%s\"\n",
                                                 DEFAULT_X265_BINARY_PATH, DEFAULT_X264_BINARY_PATH);
         printf("     --seek-mode <string>   Set seek mode when using --seek. [Default=\"fast\"]\n"
-               "                                - fast: Skip process of frames before seek number as x26x does if no\n"
-               "                                        --tcfile-in/--qpfile specified;\n"
-               "                                        otherwise freeze frames before seek number to skip process, \n"
-               "                                        but keep frame number as-is.\n"
-               "                                        ( x26x treats tcfile-in/qpfile as timecodes/qpfile of input \n"
-               "                                        video, not output video )\n"
+               "                                - fast: Skip process of frames before seek number as x26x does.\n"
+               "                                        x26x is given copies of --tcfile-in/--qpfile renumbered\n"
+               "                                        from the seek number, as it treats them as timecodes/qpfile\n"
+               "                                        of input video, not output video; if they can't be written,\n"
+               "                                        freeze frames before seek number to skip process, but keep\n"
+               "                                        frame number as-is.\n"
                "                                        Normally safe enough for randomly seekable AviSynth scripts.\n"
                "                                        May break scripts which can only be linearly seeked, such as\n"
                "                                        TDecimate(mode=3)\n"
                "                                - safe: Process and deliver every frame to x26x.\n"
                "                                        Should give accurate result with every AviSynth script.\n"
                "                                        Significantly slower when the process is heavy.\n");
+        printf("     --input-format <string> How the script delivers its samples. [Default=\"native\"]\n"
+               "                                - native: As they are, AviSynth+ high bit depth included.\n"
+               "                                - stack16: Dither stack16, the MSB half stacked above the LSB half.\n"
+               "                                        Interleaved into 16-bit samples here, no Dither_out() needed.\n");
+        printf("     --y4m, --stdout        Write a YUV4MPEG2 stream to stdout instead of starting x26x, for\n"
+               "                                ffmpeg, SVT-AV1 and the like. Uses vmsplice on Linux when stdout\n"
+               "                                is a pipe. --seek, --frames, --sar and --tff/--bff apply.\n");
+        printf("     --convert <string>     Who converts RGB, YUY2, YV411 and YUV9 for x26x. [Default=\"internal\"]\n"
+               "                                - internal: Here, with SIMD on worker threads while packing frames.\n"
+               "                                - avisynth: ConvertToYV12/ConvertToYV16 in the script.\n"
+               "                                RGB and YUY2 are piped as they are when x264 takes them.\n");
+        printf("     --prefetch-frames <int> Number of frames rendered ahead while x26x reads the pipe.\n"
+               "                                0 renders and writes each frame in turn. [Default=%d]\n",
+                                                DEFAULT_PREFETCH_FRAMES);
+        printf("     --render-threads <int> Frames requested from AviSynth at once, by as many threads. Needs\n"
+               "                                AviSynth+ MT or a source filter that serves frames in parallel.\n"
+               "                                The frames still reach x26x in order. [Default=1]\n");
+        printf("     --render-linear        With --render-threads, request the frames one at a time in order,\n"
+               "                                for scripts that can only be read linearly, e.g. TDecimate(mode=3).\n"
+               "                                Packing the frames for x26x still runs in parallel.\n");
+        printf("     --avs-threads <int>    Wrap the output clip in Prefetch(<int>) on AviSynth+, for scripts\n"
+               "                                that don't call Prefetch themselves. \"auto\" uses one per CPU.\n");
+        printf("     --avs-cache-hints[=<int>] Make the cache of the output clip keep <int> frames, by default as\n"
+               "                                many as can be requested at once.\n");
+        printf("     --progress-json <string> Write the progress as a line of JSON every second to a file, or to\n"
+               "                                an inherited descriptor given by its number: frames written and\n"
+               "                                rendered, frameserver fps, time blocked on the pipe and the ETA.\n");
+        printf("     --memory-budget <int>  Address space in MB the process keeps below. AviSynth's cache is\n"
+               "                                capped with SetMemoryMax to fit the frame buffers, and the prefetch\n"
+               "                                shrinks when the budget is exceeded. 0 disables it. [Default=%d%% of\n"
+               "                                the address space of a 32-bit process, none in 64-bit]\n",
+                                                MEMGOV_DEFAULT_SHARE);
+        printf("     --frame-cache <dir>    Store the rendered frames losslessly compressed in <dir>, later runs\n"
+               "                                of the same script and range read them back instead of rendering.\n");
+        printf("     --plugin-map <string>  Load only the given plugin for inputs with these extensions instead\n"
+               "                                of autoloading the plugin directories, as ext=plugin[;ext=plugin...],\n"
+               "                                e.g. \"mkv=C:\\plugins\\LSMASHSource.dll;d2v=DGDecode.dll\". Repeatable.\n");
+        printf("     --probe-cache <file>   Where the source filter that opened each input is remembered, so\n"
+               "                                later runs skip the fallback chain. \"none\" disables it.\n"
+               "                                [Default=\"%s\"]\n", probe_file ? probe_file : "none");
+        printf("     --fanout <string>      Also feed the rendered frames to another x26x with these options,\n"
+               "                                e.g. --fanout \"-L x265 --crf 20 -o out.hevc\". Repeatable,\n"
+               "                                the script is rendered once and the slowest x26x sets the pace.\n");
+        printf("     --segments <int>       Split the frame range into segments encoded by this many parallel\n"
+               "                                avs4x26x and x26x instances, then join the elementary streams.\n"
+               "                                Needs a raw .264/.265/.hevc output. [Default=0, off]\n");
+        printf("     --avs-stats            Print the time spent in each stage and whether AviSynth or x26x\n"
+               "                                is the bottleneck at the end.\n");
+        printf("     --pipe-buffer <int>    Size of the pipe buffer to x26x in bytes, K and M suffixes allowed.\n"
+               "                                0 uses the system default. [Default=%dK]\n",
+                                                DEFAULT_PIPE_BUFFER_SIZE >> 10);
+        printf("     --jobs <file>          Run the command lines in <file>, one per line, one after another in\n"
+               "                                this process. The other arguments apply to every job. AviSynth\n"
+               "                                stays loaded and a job after a successful one reuses its script\n"
+               "                                environment with the plugins loaded. Lines starting with # are skipped.\n");
+        printf("     --avs-fresh-env        With --jobs, give the job a script environment of its own, for\n"
+               "                                scripts that depend on global state like SetFilterMTMode.\n");
+        printf("     --serve <string>       Run as a daemon keeping AviSynth loaded for clients connecting to the\n"
+               "                                Unix domain socket at this path, on Windows the named pipe\n"
+               "                                \\\\.\\pipe\\<string>. Clips opened by Import() or a source filter stay\n"
+               "                                open for the next client asking for the same file.\n");
+        printf("     --server <string>      Get the frames from an avs4x26x --serve instead of loading AviSynth.\n"
+               "                                Everything else works as usual, the script is opened by the server.\n");
+        return -1;
+    }
+    return exitcode;
+}
+
+/* --jobs: each line of the file is a job's command line, appended to the arguments given besides
+   --jobs, and run by encode() in this process. the library stays loaded all along, the script
+   environment and its plugins are passed on from one job to the next while they succeed */
+static int run_jobs( const options_t *opt )
+{
+    const arglist_t *a = &opt->args;
+    FILE *fh = fopen( opt->jobs_file, "r" );
+    if( !fh )
+    {
+        print_error("avs4x26x [error]: Couldn't open the job list \"%s\"\n", opt->jobs_file );
         return -1;
     }
-    CloseHandle(h_console);
+    avs_hnd_t shared = {0};
+    char line[8192];
+    int i_jobs = 0, i_failed = 0, exitcode = 0;
+    int64_t i_start = os_time_us();
+    while( fgets( line, sizeof(line), fh ) )
+    {
+        size_t len = strlen( line );
+        if( len == sizeof(line) - 1 && line[len-1] != '\n' )
+        {
+            print_error("avs4x26x [error]: A line of the job list is longer than %d characters\n", (int)sizeof(line) - 2 );
+            exitcode = -1;
+            break;
+        }
+        while( len && (line[len-1] == '\n' || line[len-1] == '\r') )
+            line[--len] = 0;
+        char *p = line + strspn( line, " \t" );
+        if( !*p || *p == '#' )
+            continue;
+        char **job = split_commandline( p );
+        int i_job_args = 0;
+        while( job && job[i_job_args] )
+            i_job_args++;
+        char **args = job ? malloc( (a->argc + i_job_args + 1) * sizeof(char*) ) : NULL;
+        if( !args )
+        {
+            free( job );
+            exitcode = -1;
+            break;
+        }
+        /* the shared options without --jobs, which a segment started from them would run again */
+        int n = 0;
+        for( int i = 0; i < a->argc; i++ )
+        {
+            if( a->arg_option[i] >= 0 && option_table[a->arg_option[i]].id == OPT_JOBS )
+                i += arg_width( a, i ) - 1;
+            else
+                args[n++] = a->argv[i];
+        }
+        memcpy( args + n, job, (i_job_args + 1) * sizeof(char*) );
+
+        i_jobs++;
+        print_colored(CONSOLE_WHITE, "avs4x26x [info]: job %d: %s\n", i_jobs, p );
+        stats_t report = {0};
+        int64_t i_job_start = os_time_us();
+        options_t job_opt;
+        int ret = -1;
+        if( parse_options( n + i_job_args, args, &job_opt ) )
+            ;
+        else if( job_opt.jobs_file || job_opt.serve )
+            print_error("avs4x26x [error]: --jobs and --serve can't be used in a job\n" );
+        else
+            ret = encode( &job_opt, &shared, &report );
+        free_options( &job_opt );
+        print_colored(ret ? CONSOLE_YELLOW : CONSOLE_CYAN, "avs4x26x [%s]: job %d %s with %d in %.3f s: setup %.3f s, "
+                      "of which plugins %.3f s, %d frames in %.3f s\n", ret ? "warning" : "info", i_jobs,
+                      ret ? "failed" : "finished", ret, (os_time_us() - i_job_start) / 1e6, report.i_setup / 1e6,
+                      report.i_plugins / 1e6, report.i_frames, report.i_loop / 1e6 );
+        if( ret )
+        {
+            i_failed++;
+            if( !exitcode )
+                exitcode = ret;
+        }
+        free( args );
+        free( job );
+    }
+    fclose( fh );
+    if( shared.env && shared.func.avs_delete_script_environment )
+        shared.func.avs_delete_script_environment( shared.env );
+    if( shared.library )
+        os_library_close( shared.library );
+    print_info("avs4x26x [info]: %d %s in %.3f s, %d failed\n", i_jobs, i_jobs == 1 ? "job" : "jobs",
+               (os_time_us() - i_start) / 1e6, i_failed );
     return exitcode;
 }
+
+/* --serve: AviSynth stays loaded with one script environment shared by all clients, each
+   connection is served by a thread of its own. clips made from scratch, by Import() or a source
+   filter, are kept after their clients are gone and handed to the next client asking for the same,
+   unless a file in the arguments changed, so scripts and source indexes stay open between encodes */
+#define SERVE_CACHED_CLIPS 16
+
+typedef struct
+{
+    char *key;              /* the request that made the clip, NULL once stale */
+    size_t key_size;
+    int64_t i_mtime;        /* of the files in the request */
+    AVS_Value value;
+    int i_users;
+    int64_t i_used;
+} serve_cached_t;
+
+typedef struct
+{
+    avs_hnd_t *h;
+    os_mutex_t mutex;       /* calls into the environment, frame requests too without MT */
+    int b_mt;
+    serve_cached_t cache[SERVE_CACHED_CLIPS];
+} server_t;
+
+typedef struct
+{
+    int b_used;
+    AVS_Value value;
+    AVS_Clip *clip;
+    serve_cached_t *cached; /* the value belongs to the cache */
+} serve_handle_t;
+
+typedef struct serve_client_t
+{
+    server_t *server;
+    remote_conn_t *conn;
+    os_thread_t thread;
+    int id;
+    int b_done;
+    serve_handle_t *handles;
+    int i_handles;
+    int b_clip_args;        /* the request being read has a clip among its arguments */
+    int i_frames;
+    struct serve_client_t *next;
+} serve_client_t;
+
+/* called with the server mutex held */
+static void serve_uncache( server_t *s, serve_cached_t *c )
+{
+    s->h->func.avs_release_value( c->value );
+    free( c->key );
+    memset( c, 0, sizeof(*c) );
+}
+
+static serve_handle_t *serve_handle( serve_client_t *cl, int handle )
+{
+    return handle >= 0 && handle < cl->i_handles && cl->handles[handle].b_used ? &cl->handles[handle] : NULL;
+}
+
+/* called with the server mutex held, takes over a value that isn't cached */
+static int serve_add_handle( serve_client_t *cl, AVS_Value value, serve_cached_t *cached )
+{
+    int i;
+    for( i = 0; i < cl->i_handles && cl->handles[i].b_used; i++ );
+    if( i == cl->i_handles )
+    {
+        serve_handle_t *handles = realloc( cl->handles, (cl->i_handles + 16) * sizeof(serve_handle_t) );
+        if( !handles )
+            return -1;
+        memset( handles + cl->i_handles, 0, 16 * sizeof(serve_handle_t) );
+        cl->handles = handles;
+        cl->i_handles += 16;
+    }
+    serve_handle_t *hnd = &cl->handles[i];
+    hnd->b_used = 1;
+    hnd->value = value;
+    hnd->clip = cl->server->h->func.avs_take_clip( value, cl->server->h->env );
+    hnd->cached = cached;
+    if( cached )
+        cached->i_users++;
+    return i;
+}
+
+/* called with the server mutex held */
+static void serve_release_handle( serve_client_t *cl, serve_handle_t *hnd )
+{
+    server_t *s = cl->server;
+    s->h->func.avs_release_clip( hnd->clip );
+    if( !hnd->cached )
+        s->h->func.avs_release_value( hnd->value );
+    else if( !--hnd->cached->i_users && !hnd->cached->key )
+        serve_uncache( s, hnd->cached );
+    memset( hnd, 0, sizeof(*hnd) );
+}
+
+static int serve_read_clip( void *ctx, remote_conn_t *c, AVS_Value *v )
+{
+    serve_client_t *cl = ctx;
+    int handle;
+    if( remote_read_int( c, &handle ) )
+        return -1;
+    serve_handle_t *hnd = serve_handle( cl, handle );
+    *v = hnd ? hnd->value : avs_void;
+    cl->b_clip_args = 1;
+    return 0;
+}
+
+static int serve_write_clip( void *ctx, remote_conn_t *c, AVS_Value v )
+{
+    serve_client_t *cl = ctx;
+    for( int i = 0; i < cl->i_handles; i++ )
+        if( cl->handles[i].b_used && cl->handles[i].value.d.clip == v.d.clip )
+        {
+            const avs_hnd_t *h = cl->server->h;
+            return remote_write_int( c, i ) || remote_write_video_info( c, h->func.avs_get_video_info( cl->handles[i].clip ) ) ||
+                   remote_write_int( c, h->func.avs_get_version( cl->handles[i].clip ) );
+        }
+    return -1;
+}
+
+/* the modification times of the files named by the arguments, summed up */
+static int64_t serve_files_mtime( AVS_Value v )
+{
+    int64_t i_size, i_mtime, i_sum = 0;
+    if( avs_is_string( v ) && v.d.string && !os_file_info( v.d.string, &i_size, &i_mtime ) )
+        return i_mtime;
+    for( int i = 0; avs_is_array( v ) && i < v.array_size; i++ )
+        i_sum += serve_files_mtime( v.d.array[i] );
+    return i_sum;
+}
+
+static int serve_invoke( serve_client_t *cl )
+{
+    server_t *s = cl->server;
+    remote_clips_t clips = { serve_write_clip, serve_read_clip, cl };
+    char *name = NULL, *names[64] = { NULL };
+    AVS_Value args = avs_void, res;
+    int i_names = 0, b_ok = 0;
+    size_t key_size;
+
+    cl->b_clip_args = 0;
+    remote_record( cl->conn );
+    if( remote_read_string( cl->conn, &name ) || !name || remote_read_value( cl->conn, &args, &clips ) ||
+        remote_read_int( cl->conn, &i_names ) || i_names < 0 || i_names > 64 )
+        goto fail;
+    for( int i = 0; i < i_names; i++ )
+        if( remote_read_string( cl->conn, &names[i] ) )
+            goto fail;
+    const char *key = remote_recorded( cl->conn, &key_size );
+    int64_t i_mtime = cl->b_clip_args ? 0 : serve_files_mtime( args );
+
+    os_mutex_lock( &s->mutex );
+    serve_cached_t *cached = NULL, *slot = NULL;
+    for( int i = 0; i < SERVE_CACHED_CLIPS && !cl->b_clip_args; i++ )
+    {
+        serve_cached_t *c = &s->cache[i];
+        if( c->key && c->key_size == key_size && !memcmp( c->key, key, key_size ) )
+        {
+            if( c->i_mtime == i_mtime )
+                cached = c;
+            else if( c->i_users )
+            {
+                /* a file changed, the clip goes once its last client is done with it */
+                free( c->key );
+                c->key = NULL;
+            }
+            else
+                serve_uncache( s, c );
+        }
+    }
+    if( cached )
+    {
+        res = cached->value;
+        print_details("avs4x26x [info]: client %d reuses the clip of an earlier %s()\n", cl->id, name );
+    }
+    else
+        res = s->h->func.avs_invoke( s->h->env, name, args, i_names ? (const char**)names : NULL );
+    if( avs_is_array( res ) )
+    {
+        s->h->func.avs_release_value( res );
+        res = avs_new_value_error( "the AviSynth server doesn't return arrays" );
+    }
+    if( avs_is_clip( res ) && !cached && !cl->b_clip_args )
+    {
+        /* the least recently used clip nobody is using makes room */
+        for( int i = 0; i < SERVE_CACHED_CLIPS; i++ )
+        {
+            serve_cached_t *c = &s->cache[i];
+            if( !c->i_users && (!slot || !c->key || (slot->key && c->i_used < slot->i_used)) )
+                slot = c;
+        }
+        if( slot && (slot->key || avs_is_clip( slot->value )) )
+            serve_uncache( s, slot );
+        if( slot && (slot->key = malloc( key_size )) )
+        {
+            memcpy( slot->key, key, key_size );
+            slot->key_size = key_size;
+            slot->i_mtime = i_mtime;
+            slot->value = res;
+            cached = slot;
+        }
+    }
+    if( cached )
+        cached->i_used = os_time_us();
+    if( avs_is_clip( res ) && serve_add_handle( cl, res, cached ) < 0 )
+    {
+        if( !cached )
+            s->h->func.avs_release_value( res );
+        res = avs_new_value_error( "out of memory" );
+    }
+    os_mutex_unlock( &s->mutex );
+
+    b_ok = !remote_write_value( cl->conn, res, &clips, 0 ) && !remote_flush( cl->conn );
+    if( !avs_is_clip( res ) )
+        s->h->func.avs_release_value( res );
+fail:
+    free( name );
+    remote_free_value( args );
+    for( int i = 0; i < i_names; i++ )
+        free( names[i] );
+    return b_ok ? 0 : -1;
+}
+
+/* frames go out as their planes without padding, flushed one by one so the client starts on
+   the first while the next one renders */
+static int serve_frames( serve_client_t *cl )
+{
+    server_t *s = cl->server;
+    const avs_hnd_t *h = s->h;
+    int handle, first, count;
+    if( remote_read_int( cl->conn, &handle ) || remote_read_int( cl->conn, &first ) || remote_read_int( cl->conn, &count ) )
+        return -1;
+    serve_handle_t *hnd = serve_handle( cl, handle );
+    if( !hnd )
+        return -1;
+    const AVS_VideoInfo *vi = h->func.avs_get_video_info( hnd->clip );
+    int plane_id[MAX_PLANES], row_size[MAX_PLANES], height[MAX_PLANES];
+    int i_planes = remote_frame_planes( vi, plane_id, row_size, height );
+    for( int n = first; n < first + count; n++ )
+    {
+        if( !s->b_mt )
+            os_mutex_lock( &s->mutex );
+        AVS_VideoFrame *frm = h->func.avs_get_frame( hnd->clip, n );
+        const char *err = h->func.avs_clip_get_error( hnd->clip );
+        int b_fail;
+        if( err || !frm )
+            b_fail = remote_write_int( cl->conn, 1 ) || remote_write_string( cl->conn, err ? err : "no frame" );
+        else
+        {
+            b_fail = remote_write_int( cl->conn, 0 ) || remote_write_int( cl->conn, i_planes );
+            for( int p = 0; p < i_planes && !b_fail; p++ )
+                b_fail = remote_write_int( cl->conn, plane_id[p] ) || remote_write_int( cl->conn, row_size[p] ) ||
+                         remote_write_int( cl->conn, height[p] );
+            for( int p = 0; p < i_planes && !b_fail; p++ )
+            {
+                const BYTE *src = frame_read_ptr( h, frm, plane_id[p] );
+                int pitch = frame_pitch( h, frm, plane_id[p] );
+                if( pitch == row_size[p] )
+                    b_fail = remote_write( cl->conn, src, (size_t)row_size[p] * height[p] );
+                else
+                    for( int y = 0; y < height[p] && !b_fail; y++ )
+                        b_fail = remote_write( cl->conn, src + (ptrdiff_t)y * pitch, row_size[p] );
+            }
+        }
+        if( frm )
+            h->func.avs_release_video_frame( frm );
+        if( !s->b_mt )
+            os_mutex_unlock( &s->mutex );
+        if( b_fail || remote_flush( cl->conn ) )
+            return -1;
+        cl->i_frames++;
+    }
+    return 0;
+}
+
+static os_thread_ret OS_THREAD_CC serve_client( void *arg )
+{
+    serve_client_t *cl = arg;
+    server_t *s = cl->server;
+    int64_t i_start = os_time_us();
+    int op, magic, version, b_ok = 0;
+    if( !remote_read_int( cl->conn, &op ) && op == REMOTE_HELLO && !remote_read_int( cl->conn, &magic ) &&
+        !remote_read_int( cl->conn, &version ) )
+    {
+        b_ok = magic == REMOTE_MAGIC && version == REMOTE_VERSION;
+        if( remote_write_int( cl->conn, b_ok ? 0 : -1 ) || remote_flush( cl->conn ) )
+            b_ok = 0;
+    }
+    while( b_ok && !remote_read_int( cl->conn, &op ) )
+    {
+        int handle, a, b;
+        char *name;
+        serve_handle_t *hnd;
+        switch( op )
+        {
+            case REMOTE_FUNCTION_EXISTS:
+                if( remote_read_string( cl->conn, &name ) || !name )
+                    b_ok = 0;
+                else
+                {
+                    os_mutex_lock( &s->mutex );
+                    a = s->h->func.avs_function_exists( s->h->env, name );
+                    os_mutex_unlock( &s->mutex );
+                    b_ok = !remote_write_int( cl->conn, a ) && !remote_flush( cl->conn );
+                }
+                free( name );
+                break;
+            case REMOTE_INVOKE:
+                b_ok = !serve_invoke( cl );
+                break;
+            case REMOTE_RELEASE_CLIP:
+                b_ok = !remote_read_int( cl->conn, &handle );
+                os_mutex_lock( &s->mutex );
+                if( b_ok && (hnd = serve_handle( cl, handle )) )
+                    serve_release_handle( cl, hnd );
+                os_mutex_unlock( &s->mutex );
+                break;
+            case REMOTE_GET_FRAMES:
+                b_ok = !serve_frames( cl );
+                break;
+            case REMOTE_SET_CACHE_HINTS:
+                b_ok = !remote_read_int( cl->conn, &handle ) && !remote_read_int( cl->conn, &a ) && !remote_read_int( cl->conn, &b );
+                hnd = b_ok ? serve_handle( cl, handle ) : NULL;
+                if( hnd )
+                {
+                    os_mutex_lock( &s->mutex );
+                    a = s->h->func.avs_set_cache_hints ? s->h->func.avs_set_cache_hints( hnd->clip, a, b ) : 0;
+                    os_mutex_unlock( &s->mutex );
+                    b_ok = !remote_write_int( cl->conn, a ) && !remote_flush( cl->conn );
+                }
+                else
+                    b_ok = 0;
+                break;
+            default:
+                b_ok = 0;
+                break;
+        }
+    }
+
+    os_mutex_lock( &s->mutex );
+    for( int i = 0; i < cl->i_handles; i++ )
+        if( cl->handles[i].b_used )
+            serve_release_handle( cl, &cl->handles[i] );
+    cl->b_done = 1;
+    os_mutex_unlock( &s->mutex );
+    print_details("avs4x26x [info]: client %d disconnected, %d frames served in %.1f s\n", cl->id, cl->i_frames,
+                  (os_time_us() - i_start) / 1e6 );
+    return 0;
+}
+
+static int serve( const char *name )
+{
+    avs_hnd_t avs_h = {0};
+    server_t server = { .h = &avs_h };
+    serve_client_t *clients = NULL;
+    char err[256];
+    int i_clients = 0;
+
+    if( avs_load_library( &avs_h ) )
+    {
+        print_error("avs [error]: failed to load avisynth\n" );
+        return -1;
+    }
+    avs_h.env = avs_h.func.avs_create_script_environment( AVS_INTERFACE_YV12 );
+    if( !avs_h.env )
+    {
+        print_error("avs [error]: failed to initiate avisynth\n" );
+        os_library_close( avs_h.library );
+        return -1;
+    }
+    print_colored(CONSOLE_WHITE, "avs [info]: %s\n", get_avs_version_string( avs_h ) );
+    server.b_mt = avs_h.func.avs_function_exists( avs_h.env, "SetFilterMTMode" );
+    os_server_t *listener = os_server_open( name );
+    if( !listener )
+    {
+        print_error("avs4x26x [error]: Couldn't serve on \"%s\": %s\n", name, os_error_string( err, sizeof(err) ) );
+        if( avs_h.func.avs_delete_script_environment )
+            avs_h.func.avs_delete_script_environment( avs_h.env );
+        os_library_close( avs_h.library );
+        return -1;
+    }
+    os_mutex_init( &server.mutex );
+    print_info("avs4x26x [info]: Serving AviSynth on \"%s\"%s\n", name,
+               server.b_mt ? "" : ", frame requests of different clients take turns" );
+    for( ;; )
+    {
+        os_handle_t h = os_server_accept( listener );
+        if( h == OS_INVALID_HANDLE )
+        {
+            print_error("avs4x26x [error]: Couldn't accept a client: %s\n", os_error_string( err, sizeof(err) ) );
+            break;
+        }
+        /* the threads of the clients that are gone */
+        os_mutex_lock( &server.mutex );
+        for( serve_client_t **p = &clients; *p; )
+        {
+            serve_client_t *cl = *p;
+            if( !cl->b_done )
+            {
+                p = &cl->next;
+                continue;
+            }
+            *p = cl->next;
+            os_mutex_unlock( &server.mutex );
+            os_thread_join( cl->thread );
+            remote_conn_close( cl->conn );
+            free( cl->handles );
+            free( cl );
+            os_mutex_lock( &server.mutex );
+        }
+        os_mutex_unlock( &server.mutex );
+
+        serve_client_t *cl = calloc( 1, sizeof(serve_client_t) );
+        if( !cl || !(cl->conn = remote_conn_open( h )) )
+        {
+            free( cl );
+            os_handle_close( h );
+            continue;
+        }
+        cl->server = &server;
+        cl->id = ++i_clients;
+        print_details("avs4x26x [info]: client %d connected\n", cl->id );
+        if( os_thread_create( &cl->thread, serve_client, cl ) )
+        {
+            remote_conn_close( cl->conn );
+            free( cl );
+            continue;
+        }
+        os_mutex_lock( &server.mutex );
+        cl->next = clients;
+        clients = cl;
+        os_mutex_unlock( &server.mutex );
+    }
+
+    os_server_close( listener );
+    while( clients )
+    {
+        serve_client_t *cl = clients;
+        clients = cl->next;
+        os_thread_join( cl->thread );
+        remote_conn_close( cl->conn );
+        free( cl->handles );
+        free( cl );
+    }
+    for( int i = 0; i < SERVE_CACHED_CLIPS; i++ )
+        if( server.cache[i].key || avs_is_clip( server.cache[i].value ) )
+            serve_uncache( &server, &server.cache[i] );
+    os_mutex_destroy( &server.mutex );
+    if( avs_h.func.avs_delete_script_environment )
+        avs_h.func.avs_delete_script_environment( avs_h.env );
+    os_library_close( avs_h.library );
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    options_t opt;
+    int ret;
+    os_console_init();
+    if( parse_options( argc, argv, &opt ) )
+        ret = -1;
+    else if( opt.serve )
+        ret = serve( opt.serve );
+    else if( opt.jobs_file )
+        ret = run_jobs( &opt );
+    else
+        ret = encode( &opt, NULL, NULL );
+    free_options( &opt );
+    return ret;
+}
@@ -0,0 +1,357 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+/* stand-in for the AviSynth library, only good for measuring avs4x26x itself.
+   it implements the functions avs4x26x loads and serves a small pool of pre-generated frames.
+   the "script" passed to Import() is a list of key=value pairs, e.g.
+       width=1920 height=1080 csp=yv12 pad=64 frames=1000 fps=24000/1001
+   pad is the number of bytes added to each row's pitch.
+   STUB_SOURCES, a comma separated list of filter names, makes those filters exist and open
+   their first argument like Import(), to exercise the source filter probing.
+   STUB_RENDER_MS makes every frame request take that long, as a script would, and
+   STUB_FAIL_FRAME makes the request of that frame fail.
+   ConvertToYV12 and ConvertToYV16 convert each frame as it is requested, on the calling thread,
+   with the same code avs4x26x uses, to compare --convert avisynth with the internal conversion.
+   Prefetch returns its clip as it is, avs_set_cache_hints and SetMemoryMax are accepted and ignored */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+#define __stdcall
+#define __declspec(i)
+#endif
+#define AVISYNTH_C_EXPORTS
+#include "../avisynth_c.h"
+#include "../convert.h"
+
+/* frames are served round-robin from a pool so the frame data isn't constant */
+#define POOL_SIZE 4
+
+struct AVS_ScriptEnvironment
+{
+    char error[256];
+};
+
+struct AVS_Clip
+{
+    AVS_VideoInfo vi;
+    AVS_Clip *source;       /* converted from, NULL for an imported clip */
+    int b_interlaced;
+    AVS_VideoFrame frames[POOL_SIZE];
+    AVS_VideoFrameBuffer buffers[POOL_SIZE];
+};
+
+static const struct
+{
+    const char *name;
+    int pixel_type;
+} csp_table[] =
+{
+    { "yv12", AVS_CS_YV12 },
+    { "yv16", AVS_CS_YV16 },
+    { "yv24", AVS_CS_YV24 },
+    { "yv411", AVS_CS_YV411 },
+    { "yuv9", AVS_CS_YUV9 },
+    { "y8", AVS_CS_Y8 },
+    { "yuy2", AVS_CS_YUY2 },
+    { "rgb24", AVS_CS_BGR24 },
+    { "rgb32", AVS_CS_BGR32 },
+    { "yuv420p10", AVS_CS_YV12 | AVS_CS_SAMPLE_BITS_10 },
+    { "yuv420p16", AVS_CS_YV12 | AVS_CS_SAMPLE_BITS_16 },
+    { "yuv422p10", AVS_CS_YV16 | AVS_CS_SAMPLE_BITS_10 },
+    { "yuv444p12", AVS_CS_YV24 | AVS_CS_SAMPLE_BITS_12 },
+    { 0 }
+};
+
+static int parse_csp( const char *name )
+{
+    for( int i = 0; csp_table[i].name; i++ )
+        if( !strcasecmp( csp_table[i].name, name ) )
+            return csp_table[i].pixel_type;
+    return 0;
+}
+
+/* bytes per row of the luma (or only) plane, and the chroma subsampling shifts */
+static int row_size( const AVS_VideoInfo *vi )
+{
+    if( avs_is_planar( vi ) )
+        return vi->width * (avs_bits_per_component( vi ) > 8 ? 2 : 1);
+    return vi->width * (avs_is_yuy2( vi ) ? 2 : avs_is_rgb24( vi ) ? 3 : 4);
+}
+
+static void chroma_shift( const AVS_VideoInfo *vi, int *shift_w, int *shift_h )
+{
+    switch( vi->pixel_type & AVS_CS_SUB_WIDTH_MASK )
+    {
+        case AVS_CS_SUB_WIDTH_1: *shift_w = 0; break;
+        case AVS_CS_SUB_WIDTH_4: *shift_w = 2; break;
+        default:                 *shift_w = 1; break;
+    }
+    switch( vi->pixel_type & AVS_CS_SUB_HEIGHT_MASK )
+    {
+        case AVS_CS_SUB_HEIGHT_1: *shift_h = 0; break;
+        case AVS_CS_SUB_HEIGHT_4: *shift_h = 2; break;
+        default:                  *shift_h = 1; break;
+    }
+}
+
+static void fill_plane( BYTE *dst, int pitch, int width, int height, int seed )
+{
+    for( int y = 0; y < height; y++, dst += pitch )
+        for( int x = 0; x < width; x++ )
+            dst[x] = (BYTE)(x + 2 * y + 3 * seed + ((x * 7 + y * 13) >> 4));
+}
+
+static int create_frames( AVS_Clip *clip, int pad )
+{
+    AVS_VideoInfo *vi = &clip->vi;
+    int pitch = row_size( vi ) + pad;
+    int b_chroma = avs_is_planar( vi ) && !avs_is_color_space_any_depth( vi, AVS_CS_Y8 );
+    int shift_w = 0, shift_h = 0;
+    if( b_chroma )
+        chroma_shift( vi, &shift_w, &shift_h );
+    int width_uv = row_size( vi ) >> shift_w, height_uv = vi->height >> shift_h;
+    int pitch_uv = b_chroma ? width_uv + pad : 0;
+    int size_y = pitch * vi->height, size_uv = pitch_uv * height_uv;
+
+    for( int i = 0; i < POOL_SIZE; i++ )
+    {
+        AVS_VideoFrameBuffer *vfb = &clip->buffers[i];
+        AVS_VideoFrame *frm = &clip->frames[i];
+        vfb->data_size = size_y + 2 * size_uv;
+        vfb->data = malloc( vfb->data_size );
+        if( !vfb->data )
+            return -1;
+        vfb->refcount = 1;
+        frm->refcount = 1;
+        frm->vfb = vfb;
+        frm->offset = 0;
+        frm->pitch = pitch;
+        frm->row_size = row_size( vi );
+        frm->height = vi->height;
+        frm->offsetV = size_y;
+        frm->offsetU = size_y + size_uv;
+        frm->pitchUV = pitch_uv;
+        frm->row_sizeUV = b_chroma ? width_uv : 0;
+        frm->heightUV = b_chroma ? height_uv : 0;
+        fill_plane( vfb->data, pitch, frm->row_size, vi->height, i );
+        if( b_chroma )
+        {
+            fill_plane( vfb->data + frm->offsetU, pitch_uv, width_uv, height_uv, i + 64 );
+            fill_plane( vfb->data + frm->offsetV, pitch_uv, width_uv, height_uv, i + 128 );
+        }
+    }
+    return 0;
+}
+
+static AVS_Value import( AVS_ScriptEnvironment *env, const char *filename )
+{
+    char key[32], value[64];
+    int pad = 0;
+    FILE *fh = fopen( filename, "r" );
+    if( !fh )
+    {
+        snprintf( env->error, sizeof(env->error), "Import: couldn't open \"%s\"", filename );
+        return avs_new_value_error( env->error );
+    }
+    AVS_Clip *clip = calloc( 1, sizeof(AVS_Clip) );
+    clip->vi.width = 1920;
+    clip->vi.height = 1080;
+    clip->vi.pixel_type = AVS_CS_YV12;
+    clip->vi.num_frames = 1000;
+    clip->vi.fps_numerator = 24000;
+    clip->vi.fps_denominator = 1001;
+    while( fscanf( fh, " %31[^= \n]=%63s", key, value ) == 2 )
+    {
+        if( !strcmp( key, "width" ) )
+            clip->vi.width = atoi( value );
+        else if( !strcmp( key, "height" ) )
+            clip->vi.height = atoi( value );
+        else if( !strcmp( key, "frames" ) )
+            clip->vi.num_frames = atoi( value );
+        else if( !strcmp( key, "pad" ) )
+            pad = atoi( value );
+        else if( !strcmp( key, "fps" ) )
+            sscanf( value, "%u/%u", &clip->vi.fps_numerator, &clip->vi.fps_denominator );
+        else if( !strcmp( key, "csp" ) && !(clip->vi.pixel_type = parse_csp( value )) )
+            break;
+    }
+    fclose( fh );
+    if( !clip->vi.pixel_type || create_frames( clip, pad ) )
+    {
+        free( clip );
+        snprintf( env->error, sizeof(env->error), "Import: invalid clip description in \"%s\"", filename );
+        return avs_new_value_error( env->error );
+    }
+    AVS_Value ret;
+    ret.type = 'c';
+    ret.array_size = 0;
+    ret.d.clip = clip;
+    return ret;
+}
+
+static AVS_Value convert( AVS_ScriptEnvironment *env, const char *name, AVS_Value args )
+{
+    AVS_Value src = avs_array_elt( args, 0 ), interlaced = avs_array_elt( args, 1 );
+    AVS_Clip *source = avs_is_clip( src ) ? src.d.clip : NULL;
+    int b_422 = !strcmp( name, "ConvertToYV16" );
+    /* the conversions convert.c has, 8-bit only */
+    if( !source || (b_422 ? !avs_is_yuy2( &source->vi ) :
+        !( avs_is_rgb( &source->vi ) || avs_is_yv411( &source->vi ) || avs_is_color_space( &source->vi, AVS_CS_YUV9 ) )) )
+    {
+        snprintf( env->error, sizeof(env->error), "%s: unsupported input in the benchmark stub", name );
+        return avs_new_value_error( env->error );
+    }
+    AVS_Clip *clip = calloc( 1, sizeof(AVS_Clip) );
+    clip->vi = source->vi;
+    clip->vi.pixel_type = b_422 ? AVS_CS_YV16 : AVS_CS_YV12;
+    clip->source = source;
+    clip->b_interlaced = avs_is_bool( interlaced ) && avs_as_bool( interlaced );
+    if( create_frames( clip, 0 ) )
+    {
+        free( clip );
+        return avs_new_value_error( "out of memory" );
+    }
+    /* convert.c writes the planes in Y, U, V order */
+    for( int i = 0; i < POOL_SIZE; i++ )
+    {
+        clip->frames[i].offsetU = clip->frames[i].offsetV;
+        clip->frames[i].offsetV = clip->frames[i].offsetU + clip->frames[i].pitchUV * clip->frames[i].heightUV;
+    }
+    convert_init( NULL );
+    AVS_Value ret;
+    ret.type = 'c';
+    ret.array_size = 0;
+    ret.d.clip = clip;
+    return ret;
+}
+
+AVSC_API(AVS_ScriptEnvironment *, avs_create_script_environment)( int version )
+{
+    return calloc( 1, sizeof(AVS_ScriptEnvironment) );
+}
+
+AVSC_API(void, avs_delete_script_environment)( AVS_ScriptEnvironment *env )
+{
+    free( env );
+}
+
+static int is_stub_source( const char *name )
+{
+    const char *list = getenv( "STUB_SOURCES" );
+    size_t len = strlen( name );
+    for( const char *p = list; p && *p; p += strcspn( p, "," ), p += !!*p )
+        if( !strncmp( p, name, len ) && (p[len] == ',' || !p[len]) )
+            return 1;
+    return 0;
+}
+
+AVSC_API(int, avs_function_exists)( AVS_ScriptEnvironment *env, const char *name )
+{
+    /* SetFilterMTMode tells avs4x26x that frames may be requested from several threads */
+    return !strcmp( name, "Import" ) || !strcmp( name, "VersionString" ) || !strcmp( name, "AutoloadPlugins" ) ||
+           !strcmp( name, "LoadPlugin" ) || !strcmp( name, "SetFilterMTMode" ) || !strcmp( name, "Prefetch" ) ||
+           is_stub_source( name );
+}
+
+AVSC_API(AVS_Value, avs_invoke)( AVS_ScriptEnvironment *env, const char *name, AVS_Value args, const char **arg_names )
+{
+    if( !strcmp( name, "Import" ) || is_stub_source( name ) )
+    {
+        AVS_Value file = avs_array_elt( args, 0 );
+        return avs_is_string( file ) ? import( env, avs_as_string( file ) ) : avs_new_value_error( "Import: no file name" );
+    }
+    /* plugins are only pretended to be loaded */
+    if( !strcmp( name, "AutoloadPlugins" ) || !strcmp( name, "LoadPlugin" ) )
+        return avs_void;
+    if( !strcmp( name, "VersionString" ) )
+        return avs_new_value_string( "AviSynth stub for benchmarking" );
+    if( !strcmp( name, "ConvertToYV12" ) || !strcmp( name, "ConvertToYV16" ) )
+        return convert( env, name, args );
+    if( !strcmp( name, "Prefetch" ) )
+        return avs_array_elt( args, 0 );
+    if( !strcmp( name, "SetMemoryMax" ) )
+        return avs_new_value_int( 1024 );
+    snprintf( env->error, sizeof(env->error), "%s is not available in the benchmark stub", name );
+    return avs_new_value_error( env->error );
+}
+
+AVSC_API(AVS_Clip *, avs_take_clip)( AVS_Value value, AVS_ScriptEnvironment *env )
+{
+    return value.d.clip;
+}
+
+AVSC_API(int, avs_set_cache_hints)( AVS_Clip *clip, int cachehints, int frame_range )
+{
+    return 0;
+}
+
+AVSC_API(void, avs_release_value)( AVS_Value value )
+{
+}
+
+AVSC_API(void, avs_release_clip)( AVS_Clip *clip )
+{
+    /* clips are shared between values and never freed, the process is short lived */
+}
+
+static __thread const char *clip_error;
+
+AVSC_API(const char *, avs_clip_get_error)( AVS_Clip *clip )
+{
+    return clip_error;
+}
+
+AVSC_API(int, avs_get_version)( AVS_Clip *clip )
+{
+    return 6;
+}
+
+AVSC_API(const AVS_VideoInfo *, avs_get_video_info)( AVS_Clip *clip )
+{
+    return &clip->vi;
+}
+
+AVSC_API(AVS_VideoFrame *, avs_get_frame)( AVS_Clip *clip, int n )
+{
+    AVS_VideoFrame *frm = &clip->frames[n % POOL_SIZE];
+    const char *delay = getenv( "STUB_RENDER_MS" ), *fail = getenv( "STUB_FAIL_FRAME" );
+    if( delay )
+        usleep( atoi( delay ) * 1000 );
+    clip_error = fail && atoi( fail ) == n ? "stub failure" : NULL;
+    if( clip_error )
+        return NULL;    /* as AviSynth does when the frame can't be made */
+    if( clip->source )
+    {
+        const AVS_VideoFrame *src = avs_get_frame( clip->source, n );
+        const AVS_VideoInfo *vi = &clip->source->vi;
+        const BYTE *data = src->vfb->data;
+        char *dst = (char*)frm->vfb->data;
+        if( avs_is_yuy2( vi ) )
+            convert_yuy2_422( NULL, dst, data, src->pitch, vi->width, vi->height );
+        else if( avs_is_rgb( vi ) )
+            convert_rgb_420( NULL, dst, data, src->pitch, avs_is_rgb24( vi ) ? 3 : 4, vi->width, vi->height, clip->b_interlaced );
+        else
+        {
+            for( int y = 0; y < vi->height; y++ )
+                memcpy( dst + (size_t)y * vi->width, data + (size_t)y * src->pitch, vi->width );
+            int b_yuv9 = avs_is_color_space( vi, AVS_CS_YUV9 );
+            convert_chroma_420( NULL, dst + frm->offsetU, data + src->offsetU, src->pitchUV, frm->row_sizeUV, frm->heightUV,
+                                b_yuv9, clip->b_interlaced );
+            convert_chroma_420( NULL, dst + frm->offsetV, data + src->offsetV, src->pitchUV, frm->row_sizeUV, frm->heightUV,
+                                b_yuv9, clip->b_interlaced );
+        }
+    }
+    return frm;
+}
+
+AVSC_API(void, avs_release_video_frame)( AVS_VideoFrame *frame )
+{
+}
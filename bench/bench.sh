@@ -0,0 +1,61 @@
+#!/bin/bash
+# Throughput of avs4x26x itself, without the cost of a real script or encoder.
+# avs4x26x is run against a stub AviSynth library serving pre-generated frames and
+# a null encoder that drains the pipe; fps and MB/s are measured by the null encoder
+# from the first byte to the end of the stream, CPU time is that of avs4x26x alone.
+# The conversion cases compare with the stub's ConvertToYV12, which converts serially on the
+# frameserver thread like AviSynth does: bench.sh --convert avisynth. convert_bench times the
+# conversion kernels alone.
+#
+# usage: bench/bench.sh [avs4x26x options]
+#   BENCH_FRAMES  number of frames per case (default 500)
+#   BENCH_CASES   space separated list of cases to run (default all), see below
+
+cd "$(dirname "$0")" || exit 1
+OUT=out
+FRAMES=${BENCH_FRAMES:-500}
+mkdir -p $OUT
+
+gcc -O2 -std=gnu99 -shared -fPIC avisynth_stub.c ../convert.c ../osdep.c -o $OUT/libavisynth.so -lpthread || exit 1
+gcc -O2 -std=gnu99 null_encoder.c -o $OUT/null_encoder || exit 1
+gcc -O2 -std=gnu99 convert_bench.c ../convert.c ../osdep.c -o $OUT/convert_bench -ldl -lpthread || exit 1
+if [ ! -x ../avs4x26x ]; then
+    (cd .. && ./build.sh) || exit 1
+fi
+
+# name: stub clip description
+declare -A CASES=(
+    [1080p-yv12]="width=1920 height=1080 csp=yv12 pad=0"
+    [1080p-yv12-pad]="width=1920 height=1080 csp=yv12 pad=64"
+    [2160p-yv12-pad]="width=3840 height=2160 csp=yv12 pad=64"
+    [2160p-yv24-pad]="width=3840 height=2160 csp=yv24 pad=64"
+    [1080p-yv411]="width=1920 height=1080 csp=yv411 pad=0"
+    [1080p-rgb32-hevc]="width=1920 height=1080 csp=rgb32 pad=0"
+    [2160p-rgb24-hevc]="width=3840 height=2160 csp=rgb24 pad=0"
+)
+NAMES=${BENCH_CASES:-"1080p-yv12 1080p-yv12-pad 2160p-yv12-pad 2160p-yv24-pad 1080p-yv411 1080p-rgb32-hevc 2160p-rgb24-hevc"}
+
+printf "%-16s %8s %10s %10s %10s %8s\n" case frames fps MB/s "cpu(s)" "wall(s)"
+status=0
+for name in $NAMES; do
+    # keep the script untouched between runs so --frame-cache can hit
+    desc="${CASES[$name]} frames=$FRAMES"
+    [ "$(cat $OUT/$name.avs 2>/dev/null)" = "$desc" ] || echo "$desc" > $OUT/$name.avs
+    TIMEFORMAT="bench_time: real=%R user=%U sys=%S"
+    # x264 takes RGB as it is, an HEVC output name makes avs4x26x convert it
+    case $name in *-hevc) output=$OUT/null.hevc ;; *) output=/dev/null ;; esac
+    { time LD_LIBRARY_PATH=$OUT ../avs4x26x --x26x-binary $OUT/null_encoder "$@" -o $output $OUT/$name.avs ; } \
+        > $OUT/$name.log 2>&1
+    rc=$?
+    enc=$(grep '^null_encoder: bytes' $OUT/$name.log)
+    tim=$(grep '^bench_time:' $OUT/$name.log)
+    if [ $rc -ne 0 ] || [ -z "$enc" ]; then
+        echo "$name: failed, see bench/$OUT/$name.log"
+        status=1
+        continue
+    fi
+    eval "$(echo "$enc" | sed 's/^null_encoder: //') $(echo "$tim" | sed 's/^bench_time: //')"
+    awk -v n="$name" -v b="$bytes" -v f="$frames" -v s="$seconds" -v c="$cpu" -v u="$user" -v y="$sys" -v r="$real" \
+        'BEGIN { if( s <= 0 ) s = 1e-9; printf "%-16s %8d %10.1f %10.1f %10.2f %8.2f\n", n, f, f / s, b / s / 1e6, u + y - c, r }'
+done
+exit $status
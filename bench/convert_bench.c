@@ -0,0 +1,137 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+/* throughput of the colourspace conversions of convert.c for every instruction set the CPU has,
+   on one thread and on the worker pool, and a check that all of them give the same output as C.
+   "serial" is the C kernel on one thread, which is how the conversion runs when it is left to
+   AviSynth on the frameserver thread; bench.sh with --convert avisynth measures that path end to end.
+
+   usage: convert_bench [width height [seconds per measurement]] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../osdep.h"
+#include "../convert.h"
+
+typedef struct
+{
+    const char *name;
+    int src_width;      /* bytes per source row */
+    int src_height;
+    size_t dst_size;
+    void (*run)( convert_pool_t *pool, char *dst, const uint8_t *src, int pitch, int width, int height );
+} format_t;
+
+static void run_rgb24( convert_pool_t *pool, char *dst, const uint8_t *src, int pitch, int width, int height )
+{
+    convert_rgb_420( pool, dst, src, pitch, 3, width, height, 0 );
+}
+
+static void run_rgb32( convert_pool_t *pool, char *dst, const uint8_t *src, int pitch, int width, int height )
+{
+    convert_rgb_420( pool, dst, src, pitch, 4, width, height, 0 );
+}
+
+/* the luma plane is a plain copy, only the chroma planes are converted */
+static void run_yv411( convert_pool_t *pool, char *dst, const uint8_t *src, int pitch, int width, int height )
+{
+    convert_chroma_420( pool, dst, src, pitch, width / 2, height / 2, 0, 0 );
+    convert_chroma_420( pool, dst + (size_t)width * height / 4, src, pitch, width / 2, height / 2, 0, 0 );
+}
+
+static void run_yuv9( convert_pool_t *pool, char *dst, const uint8_t *src, int pitch, int width, int height )
+{
+    convert_chroma_420( pool, dst, src, pitch, width / 2, height / 2, 1, 0 );
+    convert_chroma_420( pool, dst + (size_t)width * height / 4, src, pitch, width / 2, height / 2, 1, 0 );
+}
+
+static void run_yuy2( convert_pool_t *pool, char *dst, const uint8_t *src, int pitch, int width, int height )
+{
+    convert_yuy2_422( pool, dst, src, pitch, width, height );
+}
+
+static void run_stack16( convert_pool_t *pool, char *dst, const uint8_t *src, int pitch, int width, int height )
+{
+    convert_stack16( pool, dst, src, pitch, width, height );
+}
+
+/* frames converted per second with the current kernels */
+static double measure( const format_t *f, convert_pool_t *pool, char *dst, const uint8_t *src,
+                       int width, int height, double seconds )
+{
+    int64_t start = os_time_us(), now;
+    int n = 0;
+    do
+    {
+        f->run( pool, dst, src, f->src_width, width, height );
+        n++;
+        now = os_time_us();
+    } while( now - start < seconds * 1e6 );
+    return n * 1e6 / (now - start);
+}
+
+int main( int argc, char *argv[] )
+{
+    static const char *isas[] = { "C", "SSE2", "AVX2", "AVX-512", NULL };
+    int width = argc > 2 ? atoi( argv[1] ) : 1920;
+    int height = argc > 2 ? atoi( argv[2] ) : 1080;
+    double seconds = argc > 3 ? atof( argv[3] ) : 0.5;
+    if( width <= 0 || height <= 0 || width % 4 || height % 4 )
+    {
+        fprintf( stderr, "width and height must be positive multiples of 4\n" );
+        return 1;
+    }
+    format_t formats[] =
+    {
+        { "rgb24->i420",   width * 3, height,     (size_t)width * height * 3 / 2, run_rgb24 },
+        { "rgb32->i420",   width * 4, height,     (size_t)width * height * 3 / 2, run_rgb32 },
+        { "yv411->i420",   width / 4, height,     (size_t)width * height / 2,     run_yv411 },
+        { "yuv9->i420",    width / 4, height / 4, (size_t)width * height / 2,     run_yuv9 },
+        { "yuy2->i422",    width * 2, height,     (size_t)width * height * 2,     run_yuy2 },
+        { "stack16->p16",  width,     height * 2, (size_t)width * height * 2,     run_stack16 },
+    };
+    int i_threads = os_cpu_count() - 1;
+    convert_pool_t *pool = convert_pool_create( i_threads );
+
+    printf( "%dx%d, pool of %d threads\n", width, height, pool ? i_threads + 1 : 1 );
+    printf( "%-14s %-8s %10s %10s %10s\n", "conversion", "isa", "fps", "fps pool", "vs serial" );
+    int status = 0;
+    for( size_t k = 0; k < sizeof(formats) / sizeof(formats[0]); k++ )
+    {
+        const format_t *f = &formats[k];
+        uint8_t *src = malloc( (size_t)f->src_width * f->src_height );
+        char *ref = malloc( f->dst_size ), *dst = malloc( f->dst_size );
+        if( !src || !ref || !dst )
+            return 1;
+        srand( 1 );
+        for( size_t i = 0; i < (size_t)f->src_width * f->src_height; i++ )
+            src[i] = (uint8_t)rand();
+        double serial = 0;
+        for( int i = 0; isas[i]; i++ )
+        {
+            if( !convert_init( isas[i] ) )
+                continue;
+            memset( dst, 0, f->dst_size );
+            f->run( NULL, dst, src, f->src_width, width, height );
+            if( i == 0 )
+                memcpy( ref, dst, f->dst_size );
+            int b_match = !memcmp( ref, dst, f->dst_size );
+            status |= !b_match;
+            double fps = measure( f, NULL, dst, src, width, height, seconds );
+            double fps_pool = pool ? measure( f, pool, dst, src, width, height, seconds ) : fps;
+            if( i == 0 )
+                serial = fps;
+            printf( "%-14s %-8s %10.1f %10.1f %9.2fx%s\n", f->name, isas[i], fps, fps_pool,
+                    fps_pool / serial, b_match ? "" : "  MISMATCH" );
+        }
+        free( src );
+        free( ref );
+        free( dst );
+    }
+    convert_pool_close( pool );
+    return status;
+}
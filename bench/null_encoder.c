@@ -0,0 +1,112 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+/* stand-in for x26x: drains raw frames from stdin as fast as possible and reports what it got.
+   it understands the options avs4x26x generates (--frames, --input-res, --input-csp,
+   --input-depth) to check that the stream has exactly the announced number of frames.
+   exit code is 1 when the byte count doesn't match. with -o/--output the byte and frame counts
+   and the checksum are also written to that file, standing in for the encoded stream */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define READ_SIZE (1 << 20)
+
+static double csp_bytes_per_pixel( const char *csp )
+{
+    static const struct { const char *name; double bpp; } table[] =
+    {
+        { "i420", 1.5 }, { "yv12", 1.5 }, { "nv12", 1.5 }, { "i422", 2 }, { "yv16", 2 }, { "yuyv", 2 },
+        { "i444", 3 }, { "yv24", 3 }, { "i400", 1 }, { "bgr", 3 }, { "rgb", 3 }, { "bgra", 4 }, { 0 }
+    };
+    for( int i = 0; table[i].name; i++ )
+        if( !strcmp( table[i].name, csp ) )
+            return table[i].bpp;
+    return 0;
+}
+
+static const char *option_value( int argc, char **argv, const char *name )
+{
+    size_t len = strlen( name );
+    for( int i = 1; i < argc; i++ )
+    {
+        if( !strcmp( argv[i], name ) && i + 1 < argc )
+            return argv[i+1];
+        if( !strncmp( argv[i], name, len ) && argv[i][len] == '=' )
+            return argv[i] + len + 1;
+    }
+    return NULL;
+}
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main( int argc, char **argv )
+{
+    const char *res = option_value( argc, argv, "--input-res" );
+    const char *csp = option_value( argc, argv, "--input-csp" );
+    const char *frames = option_value( argc, argv, "--frames" );
+    const char *depth = option_value( argc, argv, "--input-depth" );
+    const char *output = option_value( argc, argv, "--output" );
+    int width = 0, height = 0;
+    long long frame_size = 0, expected = -1;
+    unsigned int checksum = 2166136261u;
+    long long total = 0;
+    double start = 0;
+    char *buf = malloc( READ_SIZE );
+
+    if( !output )
+        output = option_value( argc, argv, "-o" );
+
+    if( res && csp && sscanf( res, "%dx%d", &width, &height ) == 2 )
+        frame_size = (long long)(width * (double)height * csp_bytes_per_pixel( csp ) + 0.5) * (depth && atoi( depth ) > 8 ? 2 : 1);
+    if( frame_size && frames )
+        expected = frame_size * atoll( frames );
+
+    for( ;; )
+    {
+        ssize_t ret = read( STDIN_FILENO, buf, READ_SIZE );
+        if( ret <= 0 )
+            break;
+        if( !total )
+            start = now();
+        /* sparse checksum, enough to tell two byte streams apart without slowing the reader down */
+        for( ssize_t i = (61 - total % 61) % 61; i < ret; i += 61 )
+            checksum = (checksum ^ (unsigned char)buf[i]) * 16777619u;
+        total += ret;
+    }
+    double elapsed = total ? now() - start : 0;
+
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+
+    fprintf( stderr, "null_encoder: bytes=%lld frames=%lld seconds=%.3f cpu=%.3f checksum=%08x\n",
+             total, frame_size ? total / frame_size : 0, elapsed, cpu, checksum );
+    free( buf );
+    if( output )
+    {
+        FILE *fh = fopen( output, "w" );
+        if( fh )
+        {
+            fprintf( fh, "bytes=%lld frames=%lld checksum=%08x\n", total, frame_size ? total / frame_size : 0, checksum );
+            fclose( fh );
+        }
+    }
+    if( expected >= 0 && total != expected )
+    {
+        fprintf( stderr, "null_encoder: expected %lld bytes\n", expected );
+        return 1;
+    }
+    return 0;
+}
@@ -2,6 +2,18 @@
 
 VER=`git rev-list HEAD | wc -l`
 echo "#define VERSION_GIT $VER" > version.h
-gcc avs4x26x.c -s -O3 -std=gnu99 -ffast-math -oavs4x26x -Wl,--large-address-aware
-x86_64-w64-mingw32-gcc avs4x26x.c -s --3 -std=gnu99 -ffast-math -oavs4x26x-x64
+SRC="avs4x26x.c osdep.c framecache.c probecache.c convert.c progress.c remote.c"
+case `uname -s` in
+    MINGW*|MSYS*|CYGWIN*)
+        gcc $SRC -s -O3 -std=gnu99 -ffast-math -oavs4x26x -Wl,--large-address-aware
+        x86_64-w64-mingw32-gcc $SRC -s -O3 -std=gnu99 -ffast-math -oavs4x26x-x64
+        ;;
+    *)
+        gcc $SRC -s -O3 -std=gnu99 -ffast-math -oavs4x26x -ldl -lpthread
+        ;;
+esac
 rm -f version.h
+
+if [ "$1" = "bench" ]; then
+    bench/bench.sh
+fi
@@ -0,0 +1,653 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "osdep.h"
+#include "convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#ifdef __GNUC__
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+/* the C kernels are the scalar reference the others are measured against */
+#define SCALAR __attribute__((optimize("no-tree-vectorize")))
+#else
+#define ALWAYS_INLINE static inline
+#define SCALAR
+#endif
+
+/* more threads don't help, the conversions are bound by memory bandwidth */
+#define CONVERT_MAX_THREADS 8
+
+/* Rec.601 limited range, 15 bit fixed point */
+#define COEF(x) ((int)((x) * 32768 + 0.5))
+#define Y_R COEF(0.256788)
+#define Y_G COEF(0.504129)
+#define Y_B COEF(0.097906)
+#define U_R (-COEF(0.148223))
+#define U_G (-COEF(0.290993))
+#define U_B COEF(0.439216)
+#define V_R COEF(0.439216)
+#define V_G (-COEF(0.367788))
+#define V_B (-COEF(0.071427))
+
+/* the row kernels. the simple ones are written so the compiler can vectorize them and are
+   instantiated once per instruction set below, stack16 and RGB have hand written versions
+   as the compiler doesn't manage the interleaved data well on its own */
+
+/* little-endian 16-bit samples from a row of high and a row of low bytes */
+typedef void (*stack16_row_t)( uint8_t *dst, const uint8_t *msb, const uint8_t *lsb, int width );
+/* two rows of RGB32 to two rows of luma and one of each chroma, width is even */
+typedef void (*rgb_rows_t)( uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, const uint8_t *s0, const uint8_t *s1, int width );
+/* a row of RGB24 to RGB32 */
+typedef void (*rgb_expand_row_t)( uint8_t *dst, const uint8_t *src, int width );
+/* one 4:2:0 chroma row of width samples from two rows of half the width, averaged (YV411) */
+typedef void (*chroma_avg_row_t)( uint8_t *dst, const uint8_t *r0, const uint8_t *r1, int width );
+/* one 4:2:0 chroma row of width samples from a row of half the width (YUV9) */
+typedef void (*chroma_dup_row_t)( uint8_t *dst, const uint8_t *src, int width );
+/* a YUY2 row to the rows of the three 4:2:2 planes, width is even */
+typedef void (*yuy2_row_t)( uint8_t *y, uint8_t *u, uint8_t *v, const uint8_t *src, int width );
+
+ALWAYS_INLINE void stack16_row_body( uint8_t *dst, const uint8_t *msb, const uint8_t *lsb, int width )
+{
+    for( int x = 0; x < width; x++ )
+    {
+        dst[2*x]   = lsb[x];
+        dst[2*x+1] = msb[x];
+    }
+}
+
+/* chroma is sited like MPEG-2: a [1 2 1] filter centered on the even pixels, the left neighbour
+   of the first pixel being the pixel itself, summed over both rows */
+ALWAYS_INLINE void rgb_chroma( uint8_t *u, uint8_t *v, const uint8_t *s0, const uint8_t *s1, int x, int l, int bpp )
+{
+    int c = 2*x, r = 2*x + 1;
+    int b = s0[l*bpp]   + 2 * s0[c*bpp]   + s0[r*bpp]   + s1[l*bpp]   + 2 * s1[c*bpp]   + s1[r*bpp];
+    int g = s0[l*bpp+1] + 2 * s0[c*bpp+1] + s0[r*bpp+1] + s1[l*bpp+1] + 2 * s1[c*bpp+1] + s1[r*bpp+1];
+    int rd = s0[l*bpp+2] + 2 * s0[c*bpp+2] + s0[r*bpp+2] + s1[l*bpp+2] + 2 * s1[c*bpp+2] + s1[r*bpp+2];
+    u[x] = (uint8_t)((U_R * rd + U_G * g + U_B * b + (128 << 18) + (1 << 17)) >> 18);
+    v[x] = (uint8_t)((V_R * rd + V_G * g + V_B * b + (128 << 18) + (1 << 17)) >> 18);
+}
+
+/* pixels [x0, width) of a row pair, x0 is even */
+ALWAYS_INLINE void rgb_rows_body( uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                                  const uint8_t *s0, const uint8_t *s1, int x0, int width, int bpp )
+{
+    for( int x = x0; x < width; x++ )
+    {
+        const uint8_t *p = s0 + x * bpp, *q = s1 + x * bpp;
+        y0[x] = (uint8_t)((Y_R * p[2] + Y_G * p[1] + Y_B * p[0] + (16 << 15) + (1 << 14)) >> 15);
+        y1[x] = (uint8_t)((Y_R * q[2] + Y_G * q[1] + Y_B * q[0] + (16 << 15) + (1 << 14)) >> 15);
+    }
+    int x = x0 / 2;
+    if( !x && width )
+        rgb_chroma( u, v, s0, s1, x++, 0, bpp );
+    for( ; x < width / 2; x++ )
+        rgb_chroma( u, v, s0, s1, x, 2*x - 1, bpp );
+}
+
+ALWAYS_INLINE void rgb_expand_row_body( uint8_t *dst, const uint8_t *src, int width )
+{
+    for( int x = 0; x < width; x++ )
+    {
+        dst[4*x]   = src[3*x];
+        dst[4*x+1] = src[3*x+1];
+        dst[4*x+2] = src[3*x+2];
+        dst[4*x+3] = 0;
+    }
+}
+
+ALWAYS_INLINE void chroma_avg_row_body( uint8_t *dst, const uint8_t *r0, const uint8_t *r1, int width )
+{
+    for( int x = 0; x < width / 2; x++ )
+    {
+        uint8_t a = (uint8_t)((r0[x] + r1[x] + 1) >> 1);
+        dst[2*x]   = a;
+        dst[2*x+1] = a;
+    }
+}
+
+ALWAYS_INLINE void chroma_dup_row_body( uint8_t *dst, const uint8_t *src, int width )
+{
+    for( int x = 0; x < width / 2; x++ )
+    {
+        dst[2*x]   = src[x];
+        dst[2*x+1] = src[x];
+    }
+}
+
+ALWAYS_INLINE void yuy2_row_body( uint8_t *y, uint8_t *u, uint8_t *v, const uint8_t *src, int width )
+{
+    for( int x = 0; x < width / 2; x++ )
+    {
+        y[2*x]   = src[4*x];
+        u[x]     = src[4*x+1];
+        y[2*x+1] = src[4*x+2];
+        v[x]     = src[4*x+3];
+    }
+}
+
+#define DEFINE_KERNELS( isa, attr ) \
+attr static void rgb_expand_row_##isa( uint8_t *dst, const uint8_t *src, int width ) \
+    { rgb_expand_row_body( dst, src, width ); } \
+attr static void chroma_avg_row_##isa( uint8_t *dst, const uint8_t *r0, const uint8_t *r1, int width ) \
+    { chroma_avg_row_body( dst, r0, r1, width ); } \
+attr static void chroma_dup_row_##isa( uint8_t *dst, const uint8_t *src, int width ) \
+    { chroma_dup_row_body( dst, src, width ); } \
+attr static void yuy2_row_##isa( uint8_t *y, uint8_t *u, uint8_t *v, const uint8_t *src, int width ) \
+    { yuy2_row_body( y, u, v, src, width ); }
+
+DEFINE_KERNELS( c, SCALAR )
+
+SCALAR static void stack16_row_c( uint8_t *dst, const uint8_t *msb, const uint8_t *lsb, int width )
+{
+    stack16_row_body( dst, msb, lsb, width );
+}
+
+SCALAR static void rgb32_rows_c( uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, const uint8_t *s0, const uint8_t *s1, int width )
+{
+    rgb_rows_body( y0, y1, u, v, s0, s1, 0, width, 4 );
+}
+
+/* used when there is no memory to expand RGB24 rows into */
+SCALAR static void rgb24_rows_c( uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, const uint8_t *s0, const uint8_t *s1, int width )
+{
+    rgb_rows_body( y0, y1, u, v, s0, s1, 0, width, 3 );
+}
+
+#ifdef HAVE_X86_SIMD
+DEFINE_KERNELS( sse2, __attribute__((target("sse2"))) )
+DEFINE_KERNELS( avx2, __attribute__((target("avx2"))) )
+DEFINE_KERNELS( avx512, __attribute__((target("avx512f,avx512bw"))) )
+
+__attribute__((target("sse2")))
+static void stack16_row_sse2( uint8_t *dst, const uint8_t *msb, const uint8_t *lsb, int width )
+{
+    int x = 0;
+    for( ; x + 16 <= width; x += 16 )
+    {
+        __m128i hi = _mm_loadu_si128( (const __m128i*)(msb + x) );
+        __m128i lo = _mm_loadu_si128( (const __m128i*)(lsb + x) );
+        _mm_storeu_si128( (__m128i*)(dst + 2*x),      _mm_unpacklo_epi8( lo, hi ) );
+        _mm_storeu_si128( (__m128i*)(dst + 2*x + 16), _mm_unpackhi_epi8( lo, hi ) );
+    }
+    stack16_row_body( dst + 2*x, msb + x, lsb + x, width - x );
+}
+
+__attribute__((target("avx2")))
+static void stack16_row_avx2( uint8_t *dst, const uint8_t *msb, const uint8_t *lsb, int width )
+{
+    int x = 0;
+    for( ; x + 32 <= width; x += 32 )
+    {
+        /* the unpacks work within 128-bit lanes, so put the quadwords in 0 2 1 3 order first */
+        __m256i hi = _mm256_permute4x64_epi64( _mm256_loadu_si256( (const __m256i*)(msb + x) ), 0xD8 );
+        __m256i lo = _mm256_permute4x64_epi64( _mm256_loadu_si256( (const __m256i*)(lsb + x) ), 0xD8 );
+        _mm256_storeu_si256( (__m256i*)(dst + 2*x),      _mm256_unpacklo_epi8( lo, hi ) );
+        _mm256_storeu_si256( (__m256i*)(dst + 2*x + 32), _mm256_unpackhi_epi8( lo, hi ) );
+    }
+    stack16_row_sse2( dst + 2*x, msb + x, lsb + x, width - x );
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void stack16_row_avx512( uint8_t *dst, const uint8_t *msb, const uint8_t *lsb, int width )
+{
+    /* same as AVX2 with four lanes: quadwords in 0 4 1 5 2 6 3 7 order */
+    const __m512i order = _mm512_set_epi64( 7, 3, 6, 2, 5, 1, 4, 0 );
+    int x = 0;
+    for( ; x + 64 <= width; x += 64 )
+    {
+        __m512i hi = _mm512_permutexvar_epi64( order, _mm512_loadu_si512( msb + x ) );
+        __m512i lo = _mm512_permutexvar_epi64( order, _mm512_loadu_si512( lsb + x ) );
+        _mm512_storeu_si512( dst + 2*x,      _mm512_unpacklo_epi8( lo, hi ) );
+        _mm512_storeu_si512( dst + 2*x + 64, _mm512_unpackhi_epi8( lo, hi ) );
+    }
+    stack16_row_avx2( dst + 2*x, msb + x, lsb + x, width - x );
+}
+
+/* the RGB32 kernels split each pixel into the 16-bit pairs (B,R) and (G,A), so one pmaddwd with
+   (coef_B,coef_R) and one with (coef_G,0) give a channel per 32-bit lane. the vertical sums for
+   chroma stay in that form, the [1 2 1] filter adds them shifted by a pixel either way.
+   the previous vector supplies the left neighbour of the first pixel */
+#define RGB_CONSTANTS( type, set1 ) \
+    const type mask  = set1( 0x00FF00FF ); \
+    const type cy_br = set1( Y_R * 65536 | Y_B ), cy_g = set1( Y_G ); \
+    const type cu_br = set1( U_R * 65536 | (U_B & 0xFFFF) ), cu_g = set1( U_G & 0xFFFF ); \
+    const type cv_br = set1( V_R * 65536 | (V_B & 0xFFFF) ), cv_g = set1( V_G & 0xFFFF ); \
+    const type y_off = set1( (16 << 15) + (1 << 14) ), c_off = set1( (128 << 18) + (1 << 17) ); \
+    type prev_br = set1( (s0[2] + s1[2]) << 16 | (s0[0] + s1[0]) ), prev_ga = set1( s0[1] + s1[1] );
+
+__attribute__((target("sse2")))
+static void rgb32_rows_sse2( uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, const uint8_t *s0, const uint8_t *s1, int width )
+{
+    if( width <= 0 )
+        return;
+    RGB_CONSTANTS( __m128i, _mm_set1_epi32 )
+    int x = 0;
+    for( ; x + 16 <= width; x += 16 )
+    {
+        __m128i l0[4], l1[4], cu[4], cv[4];
+        for( int k = 0; k < 4; k++ )
+        {
+            __m128i p = _mm_loadu_si128( (const __m128i*)(s0 + 4 * (x + 4*k)) );
+            __m128i q = _mm_loadu_si128( (const __m128i*)(s1 + 4 * (x + 4*k)) );
+            __m128i br0 = _mm_and_si128( p, mask ), ga0 = _mm_and_si128( _mm_srli_epi32( p, 8 ), mask );
+            __m128i br1 = _mm_and_si128( q, mask ), ga1 = _mm_and_si128( _mm_srli_epi32( q, 8 ), mask );
+            l0[k] = _mm_srai_epi32( _mm_add_epi32( _mm_add_epi32( _mm_madd_epi16( br0, cy_br ), _mm_madd_epi16( ga0, cy_g ) ), y_off ), 15 );
+            l1[k] = _mm_srai_epi32( _mm_add_epi32( _mm_add_epi32( _mm_madd_epi16( br1, cy_br ), _mm_madd_epi16( ga1, cy_g ) ), y_off ), 15 );
+            __m128i sbr = _mm_add_epi16( br0, br1 ), sga = _mm_add_epi16( ga0, ga1 );
+            __m128i hbr = _mm_add_epi16( _mm_add_epi16( _mm_or_si128( _mm_slli_si128( sbr, 4 ), _mm_srli_si128( prev_br, 12 ) ),
+                                                        _mm_srli_si128( sbr, 4 ) ), _mm_add_epi16( sbr, sbr ) );
+            __m128i hga = _mm_add_epi16( _mm_add_epi16( _mm_or_si128( _mm_slli_si128( sga, 4 ), _mm_srli_si128( prev_ga, 12 ) ),
+                                                        _mm_srli_si128( sga, 4 ) ), _mm_add_epi16( sga, sga ) );
+            prev_br = sbr;
+            prev_ga = sga;
+            /* the even lanes hold the chroma samples, move them to the low half */
+            cu[k] = _mm_shuffle_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_add_epi32( _mm_madd_epi16( hbr, cu_br ),
+                                       _mm_madd_epi16( hga, cu_g ) ), c_off ), 18 ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+            cv[k] = _mm_shuffle_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_add_epi32( _mm_madd_epi16( hbr, cv_br ),
+                                       _mm_madd_epi16( hga, cv_g ) ), c_off ), 18 ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+        }
+        _mm_storeu_si128( (__m128i*)(y0 + x), _mm_packus_epi16( _mm_packs_epi32( l0[0], l0[1] ), _mm_packs_epi32( l0[2], l0[3] ) ) );
+        _mm_storeu_si128( (__m128i*)(y1 + x), _mm_packus_epi16( _mm_packs_epi32( l1[0], l1[1] ), _mm_packs_epi32( l1[2], l1[3] ) ) );
+        __m128i pu = _mm_packs_epi32( _mm_unpacklo_epi64( cu[0], cu[1] ), _mm_unpacklo_epi64( cu[2], cu[3] ) );
+        __m128i pv = _mm_packs_epi32( _mm_unpacklo_epi64( cv[0], cv[1] ), _mm_unpacklo_epi64( cv[2], cv[3] ) );
+        _mm_storel_epi64( (__m128i*)(u + x/2), _mm_packus_epi16( pu, pu ) );
+        _mm_storel_epi64( (__m128i*)(v + x/2), _mm_packus_epi16( pv, pv ) );
+    }
+    rgb_rows_body( y0, y1, u, v, s0, s1, x, width, 4 );
+}
+
+__attribute__((target("avx2")))
+static void rgb32_rows_avx2( uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, const uint8_t *s0, const uint8_t *s1, int width )
+{
+    if( width <= 0 )
+        return;
+    RGB_CONSTANTS( __m256i, _mm256_set1_epi32 )
+    /* packs work within 128-bit lanes, these put the results back in order */
+    const __m256i luma_order = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+    const __m256i even_lanes = _mm256_setr_epi32( 0, 2, 4, 6, 1, 3, 5, 7 );
+    int x = 0;
+    for( ; x + 32 <= width; x += 32 )
+    {
+        __m256i l0[4], l1[4];
+        __m128i cu[4], cv[4];
+        for( int k = 0; k < 4; k++ )
+        {
+            __m256i p = _mm256_loadu_si256( (const __m256i*)(s0 + 4 * (x + 8*k)) );
+            __m256i q = _mm256_loadu_si256( (const __m256i*)(s1 + 4 * (x + 8*k)) );
+            __m256i br0 = _mm256_and_si256( p, mask ), ga0 = _mm256_and_si256( _mm256_srli_epi32( p, 8 ), mask );
+            __m256i br1 = _mm256_and_si256( q, mask ), ga1 = _mm256_and_si256( _mm256_srli_epi32( q, 8 ), mask );
+            l0[k] = _mm256_srai_epi32( _mm256_add_epi32( _mm256_add_epi32( _mm256_madd_epi16( br0, cy_br ), _mm256_madd_epi16( ga0, cy_g ) ), y_off ), 15 );
+            l1[k] = _mm256_srai_epi32( _mm256_add_epi32( _mm256_add_epi32( _mm256_madd_epi16( br1, cy_br ), _mm256_madd_epi16( ga1, cy_g ) ), y_off ), 15 );
+            __m256i sbr = _mm256_add_epi16( br0, br1 ), sga = _mm256_add_epi16( ga0, ga1 );
+            /* the left neighbours cross the 128-bit lanes, the right ones of even pixels don't */
+            __m256i left_br = _mm256_alignr_epi8( sbr, _mm256_permute2x128_si256( prev_br, sbr, 0x21 ), 12 );
+            __m256i left_ga = _mm256_alignr_epi8( sga, _mm256_permute2x128_si256( prev_ga, sga, 0x21 ), 12 );
+            __m256i hbr = _mm256_add_epi16( _mm256_add_epi16( left_br, _mm256_srli_si256( sbr, 4 ) ), _mm256_add_epi16( sbr, sbr ) );
+            __m256i hga = _mm256_add_epi16( _mm256_add_epi16( left_ga, _mm256_srli_si256( sga, 4 ) ), _mm256_add_epi16( sga, sga ) );
+            prev_br = sbr;
+            prev_ga = sga;
+            cu[k] = _mm256_castsi256_si128( _mm256_permutevar8x32_epi32( _mm256_srai_epi32( _mm256_add_epi32( _mm256_add_epi32(
+                        _mm256_madd_epi16( hbr, cu_br ), _mm256_madd_epi16( hga, cu_g ) ), c_off ), 18 ), even_lanes ) );
+            cv[k] = _mm256_castsi256_si128( _mm256_permutevar8x32_epi32( _mm256_srai_epi32( _mm256_add_epi32( _mm256_add_epi32(
+                        _mm256_madd_epi16( hbr, cv_br ), _mm256_madd_epi16( hga, cv_g ) ), c_off ), 18 ), even_lanes ) );
+        }
+        _mm256_storeu_si256( (__m256i*)(y0 + x), _mm256_permutevar8x32_epi32( _mm256_packus_epi16(
+            _mm256_packs_epi32( l0[0], l0[1] ), _mm256_packs_epi32( l0[2], l0[3] ) ), luma_order ) );
+        _mm256_storeu_si256( (__m256i*)(y1 + x), _mm256_permutevar8x32_epi32( _mm256_packus_epi16(
+            _mm256_packs_epi32( l1[0], l1[1] ), _mm256_packs_epi32( l1[2], l1[3] ) ), luma_order ) );
+        _mm_storeu_si128( (__m128i*)(u + x/2), _mm_packus_epi16( _mm_packs_epi32( cu[0], cu[1] ), _mm_packs_epi32( cu[2], cu[3] ) ) );
+        _mm_storeu_si128( (__m128i*)(v + x/2), _mm_packus_epi16( _mm_packs_epi32( cv[0], cv[1] ), _mm_packs_epi32( cv[2], cv[3] ) ) );
+    }
+    rgb_rows_body( y0, y1, u, v, s0, s1, x, width, 4 );
+}
+
+/* the results are within 0..255 by construction, so they are narrowed with plain truncation */
+__attribute__((target("avx512f,avx512bw")))
+static void rgb32_rows_avx512( uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, const uint8_t *s0, const uint8_t *s1, int width )
+{
+    if( width <= 0 )
+        return;
+    RGB_CONSTANTS( __m512i, _mm512_set1_epi32 )
+    int x = 0;
+    for( ; x + 32 <= width; x += 32 )
+    {
+        __m256i cu[2], cv[2];
+        for( int k = 0; k < 2; k++ )
+        {
+            __m512i p = _mm512_loadu_si512( s0 + 4 * (x + 16*k) );
+            __m512i q = _mm512_loadu_si512( s1 + 4 * (x + 16*k) );
+            __m512i br0 = _mm512_and_si512( p, mask ), ga0 = _mm512_and_si512( _mm512_srli_epi32( p, 8 ), mask );
+            __m512i br1 = _mm512_and_si512( q, mask ), ga1 = _mm512_and_si512( _mm512_srli_epi32( q, 8 ), mask );
+            __m512i l0 = _mm512_srai_epi32( _mm512_add_epi32( _mm512_add_epi32( _mm512_madd_epi16( br0, cy_br ), _mm512_madd_epi16( ga0, cy_g ) ), y_off ), 15 );
+            __m512i l1 = _mm512_srai_epi32( _mm512_add_epi32( _mm512_add_epi32( _mm512_madd_epi16( br1, cy_br ), _mm512_madd_epi16( ga1, cy_g ) ), y_off ), 15 );
+            _mm_storeu_si128( (__m128i*)(y0 + x + 16*k), _mm512_cvtepi32_epi8( l0 ) );
+            _mm_storeu_si128( (__m128i*)(y1 + x + 16*k), _mm512_cvtepi32_epi8( l1 ) );
+            __m512i sbr = _mm512_add_epi16( br0, br1 ), sga = _mm512_add_epi16( ga0, ga1 );
+            __m512i hbr = _mm512_add_epi16( _mm512_add_epi16( _mm512_alignr_epi32( sbr, prev_br, 15 ), _mm512_alignr_epi32( sbr, sbr, 1 ) ),
+                                            _mm512_add_epi16( sbr, sbr ) );
+            __m512i hga = _mm512_add_epi16( _mm512_add_epi16( _mm512_alignr_epi32( sga, prev_ga, 15 ), _mm512_alignr_epi32( sga, sga, 1 ) ),
+                                            _mm512_add_epi16( sga, sga ) );
+            prev_br = sbr;
+            prev_ga = sga;
+            /* the even lanes hold the chroma samples, the low half of each quadword */
+            cu[k] = _mm512_cvtepi64_epi32( _mm512_srai_epi32( _mm512_add_epi32( _mm512_add_epi32(
+                        _mm512_madd_epi16( hbr, cu_br ), _mm512_madd_epi16( hga, cu_g ) ), c_off ), 18 ) );
+            cv[k] = _mm512_cvtepi64_epi32( _mm512_srai_epi32( _mm512_add_epi32( _mm512_add_epi32(
+                        _mm512_madd_epi16( hbr, cv_br ), _mm512_madd_epi16( hga, cv_g ) ), c_off ), 18 ) );
+        }
+        _mm_storeu_si128( (__m128i*)(u + x/2), _mm512_cvtepi32_epi8( _mm512_inserti64x4( _mm512_castsi256_si512( cu[0] ), cu[1], 1 ) ) );
+        _mm_storeu_si128( (__m128i*)(v + x/2), _mm512_cvtepi32_epi8( _mm512_inserti64x4( _mm512_castsi256_si512( cv[0] ), cv[1], 1 ) ) );
+    }
+    rgb_rows_body( y0, y1, u, v, s0, s1, x, width, 4 );
+}
+#endif
+
+typedef struct
+{
+    const char *name;
+    stack16_row_t stack16;
+    rgb_rows_t rgb32;
+    rgb_expand_row_t rgb_expand;
+    chroma_avg_row_t chroma_avg;
+    chroma_dup_row_t chroma_dup;
+    yuy2_row_t yuy2;
+} convert_kernels_t;
+
+#define KERNELS( isa, name ) { name, stack16_row_##isa, rgb32_rows_##isa, rgb_expand_row_##isa, \
+                               chroma_avg_row_##isa, chroma_dup_row_##isa, yuy2_row_##isa }
+
+/* best first */
+static const convert_kernels_t kernel_sets[] =
+{
+#ifdef HAVE_X86_SIMD
+    KERNELS( avx512, "AVX-512" ),
+    KERNELS( avx2, "AVX2" ),
+    KERNELS( sse2, "SSE2" ),
+#endif
+    KERNELS( c, "C" ),
+};
+
+static const convert_kernels_t *kernels = &kernel_sets[sizeof(kernel_sets) / sizeof(kernel_sets[0]) - 1];
+
+static int isa_supported( const char *name )
+{
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if( !strcmp( name, "AVX-512" ) )
+        return __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx512bw" );
+    if( !strcmp( name, "AVX2" ) )
+        return __builtin_cpu_supports( "avx2" );
+    if( !strcmp( name, "SSE2" ) )
+        return __builtin_cpu_supports( "sse2" );
+#endif
+    return 1;
+}
+
+const char *convert_init( const char *isa )
+{
+    for( size_t i = 0; i < sizeof(kernel_sets) / sizeof(kernel_sets[0]); i++ )
+        if( (!isa || !strcasecmp( isa, kernel_sets[i].name )) && isa_supported( kernel_sets[i].name ) )
+        {
+            kernels = &kernel_sets[i];
+            return kernels->name;
+        }
+    return NULL;
+}
+
+/* the two source rows of output row y when halving the height, rows of the same field if interlaced */
+static void halve_rows( int y, int height, int b_interlaced, int *r0, int *r1 )
+{
+    if( b_interlaced )
+    {
+        *r0 = ((y >> 1) << 2) + (y & 1);
+        *r1 = *r0 + 2;
+    }
+    else
+    {
+        *r0 = 2 * y;
+        *r1 = 2 * y + 1;
+    }
+    if( *r1 >= height )
+        *r1 = *r0 < height ? *r0 : height - 1;
+    if( *r0 >= height )
+        *r0 = height - 1;
+}
+
+typedef struct
+{
+    uint8_t *dst;
+    const uint8_t *src;
+    int src_pitch;
+    int width;
+    int height;
+    int b_interlaced;
+    int i_bpp;
+} convert_job_t;
+
+static void stack16_band( void *arg, int y0, int y1 )
+{
+    convert_job_t *job = arg;
+    for( int y = y0; y < y1; y++ )
+        kernels->stack16( job->dst + (size_t)y * job->width * 2, job->src + (size_t)y * job->src_pitch,
+                          job->src + (size_t)(y + job->height) * job->src_pitch, job->width );
+}
+
+void convert_stack16( convert_pool_t *pool, char *dst, const uint8_t *src, int src_pitch, int width, int height )
+{
+    convert_job_t job = { .dst = (uint8_t*)dst, .src = src, .src_pitch = src_pitch, .width = width, .height = height };
+    convert_pool_run( pool, stack16_band, &job, height );
+}
+
+/* bands are rows of chroma, each covering two rows of luma. RGB24 rows are expanded to RGB32 first */
+static void rgb_band( void *arg, int y0, int y1 )
+{
+    convert_job_t *job = arg;
+    size_t luma_size = (size_t)job->width * job->height, chroma_size = luma_size / 4;
+    uint8_t *expanded = job->i_bpp == 3 ? malloc( (size_t)job->width * 8 ) : NULL;
+    for( int y = y0; y < y1; y++ )
+    {
+        int r0, r1;
+        halve_rows( y, job->height, job->b_interlaced, &r0, &r1 );
+        /* AviSynth RGB is stored bottom-up */
+        const uint8_t *s0 = job->src + (size_t)(job->height - 1 - r0) * job->src_pitch;
+        const uint8_t *s1 = job->src + (size_t)(job->height - 1 - r1) * job->src_pitch;
+        uint8_t *dst_y0 = job->dst + (size_t)r0 * job->width, *dst_y1 = job->dst + (size_t)r1 * job->width;
+        uint8_t *dst_u = job->dst + luma_size + (size_t)y * (job->width / 2), *dst_v = dst_u + chroma_size;
+        if( job->i_bpp == 4 )
+            kernels->rgb32( dst_y0, dst_y1, dst_u, dst_v, s0, s1, job->width );
+        else if( expanded )
+        {
+            kernels->rgb_expand( expanded, s0, job->width );
+            kernels->rgb_expand( expanded + (size_t)job->width * 4, s1, job->width );
+            kernels->rgb32( dst_y0, dst_y1, dst_u, dst_v, expanded, expanded + (size_t)job->width * 4, job->width );
+        }
+        else
+            rgb24_rows_c( dst_y0, dst_y1, dst_u, dst_v, s0, s1, job->width );
+    }
+    free( expanded );
+}
+
+void convert_rgb_420( convert_pool_t *pool, char *dst, const uint8_t *src, int src_pitch, int i_bpp,
+                      int width, int height, int b_interlaced )
+{
+    convert_job_t job = { .dst = (uint8_t*)dst, .src = src, .src_pitch = src_pitch, .width = width, .height = height,
+                          .b_interlaced = b_interlaced, .i_bpp = i_bpp };
+    convert_pool_run( pool, rgb_band, &job, height / 2 );
+}
+
+static void chroma_avg_band( void *arg, int y0, int y1 )
+{
+    convert_job_t *job = arg;
+    for( int y = y0; y < y1; y++ )
+    {
+        int r0, r1;
+        halve_rows( y, job->height * 2, job->b_interlaced, &r0, &r1 );
+        kernels->chroma_avg( job->dst + (size_t)y * job->width, job->src + (size_t)r0 * job->src_pitch,
+                             job->src + (size_t)r1 * job->src_pitch, job->width );
+    }
+}
+
+static void chroma_dup_band( void *arg, int y0, int y1 )
+{
+    convert_job_t *job = arg;
+    int src_height = job->height / 2;
+    for( int y = y0; y < y1; y++ )
+    {
+        /* every source row is used for two output rows, of its own field if interlaced */
+        int r = job->b_interlaced ? (((y >> 1) >> 1) << 1) + (y & 1) : y >> 1;
+        if( r >= src_height )
+            r = src_height - 1;
+        kernels->chroma_dup( job->dst + (size_t)y * job->width, job->src + (size_t)r * job->src_pitch, job->width );
+    }
+}
+
+void convert_chroma_420( convert_pool_t *pool, char *dst, const uint8_t *src, int src_pitch,
+                         int width, int height, int b_yuv9, int b_interlaced )
+{
+    convert_job_t job = { .dst = (uint8_t*)dst, .src = src, .src_pitch = src_pitch, .width = width, .height = height,
+                          .b_interlaced = b_interlaced };
+    convert_pool_run( pool, b_yuv9 ? chroma_dup_band : chroma_avg_band, &job, height );
+}
+
+static void yuy2_band( void *arg, int y0, int y1 )
+{
+    convert_job_t *job = arg;
+    size_t luma_size = (size_t)job->width * job->height, chroma_size = luma_size / 2;
+    for( int y = y0; y < y1; y++ )
+        kernels->yuy2( job->dst + (size_t)y * job->width, job->dst + luma_size + (size_t)y * (job->width / 2),
+                       job->dst + luma_size + chroma_size + (size_t)y * (job->width / 2),
+                       job->src + (size_t)y * job->src_pitch, job->width );
+}
+
+void convert_yuy2_422( convert_pool_t *pool, char *dst, const uint8_t *src, int src_pitch, int width, int height )
+{
+    convert_job_t job = { .dst = (uint8_t*)dst, .src = src, .src_pitch = src_pitch, .width = width, .height = height };
+    convert_pool_run( pool, yuy2_band, &job, height );
+}
+
+/* every run is split into one band per thread, the caller included. a worker takes the
+   next unclaimed band until there are none left, so a slow thread doesn't hold the others up */
+struct convert_pool_t
+{
+    os_mutex_t mutex;
+    os_cond_t cv;
+    os_thread_t threads[CONVERT_MAX_THREADS];
+    int i_threads;
+    int b_exit;
+    int i_run;              /* incremented for each run, wakes the workers */
+    int b_running;          /* a caller's run is in progress, the next caller waits for it */
+    convert_band_t func;
+    void *arg;
+    int i_height;
+    int i_bands;
+    int i_next_band;
+    int i_bands_done;
+};
+
+/* work on the bands of the current run, called and returns with the mutex held */
+static void pool_work( convert_pool_t *pool )
+{
+    while( pool->i_next_band < pool->i_bands )
+    {
+        int band = pool->i_next_band++;
+        int y0 = (int)((int64_t)pool->i_height * band / pool->i_bands);
+        int y1 = (int)((int64_t)pool->i_height * (band + 1) / pool->i_bands);
+        os_mutex_unlock( &pool->mutex );
+        pool->func( pool->arg, y0, y1 );
+        os_mutex_lock( &pool->mutex );
+        if( ++pool->i_bands_done == pool->i_bands )
+            os_cond_broadcast( &pool->cv );
+    }
+}
+
+static os_thread_ret OS_THREAD_CC pool_worker( void *arg )
+{
+    convert_pool_t *pool = arg;
+    int i_run = 0;
+    os_mutex_lock( &pool->mutex );
+    for( ;; )
+    {
+        while( !pool->b_exit && pool->i_run == i_run )
+            os_cond_wait( &pool->cv, &pool->mutex );
+        if( pool->b_exit )
+            break;
+        i_run = pool->i_run;
+        pool_work( pool );
+    }
+    os_mutex_unlock( &pool->mutex );
+    return 0;
+}
+
+convert_pool_t *convert_pool_create( int i_threads )
+{
+    if( i_threads > CONVERT_MAX_THREADS )
+        i_threads = CONVERT_MAX_THREADS;
+    if( i_threads < 1 )
+        return NULL;
+    convert_pool_t *pool = calloc( 1, sizeof(convert_pool_t) );
+    if( !pool )
+        return NULL;
+    os_mutex_init( &pool->mutex );
+    os_cond_init( &pool->cv );
+    for( ; pool->i_threads < i_threads; pool->i_threads++ )
+        if( os_thread_create( &pool->threads[pool->i_threads], pool_worker, pool ) )
+            break;
+    if( !pool->i_threads )
+    {
+        convert_pool_close( pool );
+        return NULL;
+    }
+    return pool;
+}
+
+void convert_pool_run( convert_pool_t *pool, convert_band_t func, void *arg, int height )
+{
+    if( !pool )
+    {
+        func( arg, 0, height );
+        return;
+    }
+    os_mutex_lock( &pool->mutex );
+    /* render threads share the pool, each run is done whole before the next one starts */
+    while( pool->b_running )
+        os_cond_wait( &pool->cv, &pool->mutex );
+    pool->b_running = 1;
+    pool->func = func;
+    pool->arg = arg;
+    pool->i_height = height;
+    pool->i_bands = pool->i_threads + 1;
+    pool->i_next_band = 0;
+    pool->i_bands_done = 0;
+    pool->i_run++;
+    os_cond_broadcast( &pool->cv );
+    pool_work( pool );
+    while( pool->i_bands_done < pool->i_bands )
+        os_cond_wait( &pool->cv, &pool->mutex );
+    pool->b_running = 0;
+    os_cond_broadcast( &pool->cv );
+    os_mutex_unlock( &pool->mutex );
+}
+
+void convert_pool_close( convert_pool_t *pool )
+{
+    if( !pool )
+        return;
+    os_mutex_lock( &pool->mutex );
+    pool->b_exit = 1;
+    os_cond_broadcast( &pool->cv );
+    os_mutex_unlock( &pool->mutex );
+    for( int i = 0; i < pool->i_threads; i++ )
+        os_thread_join( pool->threads[i] );
+    os_cond_destroy( &pool->cv );
+    os_mutex_destroy( &pool->mutex );
+    free( pool );
+}
@@ -0,0 +1,45 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+/* pixel format conversions done while packing frames for the pipe, with SIMD kernels
+   picked at runtime and a small pool that splits the rows of a plane over worker threads */
+
+#ifndef AVS4X26X_CONVERT_H
+#define AVS4X26X_CONVERT_H
+
+#include <stdint.h>
+
+typedef struct convert_pool_t convert_pool_t;
+
+/* process rows [y0, y1) of the job described by arg */
+typedef void (*convert_band_t)( void *arg, int y0, int y1 );
+
+/* pick the kernels: isa is "AVX-512", "AVX2", "SSE2" or "C", NULL for the best this CPU has.
+   returns the name of the instruction set used, NULL if isa is unknown or unsupported */
+const char *convert_init( const char *isa );
+
+/* interleave a Dither stack16 plane, the MSB rows [0, height) above the LSB rows
+   [height, 2*height), into little-endian 16-bit samples. width is in samples,
+   dst receives height rows of 2*width bytes */
+void convert_stack16( convert_pool_t *pool, char *dst, const uint8_t *src, int src_pitch, int width, int height );
+
+/* 4:2:0 from a bottom-up RGB24 (i_bpp 3) or RGB32 (i_bpp 4) frame with the Rec.601 limited range
+   matrix, as ConvertToYV12 does by default. width and height are even, dst receives the three planes */
+void convert_rgb_420( convert_pool_t *pool, char *dst, const uint8_t *src, int src_pitch, int i_bpp,
+                      int width, int height, int b_interlaced );
+/* a 4:2:0 chroma plane of width x height from a YV411 (b_yuv9 = 0) or YUV9 chroma plane */
+void convert_chroma_420( convert_pool_t *pool, char *dst, const uint8_t *src, int src_pitch,
+                         int width, int height, int b_yuv9, int b_interlaced );
+/* 4:2:2 from a YUY2 frame, width is even, dst receives the three planes */
+void convert_yuy2_422( convert_pool_t *pool, char *dst, const uint8_t *src, int src_pitch, int width, int height );
+
+/* i_threads threads besides the caller, NULL when none could be started */
+convert_pool_t *convert_pool_create( int i_threads );
+/* run func on bands of [0, height) on the pool and the calling thread, returns once all are done.
+   runs from several threads are done one after another, a NULL pool runs everything on the calling thread */
+void convert_pool_run( convert_pool_t *pool, convert_band_t func, void *arg, int height );
+void convert_pool_close( convert_pool_t *pool );
+
+#endif
@@ -0,0 +1,66 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+#ifndef AVS4X26X_FRAME_H
+#define AVS4X26X_FRAME_H
+
+#include <stdlib.h>
+
+/* staging buffers are aligned to a cache line so the C runtime's vectorized memcpy can be used */
+#define FRAME_ALIGN 64
+
+/* maximum number of planes written per frame */
+#define MAX_PLANES 3
+
+/* how the planes are stored in the source frame */
+enum
+{
+    FRAME_FORMAT_PLANAR,    /* as they are written */
+    FRAME_FORMAT_STACK16,   /* Dither stack16: MSB rows above LSB rows, interleaved into 16-bit samples */
+    FRAME_FORMAT_BOTTOM_UP, /* last row first, as AviSynth stores RGB */
+    /* converted to a format x26x takes while packing, see convert.h */
+    FRAME_FORMAT_YV411,     /* 4:1:1 chroma planes resampled to 4:2:0 */
+    FRAME_FORMAT_YUV9,      /* 4:1:0 chroma planes resampled to 4:2:0 */
+    FRAME_FORMAT_RGB24,     /* whole frame to 4:2:0, from the luma plane pointer */
+    FRAME_FORMAT_RGB32,
+    FRAME_FORMAT_YUY2,      /* whole frame to 4:2:2 */
+};
+
+/* describes how a frame is laid out in the pipe: the planes in output order, with their row size in bytes */
+typedef struct
+{
+    int i_format;
+    int b_interlaced;       /* vertical chroma resampling keeps the fields apart */
+    int i_planes;
+    int plane_id[MAX_PLANES];
+    int width[MAX_PLANES];
+    int height[MAX_PLANES];
+    size_t frame_size;
+    const char *frame_header;   /* written before every frame, the YUV4MPEG2 marker; NULL for raw frames */
+} frame_layout_t;
+
+/* align is a power of 2, the buffers of both are released with aligned_free */
+static inline void *aligned_malloc_align( size_t size, size_t align )
+{
+    char *mem = malloc( size + align - 1 + sizeof(void*) );
+    if( !mem )
+        return NULL;
+    char *ptr = (char*)(((size_t)mem + sizeof(void*) + align - 1) & ~(align - 1));
+    ((void**)ptr)[-1] = mem;
+    return ptr;
+}
+
+static inline void *aligned_malloc( size_t size )
+{
+    return aligned_malloc_align( size, FRAME_ALIGN );
+}
+
+static inline void aligned_free( void *ptr )
+{
+    if( ptr )
+        free( ((void**)ptr)[-1] );
+}
+
+#endif
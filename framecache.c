@@ -0,0 +1,556 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+#ifndef _WIN32
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "osdep.h"
+#include "framecache.h"
+
+/* file layout, all integers little-endian:
+     header   "A4XFC001", u64 key, u64 frame size, u32 first frame, u32 end frame
+     records  u32 frame, u32 size (bit 31 set when stored uncompressed), data
+     trailer  "A4XFCEND", u32 number of records, u32 0
+   an entry is only valid with its trailer, it is written under a temporary name and renamed */
+#define HEADER_SIZE  32
+#define TRAILER_SIZE 16
+#define RECORD_RAW   0x80000000u
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+/* the last bytes of a block are always literals, so the decoder can stop on input exhaustion */
+#define LZ_LAST_LITERALS 5
+#define LZ_BOUND(size) ((size) + (size) / 255 + 16)
+
+/* at most this many compression threads, the encoder needs the rest */
+#define MAX_CACHE_THREADS 8
+
+enum { JOB_FREE, JOB_PENDING, JOB_BUSY, JOB_DONE };
+
+typedef struct
+{
+    int state;
+    int frame;
+    char *raw;
+    char *residual;
+    unsigned char *out;
+    uint32_t out_size;
+    uint32_t table[1 << LZ_HASH_BITS];
+} cache_job_t;
+
+struct framecache_t
+{
+    FILE *fh;
+    char *path;
+    char *tmp_path;
+    frame_layout_t layout;
+    int i_start;
+    int i_end;
+    int b_write;
+
+    /* reader */
+    unsigned char *in;
+    int i_next;
+
+    /* writer */
+    os_mutex_t mutex;
+    os_cond_t cv;
+    os_thread_t threads[MAX_CACHE_THREADS];
+    int i_threads;
+    cache_job_t *jobs;
+    int i_jobs;
+    int i_queued;   /* frames handed to framecache_put */
+    int i_written;  /* records in the file, they are written in queue order */
+    int b_writing;
+    int b_exit;
+    int b_error;
+};
+
+uint64_t framecache_hash( uint64_t hash, const void *data, size_t size )
+{
+    const unsigned char *p = data;
+    while( size-- )
+    {
+        hash ^= *p++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void put_u32( unsigned char *p, uint32_t v )
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get_u32( const unsigned char *p )
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_u64( unsigned char *p, uint64_t v )
+{
+    put_u32( p, (uint32_t)v );
+    put_u32( p + 4, (uint32_t)(v >> 32) );
+}
+
+static uint64_t get_u64( const unsigned char *p )
+{
+    return get_u32( p ) | ((uint64_t)get_u32( p + 4 ) << 32);
+}
+
+static uint32_t read32( const unsigned char *p )
+{
+    uint32_t v;
+    memcpy( &v, p, 4 );
+    return v;
+}
+
+/* neighbouring pixels are similar, so storing each byte as the difference to its left
+   neighbour turns smooth areas into runs the LZ stage can match */
+static void delta_encode( const frame_layout_t *layout, const char *src, char *dst )
+{
+    for( int p = 0; p < layout->i_planes; p++ )
+        for( int y = 0; y < layout->height[p]; y++ )
+        {
+            const unsigned char *s = (const unsigned char*)src;
+            unsigned char *d = (unsigned char*)dst;
+            d[0] = s[0];
+            for( int x = 1; x < layout->width[p]; x++ )
+                d[x] = s[x] - s[x-1];
+            src += layout->width[p];
+            dst += layout->width[p];
+        }
+}
+
+static void delta_decode( const frame_layout_t *layout, char *buf )
+{
+    for( int p = 0; p < layout->i_planes; p++ )
+        for( int y = 0; y < layout->height[p]; y++ )
+        {
+            unsigned char *b = (unsigned char*)buf;
+            for( int x = 1; x < layout->width[p]; x++ )
+                b[x] += b[x-1];
+            buf += layout->width[p];
+        }
+}
+
+static unsigned char *lz_put_length( unsigned char *op, size_t len )
+{
+    while( len >= 255 )
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* LZ77 with a single-entry hash table and the LZ4 token format: a token with 4 bits of literal
+   length and 4 bits of match length, extended by 255-runs, the literals, then a 16-bit offset */
+static size_t lz_compress( const unsigned char *src, size_t size, unsigned char *dst, uint32_t *table )
+{
+    const unsigned char *ip = src, *anchor = src;
+    const unsigned char *end = src + size;
+    const unsigned char *match_limit = size > LZ_LAST_LITERALS + 8 ? end - LZ_LAST_LITERALS - 8 : src;
+    unsigned char *op = dst;
+
+    memset( table, 0, sizeof(uint32_t) << LZ_HASH_BITS );
+    while( ip < match_limit )
+    {
+        uint32_t seq = read32( ip );
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        const unsigned char *ref = src + table[h];
+        table[h] = (uint32_t)(ip - src);
+        if( ref >= ip || ip - ref > LZ_MAX_OFFSET || read32( ref ) != seq )
+        {
+            /* skip faster through data that doesn't compress */
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+        size_t match = LZ_MIN_MATCH;
+        size_t max_match = end - LZ_LAST_LITERALS - ip;
+        while( match + 8 <= max_match )
+        {
+            uint64_t a, b;
+            memcpy( &a, ref + match, 8 );
+            memcpy( &b, ip + match, 8 );
+            if( a != b )
+                break;
+            match += 8;
+        }
+        while( match < max_match && ref[match] == ip[match] )
+            match++;
+
+        size_t literals = ip - anchor;
+        unsigned char *token = op++;
+        *token = (literals < 15 ? literals : 15) << 4;
+        if( literals >= 15 )
+            op = lz_put_length( op, literals - 15 );
+        memcpy( op, anchor, literals );
+        op += literals;
+        op[0] = (unsigned char)(ip - ref);
+        op[1] = (unsigned char)((ip - ref) >> 8);
+        op += 2;
+        size_t extra = match - LZ_MIN_MATCH;
+        *token |= extra < 15 ? extra : 15;
+        if( extra >= 15 )
+            op = lz_put_length( op, extra - 15 );
+        ip += match;
+        anchor = ip;
+    }
+
+    size_t literals = end - anchor;
+    *op++ = (literals < 15 ? literals : 15) << 4;
+    if( literals >= 15 )
+        op = lz_put_length( op, literals - 15 );
+    memcpy( op, anchor, literals );
+    op += literals;
+    return op - dst;
+}
+
+/* returns 0 only if the block decodes to exactly dst_size bytes */
+static int lz_decompress( const unsigned char *src, size_t size, unsigned char *dst, size_t dst_size )
+{
+    const unsigned char *ip = src, *iend = src + size;
+    unsigned char *op = dst, *oend = dst + dst_size;
+
+    while( ip < iend )
+    {
+        unsigned token = *ip++;
+        size_t literals = token >> 4;
+        if( literals == 15 )
+        {
+            unsigned b;
+            do
+            {
+                if( ip >= iend )
+                    return -1;
+                b = *ip++;
+                literals += b;
+            } while( b == 255 );
+        }
+        if( literals > (size_t)(iend - ip) || literals > (size_t)(oend - op) )
+            return -1;
+        memcpy( op, ip, literals );
+        ip += literals;
+        op += literals;
+        if( ip == iend )
+            break;
+
+        if( iend - ip < 2 )
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if( !offset || offset > (size_t)(op - dst) )
+            return -1;
+        size_t match = token & 15;
+        if( match == 15 )
+        {
+            unsigned b;
+            do
+            {
+                if( ip >= iend )
+                    return -1;
+                b = *ip++;
+                match += b;
+            } while( b == 255 );
+        }
+        match += LZ_MIN_MATCH;
+        if( match > (size_t)(oend - op) )
+            return -1;
+        const unsigned char *ref = op - offset;
+        if( offset >= match )
+            memcpy( op, ref, match );
+        else if( offset == 1 )
+            memset( op, *ref, match ); /* runs of flat residuals */
+        else
+            for( size_t i = 0; i < match; i++ )
+                op[i] = ref[i];
+        op += match;
+    }
+    return op == oend ? 0 : -1;
+}
+
+static char *cache_path( const char *dir, uint64_t key, const char *suffix )
+{
+    size_t len = strlen( dir ) + 32;
+    char *path = malloc( len );
+    if( path )
+        snprintf( path, len, "%s/%08x%08x.cache%s", dir, (unsigned)(key >> 32), (unsigned)key, suffix );
+    return path;
+}
+
+static void cache_free( framecache_t *c )
+{
+    if( c->fh )
+        fclose( c->fh );
+    free( c->in );
+    free( c->path );
+    free( c->tmp_path );
+    free( c );
+}
+
+framecache_t *framecache_open_read( const char *dir, uint64_t key, const frame_layout_t *layout, int i_start, int i_end )
+{
+    unsigned char header[HEADER_SIZE], trailer[TRAILER_SIZE];
+    framecache_t *c = calloc( 1, sizeof(framecache_t) );
+    if( !c )
+        return NULL;
+    c->layout = *layout;
+    c->i_start = c->i_next = i_start;
+    c->i_end = i_end;
+    c->path = cache_path( dir, key, "" );
+    if( !c->path || !(c->fh = fopen( c->path, "rb" )) )
+        goto fail;
+    if( fread( header, HEADER_SIZE, 1, c->fh ) != 1 || memcmp( header, "A4XFC001", 8 ) ||
+        get_u64( header + 8 ) != key || get_u64( header + 16 ) != layout->frame_size ||
+        (int)get_u32( header + 24 ) > i_start || (int)get_u32( header + 28 ) < i_end )
+        goto fail;
+    if( fseek( c->fh, -TRAILER_SIZE, SEEK_END ) || fread( trailer, TRAILER_SIZE, 1, c->fh ) != 1 ||
+        memcmp( trailer, "A4XFCEND", 8 ) ||
+        get_u32( trailer + 8 ) != get_u32( header + 28 ) - get_u32( header + 24 ) ||
+        fseek( c->fh, HEADER_SIZE, SEEK_SET ) )
+        goto fail;
+    c->in = malloc( LZ_BOUND( layout->frame_size ) );
+    if( !c->in )
+        goto fail;
+    return c;
+fail:
+    cache_free( c );
+    return NULL;
+}
+
+int framecache_read( framecache_t *c, int frame, char *dst )
+{
+    unsigned char record[8];
+    for( ;; )
+    {
+        if( fread( record, 8, 1, c->fh ) != 1 )
+            return -1;
+        int i_frame = get_u32( record );
+        uint32_t size = get_u32( record + 4 );
+        int b_raw = !!(size & RECORD_RAW);
+        size &= ~RECORD_RAW;
+        if( size > LZ_BOUND( c->layout.frame_size ) || i_frame > frame )
+            return -1;
+        if( i_frame < frame )
+        {
+            /* the entry starts before the requested range */
+            if( fseek( c->fh, size, SEEK_CUR ) )
+                return -1;
+            continue;
+        }
+        if( b_raw )
+            return size == c->layout.frame_size && fread( dst, size, 1, c->fh ) == 1 ? 0 : -1;
+        if( fread( c->in, size, 1, c->fh ) != 1 ||
+            lz_decompress( c->in, size, (unsigned char*)dst, c->layout.frame_size ) )
+            return -1;
+        delta_decode( &c->layout, dst );
+        return 0;
+    }
+}
+
+/* write finished jobs in queue order, called and returns with the mutex held */
+static void cache_flush( framecache_t *c )
+{
+    unsigned char record[8];
+    if( c->b_writing )
+        return;
+    c->b_writing = 1;
+    for( ;; )
+    {
+        cache_job_t *job = &c->jobs[c->i_written % c->i_jobs];
+        if( c->i_written == c->i_queued || job->state != JOB_DONE )
+            break;
+        os_mutex_unlock( &c->mutex );
+        int b_raw = job->out_size >= c->layout.frame_size;
+        uint32_t size = b_raw ? (uint32_t)c->layout.frame_size : job->out_size;
+        put_u32( record, job->frame );
+        put_u32( record + 4, size | (b_raw ? RECORD_RAW : 0) );
+        int b_error = fwrite( record, 8, 1, c->fh ) != 1 ||
+                      fwrite( b_raw ? (void*)job->raw : (void*)job->out, size, 1, c->fh ) != 1;
+        os_mutex_lock( &c->mutex );
+        c->b_error |= b_error;
+        job->state = JOB_FREE;
+        c->i_written++;
+        os_cond_broadcast( &c->cv );
+    }
+    c->b_writing = 0;
+}
+
+static os_thread_ret OS_THREAD_CC cache_worker( void *arg )
+{
+    framecache_t *c = arg;
+    os_mutex_lock( &c->mutex );
+    for( ;; )
+    {
+        cache_job_t *job = NULL;
+        for( int i = 0; i < c->i_jobs && !job; i++ )
+            if( c->jobs[i].state == JOB_PENDING )
+                job = &c->jobs[i];
+        if( !job )
+        {
+            if( c->b_exit )
+                break;
+            os_cond_wait( &c->cv, &c->mutex );
+            continue;
+        }
+        job->state = JOB_BUSY;
+        os_mutex_unlock( &c->mutex );
+
+        delta_encode( &c->layout, job->raw, job->residual );
+        job->out_size = (uint32_t)lz_compress( (unsigned char*)job->residual, c->layout.frame_size, job->out, job->table );
+
+        os_mutex_lock( &c->mutex );
+        job->state = JOB_DONE;
+        cache_flush( c );
+    }
+    os_mutex_unlock( &c->mutex );
+    return 0;
+}
+
+framecache_t *framecache_open_write( const char *dir, uint64_t key, const frame_layout_t *layout, int i_start, int i_end, int i_threads )
+{
+    unsigned char header[HEADER_SIZE];
+    /* frames beyond 2 GB would not fit the record size */
+    if( LZ_BOUND( layout->frame_size ) >= RECORD_RAW )
+        return NULL;
+    framecache_t *c = calloc( 1, sizeof(framecache_t) );
+    if( !c )
+        return NULL;
+    c->b_write = 1;
+    c->layout = *layout;
+    c->i_start = c->i_next = i_start;
+    c->i_end = i_end;
+    os_mkdir( dir );
+    c->path = cache_path( dir, key, "" );
+    c->tmp_path = cache_path( dir, key, ".tmp" );
+    if( !c->path || !c->tmp_path || !(c->fh = fopen( c->tmp_path, "wb" )) )
+        goto fail;
+    memcpy( header, "A4XFC001", 8 );
+    put_u64( header + 8, key );
+    put_u64( header + 16, layout->frame_size );
+    put_u32( header + 24, i_start );
+    put_u32( header + 28, i_end );
+    if( fwrite( header, HEADER_SIZE, 1, c->fh ) != 1 )
+        goto fail;
+
+    i_threads = i_threads < 1 ? 1 : i_threads > MAX_CACHE_THREADS ? MAX_CACHE_THREADS : i_threads;
+    /* two jobs per thread keep the workers busy while finished frames wait for their turn to be written */
+    c->i_jobs = i_threads * 2;
+    c->jobs = calloc( c->i_jobs, sizeof(cache_job_t) );
+    if( !c->jobs )
+        goto fail;
+    for( int i = 0; i < c->i_jobs; i++ )
+    {
+        cache_job_t *job = &c->jobs[i];
+        job->raw = malloc( layout->frame_size );
+        job->residual = malloc( layout->frame_size );
+        job->out = malloc( LZ_BOUND( layout->frame_size ) );
+        if( !job->raw || !job->residual || !job->out )
+            goto fail_jobs;
+    }
+    os_mutex_init( &c->mutex );
+    os_cond_init( &c->cv );
+    for( ; c->i_threads < i_threads; c->i_threads++ )
+        if( os_thread_create( &c->threads[c->i_threads], cache_worker, c ) )
+            break;
+    if( !c->i_threads )
+    {
+        os_cond_destroy( &c->cv );
+        os_mutex_destroy( &c->mutex );
+        goto fail_jobs;
+    }
+    return c;
+fail_jobs:
+    for( int i = 0; i < c->i_jobs; i++ )
+    {
+        free( c->jobs[i].raw );
+        free( c->jobs[i].residual );
+        free( c->jobs[i].out );
+    }
+    free( c->jobs );
+fail:
+    if( c->fh )
+    {
+        fclose( c->fh );
+        c->fh = NULL;
+        remove( c->tmp_path );
+    }
+    cache_free( c );
+    return NULL;
+}
+
+int framecache_put( framecache_t *c, int frame, const char *data )
+{
+    os_mutex_lock( &c->mutex );
+    cache_job_t *job = &c->jobs[c->i_queued % c->i_jobs];
+    while( job->state != JOB_FREE && !c->b_error )
+        os_cond_wait( &c->cv, &c->mutex );
+    int ret = c->b_error || frame != c->i_next ? -1 : 0;
+    os_mutex_unlock( &c->mutex );
+    if( ret )
+        return ret;
+
+    memcpy( job->raw, data, c->layout.frame_size );
+    job->frame = frame;
+    c->i_next++;
+    os_mutex_lock( &c->mutex );
+    job->state = JOB_PENDING;
+    c->i_queued++;
+    os_cond_broadcast( &c->cv );
+    os_mutex_unlock( &c->mutex );
+    return 0;
+}
+
+void framecache_close( framecache_t *c, int b_complete )
+{
+    if( !c )
+        return;
+    if( !c->b_write )
+    {
+        cache_free( c );
+        return;
+    }
+
+    os_mutex_lock( &c->mutex );
+    while( c->i_written < c->i_queued && !c->b_error )
+        os_cond_wait( &c->cv, &c->mutex );
+    c->b_exit = 1;
+    os_cond_broadcast( &c->cv );
+    os_mutex_unlock( &c->mutex );
+    for( int i = 0; i < c->i_threads; i++ )
+        os_thread_join( c->threads[i] );
+    os_cond_destroy( &c->cv );
+    os_mutex_destroy( &c->mutex );
+    for( int i = 0; i < c->i_jobs; i++ )
+    {
+        free( c->jobs[i].raw );
+        free( c->jobs[i].residual );
+        free( c->jobs[i].out );
+    }
+    free( c->jobs );
+
+    b_complete = b_complete && !c->b_error && c->i_next == c->i_end;
+    if( b_complete )
+    {
+        unsigned char trailer[TRAILER_SIZE];
+        memcpy( trailer, "A4XFCEND", 8 );
+        put_u32( trailer + 8, c->i_end - c->i_start );
+        put_u32( trailer + 12, 0 );
+        b_complete = fwrite( trailer, TRAILER_SIZE, 1, c->fh ) == 1;
+    }
+    b_complete = !fclose( c->fh ) && b_complete;
+    c->fh = NULL;
+    if( !b_complete || os_rename( c->tmp_path, c->path ) )
+        remove( c->tmp_path );
+    cache_free( c );
+}
@@ -0,0 +1,37 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+/* on-disk cache of rendered frames. a script's output is stored losslessly compressed in
+   <dir>/<key>.cache the first time it is encoded, later runs with the same key read the
+   frames back instead of rendering them */
+
+#ifndef AVS4X26X_FRAMECACHE_H
+#define AVS4X26X_FRAMECACHE_H
+
+#include <stdint.h>
+
+#include "frame.h"
+
+#define FRAMECACHE_HASH_INIT 14695981039346656037ULL
+
+typedef struct framecache_t framecache_t;
+
+/* FNV-1a, chain calls starting from FRAMECACHE_HASH_INIT to build a key */
+uint64_t framecache_hash( uint64_t hash, const void *data, size_t size );
+
+/* open a complete entry holding frames [i_start, i_end), NULL if there is none */
+framecache_t *framecache_open_read( const char *dir, uint64_t key, const frame_layout_t *layout, int i_start, int i_end );
+/* read the next frame into dst, frames must be requested in order */
+int framecache_read( framecache_t *c, int frame, char *dst );
+
+/* start a new entry for frames [i_start, i_end), compressing on i_threads worker threads */
+framecache_t *framecache_open_write( const char *dir, uint64_t key, const frame_layout_t *layout, int i_start, int i_end, int i_threads );
+/* queue the next frame, data is copied before returning */
+int framecache_put( framecache_t *c, int frame, const char *data );
+
+/* a writer publishes the entry if b_complete is set and every frame was stored, otherwise it is discarded */
+void framecache_close( framecache_t *c, int b_complete );
+
+#endif
@@ -0,0 +1,1105 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "osdep.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+extern char **environ;
+#endif
+
+/* the smallest write issued to the pipe, also the floor when shrinking writes on quota errors */
+#define PIPE_MIN_CHUNK 65536
+
+/* split a command line built for CreateProcess back into arguments, by the rules of the
+   Microsoft C runtime: arguments are separated by spaces or tabs, double quotes group an argument
+   containing them, backslashes are literal unless they precede a double quote, where each pair
+   gives one backslash and an odd one out makes the quote literal */
+char **split_commandline( const char *cmd )
+{
+    size_t len = strlen( cmd );
+    char **argv = malloc( (len / 2 + 2) * sizeof(char*) + len + 1 );
+    if( !argv )
+        return NULL;
+    char *out = (char*)(argv + len / 2 + 2);
+    int argc = 0;
+    while( *cmd )
+    {
+        while( *cmd == ' ' || *cmd == '\t' )
+            cmd++;
+        if( !*cmd )
+            break;
+        argv[argc++] = out;
+        int b_quoted = 0;
+        while( *cmd && (b_quoted || (*cmd != ' ' && *cmd != '\t')) )
+        {
+            size_t i_slashes = strspn( cmd, "\\" );
+            cmd += i_slashes;
+            if( *cmd == '"' )
+            {
+                for( size_t k = 0; k < i_slashes / 2; k++ )
+                    *out++ = '\\';
+                if( i_slashes & 1 )
+                    *out++ = '"';
+                else
+                    b_quoted = !b_quoted;
+                cmd++;
+            }
+            else
+            {
+                for( size_t k = 0; k < i_slashes; k++ )
+                    *out++ = '\\';
+                if( i_slashes == 0 )
+                    *out++ = *cmd++;
+            }
+        }
+        *out++ = 0;
+    }
+    argv[argc] = NULL;
+    return argv;
+}
+
+static int cmdline_reserve( cmdline_t *c, size_t size )
+{
+    if( c->b_failed )
+        return -1;
+    if( c->len + size + 1 > c->size )
+    {
+        size_t i_size = c->size ? c->size : 256;
+        while( i_size < c->len + size + 1 )
+            i_size *= 2;
+        char *buf = realloc( c->buf, i_size );
+        if( !buf )
+        {
+            c->b_failed = 1;
+            return -1;
+        }
+        c->buf = buf;
+        c->size = i_size;
+    }
+    return 0;
+}
+
+void cmdline_arg( cmdline_t *c, const char *arg )
+{
+    size_t len = strlen( arg );
+    int b_quote = !*arg || strpbrk( arg, " \t\"" );
+    /* at worst every character is a quote taking a backslash, plus the separator and the quotes */
+    if( cmdline_reserve( c, 2 * len + 3 ) )
+        return;
+    char *out = c->buf + c->len;
+    if( c->len )
+        *out++ = ' ';
+    if( !b_quote )
+    {
+        memcpy( out, arg, len );
+        out += len;
+    }
+    else
+    {
+        *out++ = '"';
+        while( *arg )
+        {
+            size_t i_slashes = strspn( arg, "\\" );
+            arg += i_slashes;
+            /* backslashes ahead of a quote, ours or one of the argument, are doubled */
+            if( !*arg || *arg == '"' )
+                i_slashes *= 2;
+            memset( out, '\\', i_slashes );
+            out += i_slashes;
+            if( *arg == '"' )
+                *out++ = '\\';
+            if( *arg )
+                *out++ = *arg++;
+        }
+        *out++ = '"';
+    }
+    *out = 0;
+    c->len = out - c->buf;
+}
+
+void cmdline_printf( cmdline_t *c, const char *fmt, ... )
+{
+    va_list args;
+    va_start( args, fmt );
+    int len = vsnprintf( NULL, 0, fmt, args );
+    va_end( args );
+    if( len < 0 || cmdline_reserve( c, len + 1 ) )
+        return;
+    if( c->len )
+        c->buf[c->len++] = ' ';
+    va_start( args, fmt );
+    vsnprintf( c->buf + c->len, len + 1, fmt, args );
+    va_end( args );
+    c->len += len;
+}
+
+char *cmdline_take( cmdline_t *c )
+{
+    char *cmd = c->buf;
+    if( c->b_failed )
+    {
+        free( c->buf );
+        cmd = NULL;
+    }
+    else if( !cmd )
+        cmd = calloc( 1, 1 );
+    c->buf = NULL;
+    c->len = c->size = 0;
+    c->b_failed = 0;
+    return cmd;
+}
+
+#ifdef _WIN32
+
+static HANDLE h_console;
+static CONSOLE_SCREEN_BUFFER_INFO console_default;
+
+void os_console_init( void )
+{
+    h_console = GetStdHandle( STD_ERROR_HANDLE );
+    GetConsoleScreenBufferInfo( h_console, &console_default );
+}
+
+void os_console_color( int color )
+{
+    SetConsoleTextAttribute( h_console, (WORD)color );
+}
+
+void os_console_reset( void )
+{
+    SetConsoleTextAttribute( h_console, console_default.wAttributes );
+}
+
+void *os_library_open( const char *name )
+{
+    return LoadLibrary( name );
+}
+
+void *os_library_symbol( void *library, const char *name )
+{
+    return (void*)GetProcAddress( library, name );
+}
+
+void os_library_close( void *library )
+{
+    if( library )
+        FreeLibrary( library );
+}
+
+int os_thread_create( os_thread_t *thread, os_thread_func_t func, void *arg )
+{
+    *thread = CreateThread( NULL, 0, func, arg, 0, NULL );
+    return *thread ? 0 : -1;
+}
+
+void os_thread_join( os_thread_t thread )
+{
+    WaitForSingleObject( thread, INFINITE );
+    CloseHandle( thread );
+}
+
+void os_handle_close( os_handle_t h )
+{
+    if( h && h != INVALID_HANDLE_VALUE )
+        CloseHandle( h );
+}
+
+/* overlapped writes are waited for in pipe_write, there is nothing left to drain */
+void pipe_drain( pipe_out_t *p )
+{
+}
+
+void pipe_close( pipe_out_t *p )
+{
+    os_handle_close( p->h );
+    for( int i = 0; i < 2; i++ )
+        if( p->ov[i].hEvent )
+            CloseHandle( p->ov[i].hEvent );
+    memset( p, 0, sizeof(*p) );
+}
+
+int pipe_create( pipe_out_t *p, os_handle_t *h_read, size_t i_buffer_size )
+{
+    SECURITY_ATTRIBUTES sa_attr = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+    static volatile LONG i_pipes;
+    char name[64];
+
+    memset( p, 0, sizeof(*p) );
+    /* the tick count alone repeats for pipes made within a few ms of each other, as --fanout does */
+    sprintf( name, "\\\\.\\pipe\\avs4x26x-%lu-%lu-%ld", GetCurrentProcessId(), GetTickCount(),
+             (long)InterlockedIncrement( &i_pipes ) );
+    p->h = CreateNamedPipe( name, PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                            PIPE_TYPE_BYTE | PIPE_WAIT, 1, (DWORD)i_buffer_size, 0, 0, NULL );
+    if( p->h == INVALID_HANDLE_VALUE )
+        return -1;
+    *h_read = CreateFile( name, GENERIC_READ, 0, &sa_attr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( *h_read == INVALID_HANDLE_VALUE )
+        goto fail;
+    for( int i = 0; i < 2; i++ )
+    {
+        p->ov[i].hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+        if( !p->ov[i].hEvent )
+        {
+            CloseHandle( *h_read );
+            goto fail;
+        }
+    }
+    p->i_chunk = i_buffer_size > PIPE_MIN_CHUNK ? (DWORD)i_buffer_size : PIPE_MIN_CHUNK;
+    return 0;
+fail:
+    pipe_close( p );
+    return -1;
+}
+
+int pipe_open_stdout( pipe_out_t *p )
+{
+    memset( p, 0, sizeof(*p) );
+    /* a handle not opened for overlapped I/O completes every WriteFile before it returns,
+       pipe_write works the same on it */
+    if( !DuplicateHandle( GetCurrentProcess(), GetStdHandle( STD_OUTPUT_HANDLE ), GetCurrentProcess(), &p->h,
+                          0, FALSE, DUPLICATE_SAME_ACCESS ) )
+        return -1;
+    for( int i = 0; i < 2; i++ )
+    {
+        p->ov[i].hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+        if( !p->ov[i].hEvent )
+        {
+            pipe_close( p );
+            return -1;
+        }
+    }
+    p->i_chunk = PIPE_MIN_CHUNK;
+    return 0;
+}
+
+int pipe_enable_splice( pipe_out_t *p, size_t i_buffer_size )
+{
+    return -1;
+}
+
+static int is_quota_error( DWORD error )
+{
+    return error == ERROR_NOT_ENOUGH_QUOTA || error == ERROR_NO_SYSTEM_RESOURCES ||
+           error == ERROR_NOT_ENOUGH_MEMORY || error == ERROR_WORKING_SET_QUOTA;
+}
+
+/* writes are issued in chunks no bigger than i_chunk: the kernel charges pending pipe data
+   against the nonpaged pool quota, and a single write bigger than what is left fails with a
+   quota error instead of blocking. the old anonymous pipe writer ignored both that and short
+   writes, which is why buffers above ~250000 bytes used to corrupt the stream */
+int pipe_write( pipe_out_t *p, const char *buf, size_t size )
+{
+    DWORD expected[2] = {0};
+    int pending[2] = {0};
+    int cur = 0; /* the slot the next chunk goes to, it is also the older one when both are pending */
+    DWORD written;
+
+    while( size || pending[0] || pending[1] )
+    {
+        if( size && !pending[cur] )
+        {
+            DWORD chunk = size < p->i_chunk ? (DWORD)size : p->i_chunk;
+            OVERLAPPED *ov = &p->ov[cur];
+            ov->Offset = ov->OffsetHigh = 0;
+            ResetEvent( ov->hEvent );
+            if( !WriteFile( p->h, buf, chunk, NULL, ov ) )
+            {
+                DWORD error = GetLastError();
+                if( is_quota_error( error ) && p->i_chunk > PIPE_MIN_CHUNK / 16 )
+                {
+                    /* nothing was queued, retry the same data in smaller pieces */
+                    p->i_chunk >>= 1;
+                    continue;
+                }
+                if( error != ERROR_IO_PENDING )
+                    goto fail;
+            }
+            expected[cur] = chunk;
+            pending[cur] = 1;
+            buf += chunk;
+            size -= chunk;
+            cur ^= 1;
+            continue;
+        }
+        int old = pending[cur] ? cur : cur ^ 1;
+        pending[old] = 0;
+        if( !GetOverlappedResult( p->h, &p->ov[old], &written, TRUE ) || written != expected[old] )
+            goto fail;
+    }
+    return 0;
+fail:
+    /* the buffer must outlive any write still queued on it */
+    CancelIo( p->h );
+    for( int i = 0; i < 2; i++ )
+        if( pending[i] )
+            GetOverlappedResult( p->h, &p->ov[i], &written, TRUE );
+    return -1;
+}
+
+int os_process_spawn( os_process_t *proc, const char *cmd, os_handle_t h_stdin )
+{
+    STARTUPINFO si_info;
+    PROCESS_INFORMATION pi_info;
+    char *cmd_copy = strdup( cmd ); /* CreateProcess may modify the command line */
+    if( !cmd_copy )
+        return -1;
+
+    ZeroMemory( &pi_info, sizeof(PROCESS_INFORMATION) );
+    ZeroMemory( &si_info, sizeof(STARTUPINFO) );
+    si_info.cb = sizeof(STARTUPINFO);
+    si_info.dwFlags = STARTF_USESTDHANDLES;
+    si_info.hStdInput = h_stdin != INVALID_HANDLE_VALUE ? h_stdin : GetStdHandle( STD_INPUT_HANDLE );
+    si_info.hStdOutput = GetStdHandle( STD_OUTPUT_HANDLE );
+    si_info.hStdError = GetStdHandle( STD_ERROR_HANDLE );
+
+    BOOL ret = CreateProcess( NULL, cmd_copy, NULL, NULL, TRUE, 0, NULL, NULL, &si_info, &pi_info );
+    free( cmd_copy );
+    if( !ret )
+        return -1;
+    CloseHandle( pi_info.hThread );
+    proc->h_process = pi_info.hProcess;
+    return 0;
+}
+
+int os_process_wait( os_process_t *proc )
+{
+    DWORD exitcode = -1;
+    WaitForSingleObject( proc->h_process, INFINITE );
+    GetExitCodeProcess( proc->h_process, &exitcode );
+    CloseHandle( proc->h_process );
+    proc->h_process = NULL;
+    return exitcode;
+}
+
+int os_process_wait_any( os_process_t *procs, int i_procs, int *exitcode )
+{
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    DWORD code = -1;
+    if( i_procs <= 0 || i_procs > MAXIMUM_WAIT_OBJECTS )
+        return -1;
+    for( int i = 0; i < i_procs; i++ )
+        handles[i] = procs[i].h_process;
+    DWORD ret = WaitForMultipleObjects( i_procs, handles, FALSE, INFINITE );
+    if( ret >= WAIT_OBJECT_0 + i_procs )
+        return -1;
+    int i = ret - WAIT_OBJECT_0;
+    GetExitCodeProcess( procs[i].h_process, &code );
+    CloseHandle( procs[i].h_process );
+    procs[i].h_process = NULL;
+    *exitcode = code;
+    return i;
+}
+
+int64_t os_time_us( void )
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if( !freq.QuadPart )
+        QueryPerformanceFrequency( &freq );
+    QueryPerformanceCounter( &now );
+    return (int64_t)(now.QuadPart / freq.QuadPart) * 1000000 + (now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
+
+const char *os_error_string( char *buf, size_t size )
+{
+    DWORD error = GetLastError();
+    if( !FormatMessage( FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                        NULL, error, 0, buf, (DWORD)size, NULL ) )
+        snprintf( buf, size, "error %lu", error );
+    return buf;
+}
+
+
+int os_cpu_count( void )
+{
+    SYSTEM_INFO si;
+    GetSystemInfo( &si );
+    return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
+
+size_t os_page_size( void )
+{
+    SYSTEM_INFO si;
+    GetSystemInfo( &si );
+    return si.dwPageSize;
+}
+
+FILE *os_stream_from_fd( int fd )
+{
+    HANDLE h;
+    if( fd <= 2 )
+        fd = _dup( fd );
+    else if( DuplicateHandle( GetCurrentProcess(), (HANDLE)(intptr_t)fd, GetCurrentProcess(), &h, 0, FALSE, DUPLICATE_SAME_ACCESS ) )
+        fd = _open_osfhandle( (intptr_t)h, _O_WRONLY | _O_BINARY );
+    else
+        fd = -1;
+    return fd < 0 ? NULL : _fdopen( fd, "wb" );
+}
+
+int64_t os_address_space_used( void )
+{
+    MEMORYSTATUSEX ms = { sizeof(ms) };
+    if( !GlobalMemoryStatusEx( &ms ) )
+        return -1;
+    return (int64_t)(ms.ullTotalVirtual - ms.ullAvailVirtual);
+}
+
+/* 2 GB, 3 GB with /3GB or 4 GB on a 64-bit system as we link with --large-address-aware */
+int64_t os_address_space_limit( void )
+{
+    MEMORYSTATUSEX ms = { sizeof(ms) };
+    if( sizeof(void*) > 4 || !GlobalMemoryStatusEx( &ms ) )
+        return 0;
+    return (int64_t)ms.ullTotalVirtual;
+}
+
+int os_file_info( const char *path, int64_t *size, int64_t *mtime )
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if( !GetFileAttributesEx( path, GetFileExInfoStandard, &data ) )
+        return -1;
+    *size = ((int64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    *mtime = ((int64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    return 0;
+}
+
+int os_mkdir( const char *path )
+{
+    return CreateDirectory( path, NULL ) || GetLastError() == ERROR_ALREADY_EXISTS ? 0 : -1;
+}
+
+int os_rename( const char *from, const char *to )
+{
+    return MoveFileEx( from, to, MOVEFILE_REPLACE_EXISTING ) ? 0 : -1;
+}
+
+char *os_full_path( const char *path, char *buf, size_t size )
+{
+    DWORD len = GetFullPathName( path, (DWORD)size, buf, NULL );
+    return len && len < size ? buf : NULL;
+}
+
+FILE *os_temp_file( char *buf, size_t size )
+{
+    char dir[MAX_PATH];
+    DWORD len = GetTempPath( sizeof(dir), dir );
+    if( !len || len >= sizeof(dir) || size < MAX_PATH || !GetTempFileName( dir, "avs", 0, buf ) )
+        return NULL;
+    FILE *fh = fopen( buf, "wb" );
+    if( !fh )
+        remove( buf );
+    return fh;
+}
+
+struct os_server_t
+{
+    char name[MAX_PATH];
+    HANDLE h_next;      /* the instance the next client connects to */
+};
+
+static void pipe_name( char *buf, size_t size, const char *name )
+{
+    snprintf( buf, size, "%s%s", strncmp( name, "\\\\.\\pipe\\", 9 ) ? "\\\\.\\pipe\\" : "", name );
+}
+
+static HANDLE server_instance( os_server_t *s, DWORD flags )
+{
+    return CreateNamedPipe( s->name, PIPE_ACCESS_DUPLEX | flags, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+                            PIPE_UNLIMITED_INSTANCES, 1 << 20, 1 << 20, 0, NULL );
+}
+
+os_server_t *os_server_open( const char *name )
+{
+    os_server_t *s = calloc( 1, sizeof(os_server_t) );
+    if( !s )
+        return NULL;
+    pipe_name( s->name, sizeof(s->name), name );
+    /* fails if another server has the name */
+    s->h_next = server_instance( s, FILE_FLAG_FIRST_PIPE_INSTANCE );
+    if( s->h_next == INVALID_HANDLE_VALUE )
+    {
+        free( s );
+        return NULL;
+    }
+    return s;
+}
+
+os_handle_t os_server_accept( os_server_t *s )
+{
+    HANDLE h = s->h_next;
+    if( h == INVALID_HANDLE_VALUE )
+        h = server_instance( s, 0 );
+    s->h_next = INVALID_HANDLE_VALUE;
+    if( h == INVALID_HANDLE_VALUE )
+        return h;
+    if( !ConnectNamedPipe( h, NULL ) && GetLastError() != ERROR_PIPE_CONNECTED )
+    {
+        CloseHandle( h );
+        return INVALID_HANDLE_VALUE;
+    }
+    return h;
+}
+
+void os_server_close( os_server_t *s )
+{
+    os_handle_close( s->h_next );
+    free( s );
+}
+
+os_handle_t os_connect( const char *name )
+{
+    char full[MAX_PATH];
+    pipe_name( full, sizeof(full), name );
+    for( int i = 0; i < 10; i++ )
+    {
+        HANDLE h = CreateFile( full, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL );
+        if( h != INVALID_HANDLE_VALUE || GetLastError() != ERROR_PIPE_BUSY )
+            return h;
+        /* every instance is taken until the server gets to accept again */
+        WaitNamedPipe( full, 1000 );
+    }
+    return INVALID_HANDLE_VALUE;
+}
+
+int os_conn_read( os_handle_t h, void *buf, size_t size )
+{
+    DWORD done;
+    for( char *p = buf; size; p += done, size -= done )
+        if( !ReadFile( h, p, size > (1 << 30) ? 1 << 30 : (DWORD)size, &done, NULL ) || !done )
+            return -1;
+    return 0;
+}
+
+int os_conn_recv( os_handle_t h, void *buf, size_t size )
+{
+    DWORD done;
+    return ReadFile( h, buf, size > (1 << 30) ? 1 << 30 : (DWORD)size, &done, NULL ) ? (int)done : -1;
+}
+
+int os_conn_write( os_handle_t h, const void *buf, size_t size )
+{
+    DWORD done;
+    for( const char *p = buf; size; p += done, size -= done )
+        if( !WriteFile( h, p, size > (1 << 30) ? 1 << 30 : (DWORD)size, &done, NULL ) )
+            return -1;
+    return 0;
+}
+
+#else
+
+static int b_console_colors;
+
+void os_console_init( void )
+{
+    const char *term = getenv( "TERM" );
+    b_console_colors = isatty( STDERR_FILENO ) && term && strcmp( term, "dumb" );
+}
+
+/* map the Windows console attribute bits to an ANSI SGR foreground color */
+void os_console_color( int color )
+{
+    if( !b_console_colors )
+        return;
+    int ansi = (color & FOREGROUND_RED ? 1 : 0) | (color & FOREGROUND_GREEN ? 2 : 0) | (color & FOREGROUND_BLUE ? 4 : 0);
+    fprintf( stderr, "\033[%dm", (color & FOREGROUND_INTENSITY ? 90 : 30) + ansi );
+}
+
+void os_console_reset( void )
+{
+    if( b_console_colors )
+        fputs( "\033[0m", stderr );
+}
+
+void *os_library_open( const char *name )
+{
+    return dlopen( name, RTLD_NOW | RTLD_GLOBAL );
+}
+
+void *os_library_symbol( void *library, const char *name )
+{
+    return dlsym( library, name );
+}
+
+void os_library_close( void *library )
+{
+    if( library )
+        dlclose( library );
+}
+
+int os_thread_create( os_thread_t *thread, os_thread_func_t func, void *arg )
+{
+    return pthread_create( thread, NULL, func, arg ) ? -1 : 0;
+}
+
+void os_thread_join( os_thread_t thread )
+{
+    pthread_join( thread, NULL );
+}
+
+void os_handle_close( os_handle_t h )
+{
+    if( h >= 0 )
+        close( h );
+}
+
+void pipe_drain( pipe_out_t *p )
+{
+#ifdef __linux__
+    int pending;
+    struct pollfd pfd = { p->fd, 0, 0 };
+    while( p->b_splice && !ioctl( p->fd, FIONREAD, &pending ) && pending > 0 )
+    {
+        /* POLLERR once the reader is gone, what is left will never be read */
+        if( poll( &pfd, 1, 0 ) > 0 && (pfd.revents & POLLERR) )
+            break;
+        usleep( 1000 );
+    }
+#endif
+}
+
+void pipe_close( pipe_out_t *p )
+{
+    os_handle_close( p->fd );
+    p->fd = -1;
+}
+
+/* grow the pipe with F_SETPIPE_SZ where available. unprivileged processes are capped at
+   /proc/sys/fs/pipe-max-size, so fall back to that limit when the request is refused */
+static void pipe_set_size( int fd, size_t i_buffer_size )
+{
+#ifdef F_SETPIPE_SZ
+    if( !i_buffer_size || fcntl( fd, F_SETPIPE_SZ, (int)i_buffer_size ) >= 0 )
+        return;
+    FILE *fh = fopen( "/proc/sys/fs/pipe-max-size", "r" );
+    if( fh )
+    {
+        int i_max;
+        if( fscanf( fh, "%d", &i_max ) == 1 && i_max > 0 && (size_t)i_max < i_buffer_size )
+            fcntl( fd, F_SETPIPE_SZ, i_max );
+        fclose( fh );
+    }
+#endif
+}
+
+int pipe_create( pipe_out_t *p, os_handle_t *h_read, size_t i_buffer_size )
+{
+    int fds[2];
+
+    /* a dead x26x must show up as a failed write, not kill us */
+    signal( SIGPIPE, SIG_IGN );
+    if( pipe( fds ) )
+        return -1;
+    /* only the duplicate on the child's stdin may be inherited */
+    fcntl( fds[0], F_SETFD, FD_CLOEXEC );
+    fcntl( fds[1], F_SETFD, FD_CLOEXEC );
+    pipe_set_size( fds[1], i_buffer_size );
+    p->fd = fds[1];
+    p->b_splice = 0;
+    p->i_chunk = i_buffer_size > PIPE_MIN_CHUNK ? i_buffer_size : PIPE_MIN_CHUNK;
+    *h_read = fds[0];
+    return 0;
+}
+
+int pipe_open_stdout( pipe_out_t *p )
+{
+    /* a reader that went away must show up as a failed write, not kill us */
+    signal( SIGPIPE, SIG_IGN );
+    p->fd = dup( STDOUT_FILENO );
+    if( p->fd < 0 )
+        return -1;
+    fcntl( p->fd, F_SETFD, FD_CLOEXEC );
+    p->i_chunk = PIPE_MIN_CHUNK;
+    p->b_splice = 0;
+    return 0;
+}
+
+int pipe_enable_splice( pipe_out_t *p, size_t i_buffer_size )
+{
+#if defined(__linux__) && defined(F_SETPIPE_SZ)
+    struct stat st;
+    if( fstat( p->fd, &st ) || !S_ISFIFO( st.st_mode ) )
+        return -1;
+    /* as big as allowed without holding more than one buffer, the kernel takes powers of two pages */
+    size_t size = (size_t)sysconf( _SC_PAGESIZE );
+    while( size * 2 <= i_buffer_size )
+        size *= 2;
+    for( ; size >= (size_t)sysconf( _SC_PAGESIZE ); size >>= 1 )
+        if( fcntl( p->fd, F_SETPIPE_SZ, (int)size ) >= 0 )
+            break;
+    int i_size = fcntl( p->fd, F_GETPIPE_SZ );
+    if( i_size <= 0 || (size_t)i_size > i_buffer_size )
+        return -1;
+    p->b_splice = 1;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int pipe_write( pipe_out_t *p, const char *buf, size_t size )
+{
+#ifdef __linux__
+    while( p->b_splice && size )
+    {
+        struct iovec iov = { (void*)buf, size };
+        ssize_t written = vmsplice( p->fd, &iov, 1, 0 );
+        if( written < 0 && errno == EINTR )
+            continue;
+        if( written <= 0 )
+            return -1;
+        buf += written;
+        size -= written;
+    }
+#endif
+    while( size )
+    {
+        ssize_t written = write( p->fd, buf, size < p->i_chunk ? size : p->i_chunk );
+        if( written < 0 && errno == EINTR )
+            continue;
+        if( written <= 0 )
+            return -1;
+        buf += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int os_process_spawn( os_process_t *proc, const char *cmd, os_handle_t h_stdin )
+{
+    posix_spawn_file_actions_t actions;
+    char **argv = split_commandline( cmd );
+    int ret;
+
+    if( !argv || !argv[0] )
+    {
+        free( argv );
+        errno = EINVAL;
+        return -1;
+    }
+    posix_spawn_file_actions_init( &actions );
+    if( h_stdin >= 0 )
+        posix_spawn_file_actions_adddup2( &actions, h_stdin, STDIN_FILENO );
+    ret = posix_spawnp( &proc->pid, argv[0], &actions, NULL, argv, environ );
+    posix_spawn_file_actions_destroy( &actions );
+    free( argv );
+    if( ret )
+    {
+        errno = ret;
+        return -1;
+    }
+    return 0;
+}
+
+static int exit_status( int status )
+{
+    if( WIFEXITED( status ) )
+        return WEXITSTATUS( status );
+    return WIFSIGNALED( status ) ? 128 + WTERMSIG( status ) : -1;
+}
+
+int os_process_wait( os_process_t *proc )
+{
+    int status;
+    while( waitpid( proc->pid, &status, 0 ) < 0 )
+        if( errno != EINTR )
+            return -1;
+    proc->pid = 0;
+    return exit_status( status );
+}
+
+int os_process_wait_any( os_process_t *procs, int i_procs, int *exitcode )
+{
+    int status;
+    for( ;; )
+    {
+        pid_t pid = waitpid( -1, &status, 0 );
+        if( pid < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            return -1;
+        }
+        /* children that aren't in the list are reaped and ignored */
+        for( int i = 0; i < i_procs; i++ )
+            if( procs[i].pid == pid )
+            {
+                procs[i].pid = 0;
+                *exitcode = exit_status( status );
+                return i;
+            }
+    }
+}
+
+int64_t os_time_us( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+const char *os_error_string( char *buf, size_t size )
+{
+    snprintf( buf, size, "%s", strerror( errno ) );
+    return buf;
+}
+
+int os_cpu_count( void )
+{
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+    return n > 0 ? (int)n : 1;
+}
+
+size_t os_page_size( void )
+{
+    long size = sysconf( _SC_PAGESIZE );
+    return size > 0 ? (size_t)size : 4096;
+}
+
+FILE *os_stream_from_fd( int fd )
+{
+    int fd_dup = dup( fd );
+    FILE *fh = fd_dup < 0 ? NULL : fdopen( fd_dup, "w" );
+    if( !fh && fd_dup >= 0 )
+        close( fd_dup );
+    return fh;
+}
+
+void os_cond_wait_ms( os_cond_t *c, os_mutex_t *m, int ms )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_REALTIME, &ts );
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += ms % 1000 * 1000000L;
+    if( ts.tv_nsec >= 1000000000L )
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait( c, m, &ts );
+}
+
+int64_t os_address_space_used( void )
+{
+    long pages = -1;
+    FILE *fh = fopen( "/proc/self/statm", "r" );
+    if( !fh )
+        return -1;
+    if( fscanf( fh, "%ld", &pages ) != 1 )
+        pages = -1;
+    fclose( fh );
+    return pages < 0 ? -1 : (int64_t)pages * sysconf( _SC_PAGESIZE );
+}
+
+/* ulimit -v, or what a 32-bit process can count on */
+int64_t os_address_space_limit( void )
+{
+    struct rlimit rl;
+    if( !getrlimit( RLIMIT_AS, &rl ) && rl.rlim_cur != RLIM_INFINITY )
+        return (int64_t)rl.rlim_cur;
+    return sizeof(void*) > 4 ? 0 : (int64_t)3 << 30;
+}
+
+int os_file_info( const char *path, int64_t *size, int64_t *mtime )
+{
+    struct stat st;
+    if( stat( path, &st ) )
+        return -1;
+    *size = st.st_size;
+#ifdef __APPLE__
+    *mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    *mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return 0;
+}
+
+int os_mkdir( const char *path )
+{
+    return mkdir( path, 0777 ) && errno != EEXIST ? -1 : 0;
+}
+
+int os_rename( const char *from, const char *to )
+{
+    return rename( from, to );
+}
+
+char *os_full_path( const char *path, char *buf, size_t size )
+{
+    char *full = realpath( path, NULL );
+    if( !full || strlen( full ) >= size )
+    {
+        free( full );
+        return NULL;
+    }
+    strcpy( buf, full );
+    free( full );
+    return buf;
+}
+
+FILE *os_temp_file( char *buf, size_t size )
+{
+    const char *dir = getenv( "TMPDIR" );
+    if( !dir || !*dir )
+        dir = "/tmp";
+    if( snprintf( buf, size, "%s/avs4x26x-XXXXXX", dir ) >= (int)size )
+        return NULL;
+    int fd = mkstemp( buf );
+    FILE *fh = fd < 0 ? NULL : fdopen( fd, "wb" );
+    if( !fh && fd >= 0 )
+    {
+        close( fd );
+        remove( buf );
+    }
+    return fh;
+}
+
+struct os_server_t
+{
+    int fd;
+    char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+};
+
+static int socket_address( struct sockaddr_un *addr, const char *name )
+{
+    memset( addr, 0, sizeof(*addr) );
+    addr->sun_family = AF_UNIX;
+    if( strlen( name ) >= sizeof(addr->sun_path) )
+        return -1;
+    strcpy( addr->sun_path, name );
+    return 0;
+}
+
+os_server_t *os_server_open( const char *name )
+{
+    struct sockaddr_un addr;
+    if( socket_address( &addr, name ) )
+        return NULL;
+    /* a socket file nobody listens on is left over from a server that didn't exit cleanly,
+       anything else at that path is not ours to remove */
+    struct stat st;
+    int b_exists = !lstat( name, &st );
+    int fd = b_exists && S_ISSOCK( st.st_mode ) ? os_connect( name ) : -1;
+    if( fd >= 0 || (b_exists && !S_ISSOCK( st.st_mode )) )
+    {
+        if( fd >= 0 )
+            close( fd );
+        errno = EADDRINUSE;
+        return NULL;
+    }
+    os_server_t *s = calloc( 1, sizeof(os_server_t) );
+    if( !s )
+        return NULL;
+    signal( SIGPIPE, SIG_IGN );
+    if( b_exists )
+        unlink( name );
+    strcpy( s->path, name );
+    s->fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( s->fd < 0 || bind( s->fd, (struct sockaddr*)&addr, sizeof(addr) ) || listen( s->fd, 16 ) )
+    {
+        if( s->fd >= 0 )
+            close( s->fd );
+        free( s );
+        return NULL;
+    }
+    return s;
+}
+
+os_handle_t os_server_accept( os_server_t *s )
+{
+    int fd;
+    while( (fd = accept( s->fd, NULL, NULL )) < 0 && errno == EINTR );
+    return fd;
+}
+
+void os_server_close( os_server_t *s )
+{
+    close( s->fd );
+    unlink( s->path );
+    free( s );
+}
+
+os_handle_t os_connect( const char *name )
+{
+    struct sockaddr_un addr;
+    if( socket_address( &addr, name ) )
+        return -1;
+    int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( fd < 0 )
+        return -1;
+    if( connect( fd, (struct sockaddr*)&addr, sizeof(addr) ) )
+    {
+        close( fd );
+        return -1;
+    }
+    signal( SIGPIPE, SIG_IGN );
+    return fd;
+}
+
+int os_conn_read( os_handle_t h, void *buf, size_t size )
+{
+    for( char *p = buf; size; )
+    {
+        ssize_t done = read( h, p, size );
+        if( done < 0 && errno == EINTR )
+            continue;
+        if( done <= 0 )
+            return -1;
+        p += done;
+        size -= done;
+    }
+    return 0;
+}
+
+int os_conn_recv( os_handle_t h, void *buf, size_t size )
+{
+    ssize_t done;
+    while( (done = read( h, buf, size > (1 << 30) ? 1 << 30 : size )) < 0 && errno == EINTR );
+    return (int)done;
+}
+
+int os_conn_write( os_handle_t h, const void *buf, size_t size )
+{
+    for( const char *p = buf; size; )
+    {
+        ssize_t done = write( h, p, size );
+        if( done < 0 && errno == EINTR )
+            continue;
+        if( done < 0 )
+            return -1;
+        p += done;
+        size -= done;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,213 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+/* platform layer: console colors, dynamic libraries, threads, the pipe to x26x and the x26x process.
+   Windows uses the Win32 API, everything else POSIX */
+
+#ifndef AVS4X26X_OSDEP_H
+#define AVS4X26X_OSDEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+
+/* condition variables need Vista */
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+#include <windows.h>
+
+typedef HANDLE os_handle_t;
+#define OS_INVALID_HANDLE INVALID_HANDLE_VALUE
+
+typedef HANDLE os_thread_t;
+typedef DWORD os_thread_ret;
+#define OS_THREAD_CC WINAPI
+
+typedef CRITICAL_SECTION os_mutex_t;
+typedef CONDITION_VARIABLE os_cond_t;
+#define os_mutex_init(m)      InitializeCriticalSection(m)
+#define os_mutex_destroy(m)   DeleteCriticalSection(m)
+#define os_mutex_lock(m)      EnterCriticalSection(m)
+#define os_mutex_unlock(m)    LeaveCriticalSection(m)
+#define os_cond_init(c)       InitializeConditionVariable(c)
+#define os_cond_destroy(c)
+#define os_cond_wait(c, m)    SleepConditionVariableCS(c, m, INFINITE)
+#define os_cond_wait_ms(c, m, ms) SleepConditionVariableCS(c, m, ms)
+#define os_cond_broadcast(c)  WakeAllConditionVariable(c)
+
+/* the write end of the pipe to x26x. it is a named pipe opened for overlapped I/O, so two
+   chunks can be queued at once and the pipe doesn't run dry between two writes */
+typedef struct
+{
+    HANDLE h;
+    OVERLAPPED ov[2];
+    DWORD i_chunk;
+} pipe_out_t;
+
+typedef struct
+{
+    HANDLE h_process;
+} os_process_t;
+
+#else
+
+#include <pthread.h>
+#include <strings.h>
+#include <sys/types.h>
+
+/* the AviSynth+ C API uses the default calling convention outside Windows */
+#define __stdcall
+
+/* console colors use the same bits as the Windows console attributes */
+#define FOREGROUND_BLUE      0x1
+#define FOREGROUND_GREEN     0x2
+#define FOREGROUND_RED       0x4
+#define FOREGROUND_INTENSITY 0x8
+
+typedef int os_handle_t;
+#define OS_INVALID_HANDLE (-1)
+
+typedef pthread_t os_thread_t;
+typedef void *os_thread_ret;
+#define OS_THREAD_CC
+
+typedef pthread_mutex_t os_mutex_t;
+typedef pthread_cond_t os_cond_t;
+#define os_mutex_init(m)      pthread_mutex_init(m, NULL)
+#define os_mutex_destroy(m)   pthread_mutex_destroy(m)
+#define os_mutex_lock(m)      pthread_mutex_lock(m)
+#define os_mutex_unlock(m)    pthread_mutex_unlock(m)
+#define os_cond_init(c)       pthread_cond_init(c, NULL)
+#define os_cond_destroy(c)    pthread_cond_destroy(c)
+#define os_cond_wait(c, m)    pthread_cond_wait(c, m)
+#define os_cond_broadcast(c)  pthread_cond_broadcast(c)
+/* wait at most ms milliseconds */
+void os_cond_wait_ms( os_cond_t *c, os_mutex_t *m, int ms );
+
+typedef struct
+{
+    int fd;
+    size_t i_chunk;
+    int b_splice;   /* pipe_write hands the pages to the pipe with vmsplice instead of copying them */
+} pipe_out_t;
+
+typedef struct
+{
+    pid_t pid;
+} os_process_t;
+
+#endif
+
+typedef os_thread_ret (OS_THREAD_CC *os_thread_func_t)( void *arg );
+
+void os_console_init( void );
+void os_console_color( int color );
+void os_console_reset( void );
+
+void *os_library_open( const char *name );
+void *os_library_symbol( void *library, const char *name );
+void os_library_close( void *library );
+
+int os_thread_create( os_thread_t *thread, os_thread_func_t func, void *arg );
+void os_thread_join( os_thread_t thread );
+
+void os_handle_close( os_handle_t h );
+
+/* create the pipe to x26x. h_read receives the read end for the child process,
+   i_buffer_size is the requested kernel buffer size, 0 for the system default */
+int pipe_create( pipe_out_t *p, os_handle_t *h_read, size_t i_buffer_size );
+/* use our standard output as the pipe, for a stream read by a program that started us */
+int pipe_open_stdout( pipe_out_t *p );
+/* let pipe_write hand over the pages of the buffers instead of copying them, where the system
+   can (Linux vmsplice into a pipe). the pipe is kept no bigger than i_buffer_size, so a buffer has
+   been consumed by the reader once i_buffer_size more bytes are written after it; until then it
+   must not be modified. returns 0 if enabled */
+int pipe_enable_splice( pipe_out_t *p, size_t i_buffer_size );
+/* write the whole buffer, returns once all of it has been handed to the pipe */
+int pipe_write( pipe_out_t *p, const char *buf, size_t size );
+/* wait for the reader to take what was handed over with splice, so the buffers may be reused */
+void pipe_drain( pipe_out_t *p );
+void pipe_close( pipe_out_t *p );
+
+/* split a command line into a NULL terminated argument array allocated as one block, by the
+   quoting rules of CreateProcess and the Microsoft C runtime */
+char **split_commandline( const char *cmd );
+
+/* a command line for os_process_spawn, grown as it is built. starts zeroed */
+typedef struct
+{
+    char *buf;
+    size_t len;
+    size_t size;
+    int b_failed;   /* out of memory, cmdline_take gives NULL */
+} cmdline_t;
+
+/* add arg as one argument, quoted if needed so split_commandline gives it back unchanged */
+void cmdline_arg( cmdline_t *c, const char *arg );
+/* add the formatted text as is, for arguments known to need no quoting */
+void cmdline_printf( cmdline_t *c, const char *fmt, ... );
+/* hand out the command line for the caller to free, NULL if it ran out of memory. c is
+   left empty for reuse */
+char *cmdline_take( cmdline_t *c );
+
+/* start cmd with h_stdin as its standard input, sharing our stdout and stderr.
+   OS_INVALID_HANDLE shares our standard input too */
+int os_process_spawn( os_process_t *proc, const char *cmd, os_handle_t h_stdin );
+/* wait for the process to exit and return its exit code */
+int os_process_wait( os_process_t *proc );
+/* wait for the first of i_procs processes to exit, returns its index and stores its exit code */
+int os_process_wait_any( os_process_t *procs, int i_procs, int *exitcode );
+
+/* monotonic clock in microseconds */
+int64_t os_time_us( void );
+
+/* number of logical processors */
+int os_cpu_count( void );
+/* size of a memory page in bytes */
+size_t os_page_size( void );
+
+/* bytes of address space the process has reserved, -1 if unknown */
+int64_t os_address_space_used( void );
+/* bytes of address space the process can have, 0 if it is practically unlimited (64-bit) */
+int64_t os_address_space_limit( void );
+
+/* size and last modification time of a file, the time in an unspecified but stable unit */
+int os_file_info( const char *path, int64_t *size, int64_t *mtime );
+/* create a directory, succeeds if it already exists */
+int os_mkdir( const char *path );
+/* rename a file, replacing the destination if it exists */
+int os_rename( const char *from, const char *to );
+/* absolute path of an existing file, NULL if it doesn't fit in buf */
+char *os_full_path( const char *path, char *buf, size_t size );
+/* create a file of a unique name in the temporary directory, its path in buf, and open it for
+   binary writing. NULL if it couldn't be created */
+FILE *os_temp_file( char *buf, size_t size );
+
+/* local connections between a frameserver daemon and its clients, a Unix domain socket at the
+   path name or, on Windows, the named pipe \\.\pipe\name. connections are full duplex handles */
+typedef struct os_server_t os_server_t;
+/* NULL if name is in use by a running server or can't be created */
+os_server_t *os_server_open( const char *name );
+/* wait for the next client */
+os_handle_t os_server_accept( os_server_t *s );
+void os_server_close( os_server_t *s );
+os_handle_t os_connect( const char *name );
+/* read or write the whole buffer, -1 if the connection broke first */
+int os_conn_read( os_handle_t h, void *buf, size_t size );
+int os_conn_write( os_handle_t h, const void *buf, size_t size );
+/* read what has arrived, waiting for at least a byte. the bytes read, 0 or less if the connection broke */
+int os_conn_recv( os_handle_t h, void *buf, size_t size );
+
+/* a stream writing to a copy of a descriptor inherited from the program that started us, so
+   closing it leaves the descriptor open. on Windows 0-2 are the standard streams, others handles */
+FILE *os_stream_from_fd( int fd );
+
+/* description of the last system error */
+const char *os_error_string( char *buf, size_t size );
+
+#endif
@@ -0,0 +1,236 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "osdep.h"
+#include "probecache.h"
+
+/* a text file, one line per input, newest last:
+     path <TAB> size <TAB> mtime <TAB> flags <TAB> index <TAB> step [<TAB> step...]
+   where a step is the filter name followed by ",name=<type><value>" per argument */
+#define PROBECACHE_MAX_ENTRIES 256
+#define PROBECACHE_MAX_LINE    8192
+
+const char *probecache_default_file( char *buf, size_t size )
+{
+#ifdef _WIN32
+    const char *base = getenv( "LOCALAPPDATA" );
+    if( !base )
+        base = getenv( "APPDATA" );
+    if( !base )
+        return NULL;
+    snprintf( buf, size, "%s\\avs4x26x\\probe-cache.txt", base );
+#else
+    const char *base = getenv( "XDG_CACHE_HOME" );
+    if( base && *base )
+        snprintf( buf, size, "%s/avs4x26x/probe-cache.txt", base );
+    else if( (base = getenv( "HOME" )) )
+        snprintf( buf, size, "%s/.cache/avs4x26x/probe-cache.txt", base );
+    else
+        return NULL;
+#endif
+    return buf;
+}
+
+/* absolute path, size and mtime of the input, the key of its entry */
+static int input_key( const char *path, char *full, size_t size, int64_t *i_size, int64_t *i_mtime )
+{
+    if( !os_full_path( path, full, size ) || os_file_info( full, i_size, i_mtime ) )
+        return -1;
+    return strpbrk( full, "\t\n" ) ? -1 : 0;
+}
+
+static char *read_file( const char *file )
+{
+    FILE *fh = fopen( file, "rb" );
+    if( !fh )
+        return NULL;
+    fseek( fh, 0, SEEK_END );
+    long len = ftell( fh );
+    fseek( fh, 0, SEEK_SET );
+    char *data = len >= 0 ? malloc( len + 1 ) : NULL;
+    if( data )
+    {
+        len = (long)fread( data, 1, len, fh );
+        data[len] = 0;
+    }
+    fclose( fh );
+    return data;
+}
+
+/* whether line is the entry of path */
+static int line_matches( const char *line, const char *path )
+{
+    size_t len = strlen( path );
+    return !strncmp( line, path, len ) && line[len] == '\t';
+}
+
+static int parse_step( char *text, probe_step_t *step )
+{
+    char *arg = strchr( text, ',' );
+    if( arg )
+        *arg++ = 0;
+    if( strlen( text ) >= sizeof(step->filter) || !*text )
+        return -1;
+    strcpy( step->filter, text );
+    step->i_args = 0;
+    while( arg )
+    {
+        char *next = strchr( arg, ',' );
+        if( next )
+            *next++ = 0;
+        char *value = strchr( arg, '=' );
+        if( !value || step->i_args == PROBE_MAX_ARGS )
+            return -1;
+        *value++ = 0;
+        probe_arg_t *a = &step->args[step->i_args++];
+        if( strlen( arg ) >= sizeof(a->name) || !*value || strlen( value + 1 ) >= sizeof(a->value) ||
+            !strchr( "sibf@", *value ) )
+            return -1;
+        strcpy( a->name, arg );
+        a->type = *value;
+        strcpy( a->value, value + 1 );
+        arg = next;
+    }
+    return 0;
+}
+
+int probecache_lookup( const char *file, const char *path, probe_result_t *result )
+{
+    char full[1024];
+    int64_t i_size, i_mtime;
+    if( input_key( path, full, sizeof(full), &i_size, &i_mtime ) )
+        return -1;
+    char *data = read_file( file );
+    if( !data )
+        return -1;
+
+    int ret = -1;
+    /* the newest entry of a path is the last one */
+    for( char *line = data, *next; line && *line; line = next )
+    {
+        next = strchr( line, '\n' );
+        if( next )
+            *next++ = 0;
+        if( !line_matches( line, full ) )
+            continue;
+        char *field[5 + PROBE_MAX_STEPS];
+        int i_fields = 0;
+        for( char *f = line; f && i_fields < 5 + PROBE_MAX_STEPS; i_fields++ )
+        {
+            field[i_fields] = f;
+            if( (f = strchr( f, '\t' )) )
+                *f++ = 0;
+        }
+        if( i_fields < 6 || strtoll( field[1], NULL, 10 ) != i_size || strtoll( field[2], NULL, 10 ) != i_mtime )
+        {
+            ret = -1;
+            continue;
+        }
+        memset( result, 0, sizeof(*result) );
+        result->i_flags = atoi( field[3] );
+        snprintf( result->index, sizeof(result->index), "%s", field[4] );
+        ret = 0;
+        for( int k = 5; k < i_fields && !ret; k++ )
+            ret = parse_step( field[k], &result->steps[result->i_steps++] );
+    }
+    free( data );
+    return ret;
+}
+
+static int format_step( char *buf, size_t size, const probe_step_t *step )
+{
+    size_t len = snprintf( buf, size, "\t%s", step->filter );
+    for( int k = 0; k < step->i_args && len < size; k++ )
+    {
+        const probe_arg_t *a = &step->args[k];
+        if( strpbrk( a->name, "\t\n,=" ) || strpbrk( a->value, "\t\n," ) )
+            return -1;
+        len += snprintf( buf + len, size - len, ",%s=%c%s", a->name, a->type, a->value );
+    }
+    return len < size ? (int)len : -1;
+}
+
+/* create the directories leading to file */
+static void make_parent_dirs( const char *file )
+{
+    char dir[1024];
+    snprintf( dir, sizeof(dir), "%s", file );
+    for( char *p = dir + 1; *p; p++ )
+        if( *p == '/' || *p == '\\' )
+        {
+            char c = *p;
+            *p = 0;
+            if( p[-1] != ':' )
+                os_mkdir( dir );
+            *p = c;
+        }
+}
+
+int probecache_store( const char *file, const char *path, const probe_result_t *result )
+{
+    char full[1024], line[PROBECACHE_MAX_LINE];
+    int64_t i_size, i_mtime;
+    if( result->i_steps <= 0 || input_key( path, full, sizeof(full), &i_size, &i_mtime ) ||
+        strpbrk( result->index, "\t\n" ) )
+        return -1;
+    size_t len = snprintf( line, sizeof(line), "%s\t%" PRId64 "\t%" PRId64 "\t%d\t%s",
+                           full, i_size, i_mtime, result->i_flags, result->index );
+    for( int k = 0; k < result->i_steps && len < sizeof(line); k++ )
+    {
+        int n = format_step( line + len, sizeof(line) - len, &result->steps[k] );
+        if( n < 0 )
+            return -1;
+        len += n;
+    }
+    if( len + 2 > sizeof(line) )
+        return -1;
+    strcpy( line + len, "\n" );
+
+    /* keep the newest entries of the other inputs */
+    char *data = read_file( file );
+    char *keep = data;
+    int i_lines = 0;
+    for( char *p = data; p && *p; p++ )
+        i_lines += *p == '\n';
+    for( ; keep && *keep && i_lines >= PROBECACHE_MAX_ENTRIES; i_lines-- )
+    {
+        char *next = strchr( keep, '\n' );
+        keep = next ? next + 1 : keep + strlen( keep );
+    }
+
+    char tmp[1040];
+    snprintf( tmp, sizeof(tmp), "%s.tmp", file );
+    make_parent_dirs( file );
+    FILE *fh = fopen( tmp, "wb" );
+    if( !fh )
+    {
+        free( data );
+        return -1;
+    }
+    int ret = 0;
+    for( char *p = keep, *next; p && *p; p = next )
+    {
+        next = strchr( p, '\n' );
+        next = next ? next + 1 : p + strlen( p );
+        if( !line_matches( p, full ) && fwrite( p, 1, next - p, fh ) != (size_t)(next - p) )
+            ret = -1;
+    }
+    if( fputs( line, fh ) < 0 )
+        ret = -1;
+    if( fclose( fh ) )
+        ret = -1;
+    free( data );
+    if( ret || os_rename( tmp, file ) )
+    {
+        remove( tmp );
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+/* persistent cache of source filter probes. for inputs opened through the filter fallback chain
+   it remembers the calls that opened the file, keyed by its absolute path, size and mtime,
+   so the next run can make them directly instead of trying every filter again */
+
+#ifndef AVS4X26X_PROBECACHE_H
+#define AVS4X26X_PROBECACHE_H
+
+#include <stddef.h>
+
+#define PROBE_MAX_STEPS 4
+#define PROBE_MAX_ARGS  4
+
+/* side effects of the probe that the replay must restore */
+#define PROBE_SEEK_SAFE 1
+#define PROBE_HBPP_VFW  2
+
+/* argument types: 's' string, 'i' int, 'b' bool, 'f' float, '@' the input file */
+typedef struct
+{
+    char type;
+    char name[16];
+    char value[64];
+} probe_arg_t;
+
+typedef struct
+{
+    char filter[32];
+    int i_args;
+    probe_arg_t args[PROBE_MAX_ARGS];
+} probe_step_t;
+
+/* the filter calls that opened the input, the last one returns the clip.
+   i_steps is -1 once a call couldn't be recorded */
+typedef struct
+{
+    int i_flags;
+    int i_steps;
+    probe_step_t steps[PROBE_MAX_STEPS];
+    char index[1024];   /* index file the filter wrote, empty if none was found */
+} probe_result_t;
+
+/* per-user default location of the cache file */
+const char *probecache_default_file( char *buf, size_t size );
+/* returns 0 and fills result if the cache has an entry for the current version of path */
+int probecache_lookup( const char *file, const char *path, probe_result_t *result );
+/* add or replace the entry of path */
+int probecache_store( const char *file, const char *path, const probe_result_t *result );
+
+#endif
@@ -0,0 +1,155 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "osdep.h"
+#include "progress.h"
+
+/* a line looks like
+     {"state":"running","frames_written":1200,"frames_total":5000,"frames_rendered":1206,"fps":48.21,
+      "avg_fps":45.10,"pipe_blocked":0.620,"pipe_blocked_avg":0.553,"elapsed":26.7,"eta":84.6}
+   fps and pipe_blocked cover the time since the previous line, the _avg ones the whole run.
+   pipe_blocked is the share of the time spent waiting for x26x to take frames, near 1 when x26x
+   is the bottleneck and near 0 when the frameserver is. eta is null until a frame was written */
+struct progress_t
+{
+    FILE *fh;
+    int i_start;
+    int i_end;
+    int i_interval_ms;
+    os_mutex_t mutex;
+    os_cond_t cv;
+    os_thread_t thread;
+    int b_stop;
+
+    int64_t i_time_start;
+    int i_rendered;
+    int i_written;                  /* next frame to be written */
+    int64_t i_write_time;
+
+    /* at the previous line */
+    int64_t i_last_time;
+    int i_last_rendered;
+    int64_t i_last_write_time;
+};
+
+static double clamp01( double x )
+{
+    return x < 0 ? 0 : x > 1 ? 1 : x;
+}
+
+/* called with the mutex held */
+static void write_line( progress_t *p, const char *state )
+{
+    int64_t i_now = os_time_us();
+    double f_elapsed = (i_now - p->i_time_start) / 1e6;
+    double f_interval = (i_now - p->i_last_time) / 1e6;
+    int i_done = p->i_written - p->i_start, i_total = p->i_end - p->i_start;
+
+    fprintf( p->fh, "{\"state\":\"%s\",\"frames_written\":%d,\"frames_total\":%d,\"frames_rendered\":%d,"
+             "\"fps\":%.2f,\"avg_fps\":%.2f,\"pipe_blocked\":%.3f,\"pipe_blocked_avg\":%.3f,\"elapsed\":%.1f,\"eta\":",
+             state, i_done, i_total, p->i_rendered,
+             f_interval > 0 ? (p->i_rendered - p->i_last_rendered) / f_interval : 0.0,
+             f_elapsed > 0 ? p->i_rendered / f_elapsed : 0.0,
+             f_interval > 0 ? clamp01( (p->i_write_time - p->i_last_write_time) / 1e6 / f_interval ) : 0.0,
+             f_elapsed > 0 ? clamp01( p->i_write_time / 1e6 / f_elapsed ) : 0.0, f_elapsed );
+    if( i_done >= i_total )
+        fputs( "0", p->fh );
+    else if( i_done > 0 )
+        fprintf( p->fh, "%.1f", (i_total - i_done) * f_elapsed / i_done );
+    else
+        fputs( "null", p->fh );
+    fputs( "}\n", p->fh );
+    fflush( p->fh );
+
+    p->i_last_time = i_now;
+    p->i_last_rendered = p->i_rendered;
+    p->i_last_write_time = p->i_write_time;
+}
+
+static os_thread_ret OS_THREAD_CC progress_thread( void *arg )
+{
+    progress_t *p = arg;
+    os_mutex_lock( &p->mutex );
+    while( !p->b_stop )
+    {
+        os_cond_wait_ms( &p->cv, &p->mutex, p->i_interval_ms );
+        if( !p->b_stop && os_time_us() - p->i_last_time >= p->i_interval_ms * 1000LL )
+            write_line( p, "running" );
+    }
+    os_mutex_unlock( &p->mutex );
+    return 0;
+}
+
+progress_t *progress_open( const char *target, int i_start, int i_end, int i_interval_ms )
+{
+    progress_t *p = calloc( 1, sizeof(progress_t) );
+    if( !p )
+        return NULL;
+    char *end;
+    long fd = strtol( target, &end, 10 );
+    if( *target && !*end && fd >= 0 )
+        p->fh = os_stream_from_fd( (int)fd );
+    else
+        p->fh = fopen( target, "w" );
+    if( !p->fh )
+    {
+        free( p );
+        return NULL;
+    }
+    p->i_start = p->i_written = i_start;
+    p->i_end = i_end;
+    p->i_interval_ms = i_interval_ms;
+    p->i_time_start = p->i_last_time = os_time_us();
+    os_mutex_init( &p->mutex );
+    os_cond_init( &p->cv );
+    if( os_thread_create( &p->thread, progress_thread, p ) )
+    {
+        os_cond_destroy( &p->cv );
+        os_mutex_destroy( &p->mutex );
+        fclose( p->fh );
+        free( p );
+        return NULL;
+    }
+    return p;
+}
+
+void progress_rendered( progress_t *p, int i_frames )
+{
+    if( !p )
+        return;
+    os_mutex_lock( &p->mutex );
+    p->i_rendered += i_frames;
+    os_mutex_unlock( &p->mutex );
+}
+
+void progress_written( progress_t *p, int frame, int64_t i_write_time )
+{
+    if( !p )
+        return;
+    os_mutex_lock( &p->mutex );
+    p->i_written = frame;
+    p->i_write_time = i_write_time;
+    os_mutex_unlock( &p->mutex );
+}
+
+void progress_close( progress_t *p, int b_done )
+{
+    if( !p )
+        return;
+    os_mutex_lock( &p->mutex );
+    p->b_stop = 1;
+    os_cond_broadcast( &p->cv );
+    os_mutex_unlock( &p->mutex );
+    os_thread_join( p->thread );
+    write_line( p, b_done ? "done" : "failed" );
+    fclose( p->fh );
+    os_cond_destroy( &p->cv );
+    os_mutex_destroy( &p->mutex );
+    free( p );
+}
@@ -0,0 +1,26 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+/* machine-readable progress for job schedulers: one JSON object per line, written every interval
+   by a thread of its own so a stalled encode still reports. the frame loops only count frames */
+
+#ifndef AVS4X26X_PROGRESS_H
+#define AVS4X26X_PROGRESS_H
+
+#include <stdint.h>
+
+typedef struct progress_t progress_t;
+
+/* report on frames [i_start, i_end) every i_interval_ms to target, a file name or the number
+   of an inherited descriptor. NULL if target can't be opened */
+progress_t *progress_open( const char *target, int i_start, int i_end, int i_interval_ms );
+/* i_frames more frames came out of the frameserver */
+void progress_rendered( progress_t *p, int i_frames );
+/* the frames before frame reached x26x, which kept us i_write_time microseconds in pipe writes */
+void progress_written( progress_t *p, int frame, int64_t i_write_time );
+/* write the last line, "done" if b_done is set and "failed" otherwise, and close the target */
+void progress_close( progress_t *p, int b_done );
+
+#endif
@@ -0,0 +1,788 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "osdep.h"
+#include "frame.h"
+
+#undef __declspec
+#define __declspec(i)
+#undef EXTERN_C
+
+#include "avisynth_c.h"
+#include "remote.h"
+
+/* writes up to this size are gathered, bigger ones go straight to the connection */
+#define REMOTE_BUFFER_SIZE 262144
+
+/* frames requested ahead of the one asked for, the server renders them while we pack */
+#define REMOTE_READAHEAD 4
+/* frames that arrived before they were asked for, kept for the render threads asking next */
+#define REMOTE_STASH 8
+
+struct remote_conn_t
+{
+    os_handle_t h;
+    char *rbuf;
+    size_t i_rpos, i_rlen;
+    char *wbuf;
+    size_t i_wlen;
+    int b_record;
+    char *record;           /* what was read since remote_record */
+    size_t i_record, i_record_size;
+};
+
+remote_conn_t *remote_conn_open( os_handle_t h )
+{
+    remote_conn_t *c = calloc( 1, sizeof(remote_conn_t) );
+    if( !c )
+        return NULL;
+    c->rbuf = malloc( REMOTE_BUFFER_SIZE );
+    c->wbuf = malloc( REMOTE_BUFFER_SIZE );
+    if( !c->rbuf || !c->wbuf )
+    {
+        free( c->rbuf );
+        free( c->wbuf );
+        free( c );
+        return NULL;
+    }
+    c->h = h;
+    return c;
+}
+
+void remote_conn_close( remote_conn_t *c )
+{
+    if( !c )
+        return;
+    os_handle_close( c->h );
+    free( c->rbuf );
+    free( c->wbuf );
+    free( c->record );
+    free( c );
+}
+
+static int record( remote_conn_t *c, const void *buf, size_t size )
+{
+    if( c->i_record + size > c->i_record_size )
+    {
+        size_t i_size = c->i_record_size * 2 > c->i_record + size ? c->i_record_size * 2 : c->i_record + size;
+        char *p = realloc( c->record, i_size );
+        if( !p )
+            return -1;
+        c->record = p;
+        c->i_record_size = i_size;
+    }
+    memcpy( c->record + c->i_record, buf, size );
+    c->i_record += size;
+    return 0;
+}
+
+int remote_read( remote_conn_t *c, void *buf, size_t size )
+{
+    char *dst = buf;
+    size_t i_size = size;
+    while( size )
+    {
+        if( c->i_rpos == c->i_rlen )
+        {
+            /* frame data is read in place */
+            if( size >= REMOTE_BUFFER_SIZE )
+            {
+                if( os_conn_read( c->h, dst, size ) )
+                    return -1;
+                break;
+            }
+            /* whatever has arrived, at least one byte */
+            int done = os_conn_recv( c->h, c->rbuf, REMOTE_BUFFER_SIZE );
+            if( done <= 0 )
+                return -1;
+            c->i_rpos = 0;
+            c->i_rlen = done;
+        }
+        size_t n = c->i_rlen - c->i_rpos < size ? c->i_rlen - c->i_rpos : size;
+        memcpy( dst, c->rbuf + c->i_rpos, n );
+        c->i_rpos += n;
+        dst += n;
+        size -= n;
+    }
+    return c->b_record ? record( c, buf, i_size ) : 0;
+}
+
+int remote_write( remote_conn_t *c, const void *buf, size_t size )
+{
+    if( c->i_wlen + size > REMOTE_BUFFER_SIZE && remote_flush( c ) )
+        return -1;
+    if( size >= REMOTE_BUFFER_SIZE )
+        return os_conn_write( c->h, buf, size );
+    memcpy( c->wbuf + c->i_wlen, buf, size );
+    c->i_wlen += size;
+    return 0;
+}
+
+int remote_flush( remote_conn_t *c )
+{
+    size_t i_len = c->i_wlen;
+    c->i_wlen = 0;
+    return i_len ? os_conn_write( c->h, c->wbuf, i_len ) : 0;
+}
+
+int remote_read_int( remote_conn_t *c, int *v )
+{
+    int32_t i;
+    if( remote_read( c, &i, sizeof(i) ) )
+        return -1;
+    *v = i;
+    return 0;
+}
+
+int remote_write_int( remote_conn_t *c, int v )
+{
+    int32_t i = v;
+    return remote_write( c, &i, sizeof(i) );
+}
+
+int remote_read_string( remote_conn_t *c, char **s )
+{
+    int len;
+    *s = NULL;
+    if( remote_read_int( c, &len ) || len < -1 )
+        return -1;
+    if( len < 0 )
+        return 0;
+    *s = malloc( len + 1 );
+    if( !*s || remote_read( c, *s, len ) )
+    {
+        free( *s );
+        *s = NULL;
+        return -1;
+    }
+    (*s)[len] = 0;
+    return 0;
+}
+
+int remote_write_string( remote_conn_t *c, const char *s )
+{
+    int len = s ? (int)strlen( s ) : -1;
+    return remote_write_int( c, len ) || (len > 0 && remote_write( c, s, len )) ? -1 : 0;
+}
+
+/* field by field, so a 32-bit client can talk to a 64-bit server and the other way round */
+int remote_read_video_info( remote_conn_t *c, AVS_VideoInfo *vi )
+{
+    int i_samples[2];
+    memset( vi, 0, sizeof(*vi) );
+    if( remote_read_int( c, &vi->width ) || remote_read_int( c, &vi->height ) ||
+        remote_read_int( c, (int*)&vi->fps_numerator ) || remote_read_int( c, (int*)&vi->fps_denominator ) ||
+        remote_read_int( c, &vi->num_frames ) || remote_read_int( c, &vi->pixel_type ) ||
+        remote_read_int( c, &vi->audio_samples_per_second ) || remote_read_int( c, &vi->sample_type ) ||
+        remote_read_int( c, &i_samples[0] ) || remote_read_int( c, &i_samples[1] ) ||
+        remote_read_int( c, &vi->nchannels ) || remote_read_int( c, &vi->image_type ) )
+        return -1;
+    vi->num_audio_samples = ((INT64)i_samples[0] << 32) | (unsigned)i_samples[1];
+    return 0;
+}
+
+int remote_write_video_info( remote_conn_t *c, const AVS_VideoInfo *vi )
+{
+    return remote_write_int( c, vi->width ) || remote_write_int( c, vi->height ) ||
+           remote_write_int( c, vi->fps_numerator ) || remote_write_int( c, vi->fps_denominator ) ||
+           remote_write_int( c, vi->num_frames ) || remote_write_int( c, vi->pixel_type ) ||
+           remote_write_int( c, vi->audio_samples_per_second ) || remote_write_int( c, vi->sample_type ) ||
+           remote_write_int( c, (int)(vi->num_audio_samples >> 32) ) || remote_write_int( c, (int)vi->num_audio_samples ) ||
+           remote_write_int( c, vi->nchannels ) || remote_write_int( c, vi->image_type ) ? -1 : 0;
+}
+
+void remote_record( remote_conn_t *c )
+{
+    c->b_record = 1;
+    c->i_record = 0;
+}
+
+const char *remote_recorded( remote_conn_t *c, size_t *size )
+{
+    c->b_record = 0;
+    *size = c->i_record;
+    return c->record;
+}
+
+int remote_write_value( remote_conn_t *c, AVS_Value v, const remote_clips_t *clips, int b_full_paths )
+{
+    char path[4096];
+    int64_t i_size, i_mtime;
+    if( remote_write_int( c, v.type ) )
+        return -1;
+    switch( v.type )
+    {
+        case 'v': return 0;
+        case 'b': return remote_write_int( c, v.d.boolean );
+        case 'i': return remote_write_int( c, v.d.integer );
+        case 'f': return remote_write( c, &v.d.floating_pt, sizeof(float) );
+        case 'e': return remote_write_string( c, v.d.string );
+        case 's':
+            if( b_full_paths && v.d.string && !os_file_info( v.d.string, &i_size, &i_mtime ) &&
+                os_full_path( v.d.string, path, sizeof(path) ) )
+                return remote_write_string( c, path );
+            return remote_write_string( c, v.d.string );
+        case 'c': return clips && clips->write_clip ? clips->write_clip( clips->ctx, c, v ) : -1;
+        case 'a':
+            if( remote_write_int( c, v.array_size ) )
+                return -1;
+            for( int i = 0; i < v.array_size; i++ )
+                if( remote_write_value( c, v.d.array[i], clips, b_full_paths ) )
+                    return -1;
+            return 0;
+        default: return -1;
+    }
+}
+
+int remote_read_value( remote_conn_t *c, AVS_Value *v, const remote_clips_t *clips )
+{
+    int type, i;
+    char *s;
+    *v = avs_void;
+    if( remote_read_int( c, &type ) )
+        return -1;
+    switch( type )
+    {
+        case 'v': return 0;
+        case 'b':
+            if( remote_read_int( c, &i ) )
+                return -1;
+            *v = avs_new_value_bool( i );
+            return 0;
+        case 'i':
+            if( remote_read_int( c, &i ) )
+                return -1;
+            *v = avs_new_value_int( i );
+            return 0;
+        case 'f':
+        {
+            float f;
+            if( remote_read( c, &f, sizeof(f) ) )
+                return -1;
+            *v = avs_new_value_float( f );
+            return 0;
+        }
+        case 's':
+        case 'e':
+            if( remote_read_string( c, &s ) )
+                return -1;
+            *v = type == 's' ? avs_new_value_string( s ) : avs_new_value_error( s );
+            return 0;
+        case 'c': return clips && clips->read_clip ? clips->read_clip( clips->ctx, c, v ) : -1;
+        case 'a':
+        {
+            if( remote_read_int( c, &i ) || i < 0 || i > 1024 )
+                return -1;
+            AVS_Value *array = calloc( i ? i : 1, sizeof(AVS_Value) );
+            if( !array )
+                return -1;
+            *v = avs_new_value_array( array, i );
+            for( int k = 0; k < i; k++ )
+                if( remote_read_value( c, &array[k], clips ) )
+                {
+                    remote_free_value( *v );
+                    *v = avs_void;
+                    return -1;
+                }
+            return 0;
+        }
+        default: return -1;
+    }
+}
+
+void remote_free_value( AVS_Value v )
+{
+    if( v.type == 's' || v.type == 'e' )
+        free( (char*)v.d.string );
+    else if( v.type == 'a' )
+    {
+        for( int i = 0; i < v.array_size; i++ )
+            remote_free_value( v.d.array[i] );
+        free( (AVS_Value*)v.d.array );
+    }
+}
+
+int remote_frame_planes( const AVS_VideoInfo *vi, int *plane_id, int *row_size, int *height )
+{
+    int bits = avs_bits_per_component( vi );
+    int i_bytes = bits > 16 ? 4 : bits > 8 ? 2 : 1;
+    if( !avs_is_planar( vi ) )
+    {
+        /* one plane, YUY2 has two samples per pixel and RGB three or four */
+        int i_samples = avs_is_yuy2( vi ) ? 2 : (vi->pixel_type & AVS_CS_BGR32) == AVS_CS_BGR32 ? 4 :
+                        avs_is_rgb( vi ) ? 3 : 4;
+        plane_id[0] = AVS_PLANAR_Y;
+        row_size[0] = vi->width * i_samples * i_bytes;
+        height[0] = vi->height;
+        return 1;
+    }
+    if( avs_is_rgb( vi ) )
+    {
+        static const int rgb[3] = { AVS_PLANAR_G, AVS_PLANAR_B, AVS_PLANAR_R };
+        for( int p = 0; p < 3; p++ )
+        {
+            plane_id[p] = rgb[p];
+            row_size[p] = vi->width * i_bytes;
+            height[p] = vi->height;
+        }
+        return 3;
+    }
+    plane_id[0] = AVS_PLANAR_Y;
+    row_size[0] = vi->width * i_bytes;
+    height[0] = vi->height;
+    /* Y8 and its deeper versions carry the interleaved flag too */
+    if( vi->pixel_type & AVS_CS_INTERLEAVED )
+        return 1;
+    /* the subsampling codes 3, 0 and 1 stand for factors 1, 2 and 4 */
+    int i_shift_w = ((vi->pixel_type & AVS_CS_SUB_WIDTH_MASK) + 1) & 3;
+    int i_shift_h = (((vi->pixel_type & AVS_CS_SUB_HEIGHT_MASK) >> AVS_CS_SHIFT_SUB_HEIGHT) + 1) & 3;
+    for( int p = 1; p < 3; p++ )
+    {
+        plane_id[p] = p == 1 ? AVS_PLANAR_U : AVS_PLANAR_V;
+        row_size[p] = (vi->width >> i_shift_w) * i_bytes;
+        height[p] = vi->height >> i_shift_h;
+    }
+    return 3;
+}
+
+/* client */
+
+typedef struct remote_frame_t
+{
+    int n;
+    int i_planes;
+    int plane_id[MAX_PLANES];
+    int pitch[MAX_PLANES];
+    BYTE *data[MAX_PLANES];
+} remote_frame_t;
+
+struct AVS_ScriptEnvironment
+{
+    remote_conn_t *conn;
+    int b_broken;           /* the connection was lost, every call fails from then on */
+    os_mutex_t mutex;       /* one request at a time */
+    char **strings;         /* strings handed out, valid until the environment is deleted */
+    int i_strings;
+    AVS_Clip *clips;        /* clips alive */
+    AVS_Clip *streaming;    /* the clip with frames on their way */
+};
+
+struct AVS_Clip
+{
+    AVS_ScriptEnvironment *env;
+    AVS_Clip *next;
+    int handle;
+    int i_refs;
+    AVS_VideoInfo vi;
+    int version;
+    int i_next_recv;        /* frames i_next_recv up to i_requested are on their way */
+    int i_requested;
+    remote_frame_t *stash[REMOTE_STASH];
+};
+
+static const char *server_name;
+/* the error of the last frame request of each thread, as the render threads share the clip */
+static __thread const char *frame_error;
+
+void remote_set_server( const char *name )
+{
+    server_name = name;
+}
+
+static const char *keep_string( AVS_ScriptEnvironment *env, char *s )
+{
+    char **strings = realloc( env->strings, (env->i_strings + 1) * sizeof(char*) );
+    if( !strings )
+    {
+        free( s );
+        return "out of memory";
+    }
+    env->strings = strings;
+    env->strings[env->i_strings++] = s;
+    return s;
+}
+
+static void lost_connection( AVS_ScriptEnvironment *env )
+{
+    env->b_broken = 1;
+    if( env->streaming )
+        env->streaming->i_next_recv = env->streaming->i_requested;
+}
+
+static int write_clip( void *ctx, remote_conn_t *c, AVS_Value v )
+{
+    (void)ctx;
+    const AVS_Clip *clip = v.d.clip;
+    return remote_write_int( c, clip->handle );
+}
+
+/* a clip the server made, holding the reference of the value */
+static int read_clip( void *ctx, remote_conn_t *c, AVS_Value *v )
+{
+    AVS_ScriptEnvironment *env = ctx;
+    AVS_Clip *clip = calloc( 1, sizeof(AVS_Clip) );
+    if( !clip )
+        return -1;
+    if( remote_read_int( c, &clip->handle ) || remote_read_video_info( c, &clip->vi ) ||
+        remote_read_int( c, &clip->version ) )
+    {
+        free( clip );
+        return -1;
+    }
+    clip->env = env;
+    clip->i_refs = 1;
+    clip->next = env->clips;
+    env->clips = clip;
+    v->type = 'c';
+    v->array_size = 0;
+    v->d.clip = clip;
+    return 0;
+}
+
+static void free_frame( remote_frame_t *frm )
+{
+    if( frm )
+        aligned_free( frm->data[0] );
+    free( frm );
+}
+
+/* the next frame on its way, NULL with frame_error set if the server couldn't render it */
+static remote_frame_t *receive_frame( AVS_Clip *clip )
+{
+    AVS_ScriptEnvironment *env = clip->env;
+    remote_conn_t *c = env->conn;
+    int status, n = clip->i_next_recv++;
+    char *error;
+    if( remote_read_int( c, &status ) )
+        goto fail;
+    if( status )
+    {
+        if( remote_read_string( c, &error ) )
+            goto fail;
+        frame_error = keep_string( env, error ? error : strdup( "unknown error" ) );
+        return NULL;
+    }
+    remote_frame_t *frm = calloc( 1, sizeof(remote_frame_t) );
+    int row_size[MAX_PLANES], height[MAX_PLANES];
+    size_t i_size = 0;
+    if( !frm || remote_read_int( c, &frm->i_planes ) || frm->i_planes < 1 || frm->i_planes > MAX_PLANES )
+    {
+        free( frm );
+        goto fail;
+    }
+    for( int p = 0; p < frm->i_planes; p++ )
+    {
+        if( remote_read_int( c, &frm->plane_id[p] ) || remote_read_int( c, &row_size[p] ) ||
+            remote_read_int( c, &height[p] ) || row_size[p] < 0 || height[p] < 0 )
+        {
+            free( frm );
+            goto fail;
+        }
+        frm->pitch[p] = row_size[p];
+        i_size += (size_t)row_size[p] * height[p];
+    }
+    frm->n = n;
+    frm->data[0] = aligned_malloc( i_size ? i_size : 1 );
+    if( !frm->data[0] || remote_read( c, frm->data[0], i_size ) )
+    {
+        free_frame( frm );
+        goto fail;
+    }
+    for( int p = 1; p < frm->i_planes; p++ )
+        frm->data[p] = frm->data[p-1] + (size_t)row_size[p-1] * height[p-1];
+    return frm;
+fail:
+    lost_connection( env );
+    frame_error = "lost the connection to the AviSynth server";
+    return NULL;
+}
+
+static void stash_put( AVS_Clip *clip, remote_frame_t *frm )
+{
+    int k, oldest = 0;
+    for( k = 0; k < REMOTE_STASH && clip->stash[k]; k++ )
+        if( clip->stash[k]->n < clip->stash[oldest]->n )
+            oldest = k;
+    if( k == REMOTE_STASH )
+    {
+        free_frame( clip->stash[oldest] );
+        k = oldest;
+    }
+    clip->stash[k] = frm;
+}
+
+static remote_frame_t *stash_take( AVS_Clip *clip, int n )
+{
+    for( int k = 0; k < REMOTE_STASH; k++ )
+        if( clip->stash[k] && clip->stash[k]->n == n )
+        {
+            remote_frame_t *frm = clip->stash[k];
+            clip->stash[k] = NULL;
+            return frm;
+        }
+    return NULL;
+}
+
+/* take in the frames still on their way before the connection is used for something else */
+static void drain( AVS_ScriptEnvironment *env )
+{
+    AVS_Clip *clip = env->streaming;
+    while( clip && clip->i_next_recv < clip->i_requested )
+    {
+        remote_frame_t *frm = receive_frame( clip );
+        if( frm )
+            stash_put( clip, frm );
+    }
+    env->streaming = NULL;
+}
+
+static int request_frames( AVS_Clip *clip, int first, int count )
+{
+    AVS_ScriptEnvironment *env = clip->env;
+    if( remote_write_int( env->conn, REMOTE_GET_FRAMES ) || remote_write_int( env->conn, clip->handle ) ||
+        remote_write_int( env->conn, first ) || remote_write_int( env->conn, count ) || remote_flush( env->conn ) )
+    {
+        lost_connection( env );
+        return -1;
+    }
+    if( env->streaming != clip )
+        clip->i_next_recv = first;
+    env->streaming = clip;
+    clip->i_requested = first + count;
+    return 0;
+}
+
+static void clip_unref( AVS_Clip *clip )
+{
+    AVS_ScriptEnvironment *env = clip->env;
+    if( --clip->i_refs > 0 )
+        return;
+    if( env->streaming == clip )
+        drain( env );
+    if( !env->b_broken && (remote_write_int( env->conn, REMOTE_RELEASE_CLIP ) || remote_write_int( env->conn, clip->handle )) )
+        lost_connection( env );
+    for( AVS_Clip **p = &env->clips; *p; p = &(*p)->next )
+        if( *p == clip )
+        {
+            *p = clip->next;
+            break;
+        }
+    for( int k = 0; k < REMOTE_STASH; k++ )
+        free_frame( clip->stash[k] );
+    free( clip );
+}
+
+AVS_ScriptEnvironment *__stdcall remote_create_script_environment( int version )
+{
+    (void)version;  /* the server made its environment with the interface it needs */
+    int status;
+    os_handle_t h = server_name ? os_connect( server_name ) : OS_INVALID_HANDLE;
+    if( h == OS_INVALID_HANDLE )
+        return NULL;
+    AVS_ScriptEnvironment *env = calloc( 1, sizeof(AVS_ScriptEnvironment) );
+    if( !env || !(env->conn = remote_conn_open( h )) )
+    {
+        free( env );
+        os_handle_close( h );
+        return NULL;
+    }
+    if( remote_write_int( env->conn, REMOTE_HELLO ) || remote_write_int( env->conn, REMOTE_MAGIC ) ||
+        remote_write_int( env->conn, REMOTE_VERSION ) || remote_flush( env->conn ) ||
+        remote_read_int( env->conn, &status ) || status )
+    {
+        remote_conn_close( env->conn );
+        free( env );
+        return NULL;
+    }
+    os_mutex_init( &env->mutex );
+    return env;
+}
+
+/* the server releases whatever the connection still holds when it closes */
+void __stdcall remote_delete_script_environment( AVS_ScriptEnvironment *env )
+{
+    if( !env )
+        return;
+    while( env->clips )
+    {
+        AVS_Clip *clip = env->clips;
+        env->clips = clip->next;
+        for( int k = 0; k < REMOTE_STASH; k++ )
+            free_frame( clip->stash[k] );
+        free( clip );
+    }
+    remote_conn_close( env->conn );
+    for( int i = 0; i < env->i_strings; i++ )
+        free( env->strings[i] );
+    free( env->strings );
+    os_mutex_destroy( &env->mutex );
+    free( env );
+}
+
+int __stdcall remote_function_exists( AVS_ScriptEnvironment *env, const char *name )
+{
+    int ret = 0;
+    os_mutex_lock( &env->mutex );
+    drain( env );
+    if( env->b_broken || remote_write_int( env->conn, REMOTE_FUNCTION_EXISTS ) || remote_write_string( env->conn, name ) ||
+        remote_flush( env->conn ) || remote_read_int( env->conn, &ret ) )
+    {
+        lost_connection( env );
+        ret = 0;
+    }
+    os_mutex_unlock( &env->mutex );
+    return ret;
+}
+
+AVS_Value __stdcall remote_invoke( AVS_ScriptEnvironment *env, const char *name, AVS_Value args, const char **arg_names )
+{
+    remote_clips_t clips = { write_clip, read_clip, env };
+    int i_names = !arg_names ? 0 : avs_is_array( args ) ? args.array_size : 1;
+    AVS_Value res = avs_void;
+    os_mutex_lock( &env->mutex );
+    drain( env );
+    int b_fail = env->b_broken || remote_write_int( env->conn, REMOTE_INVOKE ) || remote_write_string( env->conn, name ) ||
+                 remote_write_value( env->conn, args, &clips, 1 ) || remote_write_int( env->conn, i_names );
+    for( int i = 0; i < i_names && !b_fail; i++ )
+        b_fail = remote_write_string( env->conn, arg_names[i] );
+    if( b_fail || remote_flush( env->conn ) || remote_read_value( env->conn, &res, &clips ) )
+    {
+        lost_connection( env );
+        res = avs_new_value_error( "lost the connection to the AviSynth server" );
+    }
+    else if( avs_is_string( res ) || avs_is_error( res ) )
+        res.d.string = keep_string( env, (char*)res.d.string );
+    os_mutex_unlock( &env->mutex );
+    return res;
+}
+
+AVS_Clip *__stdcall remote_take_clip( AVS_Value value, AVS_ScriptEnvironment *env )
+{
+    AVS_Clip *clip = value.d.clip;
+    os_mutex_lock( &env->mutex );
+    clip->i_refs++;
+    os_mutex_unlock( &env->mutex );
+    return clip;
+}
+
+void __stdcall remote_release_clip( AVS_Clip *clip )
+{
+    if( !clip )
+        return;
+    AVS_ScriptEnvironment *env = clip->env;
+    os_mutex_lock( &env->mutex );
+    clip_unref( clip );
+    os_mutex_unlock( &env->mutex );
+}
+
+void __stdcall remote_release_value( AVS_Value value )
+{
+    if( avs_is_clip( value ) )
+        remote_release_clip( value.d.clip );
+}
+
+const AVS_VideoInfo *__stdcall remote_get_video_info( AVS_Clip *clip )
+{
+    return &clip->vi;
+}
+
+int __stdcall remote_get_version( AVS_Clip *clip )
+{
+    return clip->version;
+}
+
+const char *__stdcall remote_clip_get_error( AVS_Clip *clip )
+{
+    (void)clip;
+    return frame_error;
+}
+
+/* frames are requested a few ahead of the one asked for, so the server renders the next ones
+   while this one is packed, and a frame another render thread asks for next is usually here */
+AVS_VideoFrame *__stdcall remote_get_frame( AVS_Clip *clip, int n )
+{
+    AVS_ScriptEnvironment *env = clip->env;
+    int i_frames = clip->vi.num_frames;
+    n = n < 0 ? 0 : n >= i_frames ? i_frames - 1 : n;
+    frame_error = NULL;
+    os_mutex_lock( &env->mutex );
+    remote_frame_t *frm = stash_take( clip, n );
+    if( !frm && env->b_broken )
+        frame_error = "lost the connection to the AviSynth server";
+    else if( !frm )
+    {
+        if( env->streaming != clip || n < clip->i_next_recv || n >= clip->i_requested )
+        {
+            drain( env );
+            request_frames( clip, n, n + REMOTE_READAHEAD < i_frames ? REMOTE_READAHEAD : i_frames - n );
+        }
+        while( !frm && clip->i_next_recv <= n && clip->i_next_recv < clip->i_requested )
+        {
+            int i_recv = clip->i_next_recv;
+            remote_frame_t *f = receive_frame( clip );
+            if( i_recv == n )
+                frm = f;
+            else if( f )
+                stash_put( clip, f );
+        }
+        if( !frm && !frame_error )
+            frame_error = "lost the connection to the AviSynth server";
+    }
+    /* keep the frames after this one coming */
+    int i_end = n + 1 + REMOTE_READAHEAD < i_frames ? n + 1 + REMOTE_READAHEAD : i_frames;
+    if( frm && !env->b_broken && env->streaming == clip && i_end - clip->i_requested >= REMOTE_READAHEAD / 2 )
+        request_frames( clip, clip->i_requested, i_end - clip->i_requested );
+    os_mutex_unlock( &env->mutex );
+    return (AVS_VideoFrame*)frm;
+}
+
+void __stdcall remote_release_video_frame( AVS_VideoFrame *frame )
+{
+    free_frame( (remote_frame_t*)frame );
+}
+
+static int plane_index( const remote_frame_t *frm, int plane )
+{
+    for( int p = 0; p < frm->i_planes; p++ )
+        if( frm->plane_id[p] == plane )
+            return p;
+    /* an interleaved frame answers for any plane, as AviSynth does */
+    return frm->i_planes == 1 ? 0 : -1;
+}
+
+int __stdcall remote_get_pitch_p( const AVS_VideoFrame *frame, int plane )
+{
+    const remote_frame_t *frm = (const remote_frame_t*)frame;
+    int p = plane_index( frm, plane & ~AVS_PLANAR_ALIGNED );
+    return p < 0 ? 0 : frm->pitch[p];
+}
+
+const BYTE *__stdcall remote_get_read_ptr_p( const AVS_VideoFrame *frame, int plane )
+{
+    const remote_frame_t *frm = (const remote_frame_t*)frame;
+    int p = plane_index( frm, plane & ~AVS_PLANAR_ALIGNED );
+    return p < 0 ? NULL : frm->data[p];
+}
+
+int __stdcall remote_set_cache_hints( AVS_Clip *clip, int cachehints, int frame_range )
+{
+    AVS_ScriptEnvironment *env = clip->env;
+    int ret = 0;
+    os_mutex_lock( &env->mutex );
+    drain( env );
+    if( env->b_broken || remote_write_int( env->conn, REMOTE_SET_CACHE_HINTS ) || remote_write_int( env->conn, clip->handle ) ||
+        remote_write_int( env->conn, cachehints ) || remote_write_int( env->conn, frame_range ) ||
+        remote_flush( env->conn ) || remote_read_int( env->conn, &ret ) )
+    {
+        lost_connection( env );
+        ret = 0;
+    }
+    os_mutex_unlock( &env->mutex );
+    return ret;
+}
@@ -0,0 +1,87 @@
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+
+/* the AviSynth C API across a local connection to avs4x26x --serve. the client half implements
+   the functions avs4x26x loads from the library, so an encode runs unchanged against a server
+   that keeps AviSynth, its plugins and the opened sources loaded. values cross the connection
+   by type, clips as a handle with their video info, frames as their planes packed without padding.
+   include after avisynth_c.h */
+
+#ifndef AVS4X26X_REMOTE_H
+#define AVS4X26X_REMOTE_H
+
+#include "osdep.h"
+
+#define REMOTE_MAGIC   0x78327661   /* "av2x" */
+#define REMOTE_VERSION 1
+
+/* requests, each answered in order before the next one is read */
+enum
+{
+    REMOTE_HELLO = 1,           /* magic, version -> 0 */
+    REMOTE_FUNCTION_EXISTS,     /* name -> int */
+    REMOTE_INVOKE,              /* name, args, names -> value */
+    REMOTE_RELEASE_CLIP,        /* handle, no answer */
+    REMOTE_GET_FRAMES,          /* handle, first, count -> count frames */
+    REMOTE_SET_CACHE_HINTS,     /* handle, hints, range -> int */
+};
+
+/* a connection with buffered reads and writes, the writes go out on remote_flush */
+typedef struct remote_conn_t remote_conn_t;
+
+remote_conn_t *remote_conn_open( os_handle_t h );
+void remote_conn_close( remote_conn_t *c );
+int remote_read( remote_conn_t *c, void *buf, size_t size );
+int remote_write( remote_conn_t *c, const void *buf, size_t size );
+int remote_flush( remote_conn_t *c );
+int remote_read_int( remote_conn_t *c, int *v );
+int remote_write_int( remote_conn_t *c, int v );
+/* a NULL string crosses as NULL, a string read is allocated with malloc */
+int remote_read_string( remote_conn_t *c, char **s );
+int remote_write_string( remote_conn_t *c, const char *s );
+int remote_read_video_info( remote_conn_t *c, AVS_VideoInfo *vi );
+int remote_write_video_info( remote_conn_t *c, const AVS_VideoInfo *vi );
+/* keep a copy of what is read from now on, until remote_recorded hands it out. the copy stays
+   valid until the next recording */
+void remote_record( remote_conn_t *c );
+const char *remote_recorded( remote_conn_t *c, size_t *size );
+
+/* how clips cross the connection, which is up to each end */
+typedef struct
+{
+    int (*write_clip)( void *ctx, remote_conn_t *c, AVS_Value v );
+    int (*read_clip)( void *ctx, remote_conn_t *c, AVS_Value *v );
+    void *ctx;
+} remote_clips_t;
+
+/* b_full_paths sends strings naming an existing file as its absolute path, as the server
+   has a working directory of its own */
+int remote_write_value( remote_conn_t *c, AVS_Value v, const remote_clips_t *clips, int b_full_paths );
+int remote_read_value( remote_conn_t *c, AVS_Value *v, const remote_clips_t *clips );
+/* free the strings and arrays of a value read with remote_read_value, clips are left alone */
+void remote_free_value( AVS_Value v );
+
+/* the planes of a frame of this format as sent, returns their number */
+int remote_frame_planes( const AVS_VideoInfo *vi, int *plane_id, int *row_size, int *height );
+
+/* client: the functions of avs_hnd_t.func talking to the server at name */
+void remote_set_server( const char *name );
+const char *__stdcall remote_clip_get_error( AVS_Clip *clip );
+AVS_ScriptEnvironment *__stdcall remote_create_script_environment( int version );
+void __stdcall remote_delete_script_environment( AVS_ScriptEnvironment *env );
+AVS_VideoFrame *__stdcall remote_get_frame( AVS_Clip *clip, int n );
+int __stdcall remote_get_version( AVS_Clip *clip );
+const AVS_VideoInfo *__stdcall remote_get_video_info( AVS_Clip *clip );
+int __stdcall remote_function_exists( AVS_ScriptEnvironment *env, const char *name );
+AVS_Value __stdcall remote_invoke( AVS_ScriptEnvironment *env, const char *name, AVS_Value args, const char **arg_names );
+void __stdcall remote_release_clip( AVS_Clip *clip );
+void __stdcall remote_release_value( AVS_Value value );
+void __stdcall remote_release_video_frame( AVS_VideoFrame *frame );
+AVS_Clip *__stdcall remote_take_clip( AVS_Value value, AVS_ScriptEnvironment *env );
+int __stdcall remote_get_pitch_p( const AVS_VideoFrame *frame, int plane );
+const BYTE *__stdcall remote_get_read_ptr_p( const AVS_VideoFrame *frame, int plane );
+int __stdcall remote_set_cache_hints( AVS_Clip *clip, int cachehints, int frame_range );
+
+#endif